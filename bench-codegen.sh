@@ -0,0 +1,84 @@
+#!/bin/bash
+#
+# Cost of the calls of the backtracking matcher: throughput of jgrep-jit on
+# star-heavy patterns with each --codegen mode. "calls" makes a function per
+# x* and calls it at every position the star reaches, "backtrack" makes the
+# same search one function per pattern, and "auto" is the DFA when it fits.
+# Most lines of the input have the bytes of the patterns, so the scan cannot
+# skip them and the time goes to backtracking.
+#
+# usage: bench-codegen.sh [program]
+#
+# The program defaults to ./jgrep-jit and may carry options, e.g.
+# bench-codegen.sh "./jgrep-jit -j 4". The input, of $BENCH_MB MiB (default
+# 64), is generated once. Every run is repeated $BENCH_REPEAT times (default
+# 3) with a warm cache, and the fastest one is kept. Prints one line per
+# pattern and mode, with the speedup over "calls" and the time of a run on an
+# empty input without the cache, which goes to compiling the matcher:
+#
+#   pattern mode seconds MB/s speedup compile_ms
+
+BENCH_MB=${BENCH_MB:-64}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+PROG=${1:-./jgrep-jit}
+FILE=bench-codegen.txt
+
+PATTERNS=(
+  'h*i*t* *e*r*ror.*w*a*warn'
+  'e.*e.*e.*e.*k$'
+  '.*o.*o.*n$'
+  'a.*b.*c.*d'
+  'o.*o.*o.*o.*o.*o.*o.*q'
+)
+
+export JGREP_CACHE_DIR=$(mktemp -d)
+EMPTY=$(mktemp)
+trap 'rm -rf "$JGREP_CACHE_DIR" "$EMPTY"' EXIT
+
+if [ ! -f "$FILE" ]; then
+  echo "generating $FILE ($BENCH_MB MiB)" >&2
+  # Lines of 40 to 120 bytes, one in 100 matching the first pattern
+  awk -v size=$((BENCH_MB * 1024 * 1024)) 'BEGIN {
+    srand(1)
+    filler = "the quick brown fox jumps over the lazy dog again and again "
+    filler = filler filler
+    for (n = 0; n < size; n += length(line) + 1) {
+      line = substr(filler, 1 + int(rand() * 10), 40 + int(rand() * 80))
+      if (i++ % 100 == 0)
+        line = "hit error " line " warn"
+      print line
+    }
+  }' > "$FILE"
+fi
+
+SIZE=$(stat -c %s "$FILE")
+cat "$FILE" > /dev/null
+
+# Seconds of the fastest of BENCH_REPEAT runs of a command
+fastest() {
+  local best=
+  for ((r = 0; r < BENCH_REPEAT; r++)); do
+    local start=$(date +%s.%N)
+    "$@" > /dev/null
+    local end=$(date +%s.%N)
+    best=$(awk -v s=$start -v e=$end -v b="$best" \
+      'BEGIN { t = e - s; print ((b == "" || t < b) ? t : b) }')
+  done
+  echo $best
+}
+
+printf "%-28s %-10s %9s %9s %8s %10s\n" pattern mode seconds MB/s speedup compile_ms
+for regex in "${PATTERNS[@]}"; do
+  calls=
+  for mode in calls backtrack auto; do
+    compile=$(fastest $PROG --no-cache --codegen=$mode "$regex" "$EMPTY")
+
+    # Caches the matcher
+    $PROG --codegen=$mode "$regex" "$FILE" > /dev/null
+
+    t=$(fastest $PROG --codegen=$mode "$regex" "$FILE")
+    calls=${calls:-$t}
+    awk -v p="$regex" -v m=$mode -v t=$t -v c=$calls -v n=$SIZE -v cm=$compile \
+      'BEGIN { printf "%-28s %-10s %9.3f %9.1f %7.2fx %10.1f\n", p, m, t, n / t / 1e6, c / t, cm * 1000 }'
+  done
+done
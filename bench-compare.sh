@@ -0,0 +1,23 @@
+#!/bin/bash
+#
+# Compares two results files of bench.sh, e.g. of two commits.
+#
+# usage: bench-compare.sh old.tsv new.tsv
+#
+# Prints, for every program, pattern and corpus in both files, the MB/s and
+# compile time of each and the speedup of new over old.
+
+if [ $# -ne 2 ]; then
+  echo "usage: $0 old.tsv new.tsv" >&2
+  exit 1
+fi
+
+awk -F '\t' '
+  FNR == 1 { next }
+  { key = $2 "\t" $3 "\t" $4 "\t" $5 "\t" $6 }
+  NR == FNR { old_mbs[key] = $8; old_compile[key] = $9; next }
+  key in old_mbs {
+    printf "%-16s %-14s %4d MiB %4d B %3d%%  %9.1f -> %9.1f MB/s  x%5.2f  compile %8.3f -> %8.3f ms\n",
+      $2, $3, $4, $5, $6, old_mbs[key], $8, $8 / old_mbs[key], old_compile[key], $9
+  }
+' "$1" "$2"
@@ -0,0 +1,104 @@
+#!/bin/bash
+#
+# Which --io backend reads fastest: throughput of a program with each of them
+# on a big file whose pages are not cached (cold), the same file once cached
+# (hot) and a tree of many small files, cold and hot.
+#
+# usage: bench-io.sh [program]
+#
+# The program, ./jgrep-jit by default, may carry options, e.g.
+# bench-io.sh "./jgrep-jit -j 4". The big file has $BENCH_MB MiB (default
+# 256) and the tree $BENCH_FILES files of 1 to 8 KiB (default 20000); both
+# are generated once. Pages are dropped from the page cache with
+# posix_fadvise, through dd iflag=nocache, so no root is needed; the cold
+# runs are only cold where the kernel honours it. Prints one line per
+# workload and backend, then the fastest backend of each workload:
+#
+#   workload backend seconds MB/s
+
+BENCH_MB=${BENCH_MB:-256}
+BENCH_FILES=${BENCH_FILES:-20000}
+BACKENDS="mmap read direct uring"
+PROG=${1:-./jgrep-jit}
+FILE=bench-io.txt
+TREE=bench-io-tree
+RESULTS=${TMPDIR:-/tmp}/jgrep-bench-io.$$
+
+trap 'rm -f "$RESULTS"' EXIT
+
+if [ ! -f "$FILE" ]; then
+  echo "generating $FILE ($BENCH_MB MiB)" >&2
+  awk -v size=$((BENCH_MB * 1024 * 1024)) 'BEGIN {
+    srand(1)
+    filler = "the quick brown fox jumps over the lazy dog again and again "
+    filler = filler filler
+    for (n = 0; n < size; n += length(line) + 1) {
+      line = (i++ % 100 == 0 ? "hit " : "miss ") substr(filler, 1, 35 + int(rand() * 80))
+      print line
+    }
+  }' > "$FILE"
+fi
+
+if [ ! -d "$TREE" ]; then
+  echo "generating $TREE ($BENCH_FILES files)" >&2
+  mkdir -p "$TREE"
+  awk -v files=$BENCH_FILES -v dir="$TREE" 'BEGIN {
+    srand(2)
+    filler = "the quick brown fox jumps over the lazy dog again and again "
+    filler = filler filler
+    for (f = 0; f < files; f++) {
+      # 100 files per directory
+      path = sprintf("%s/%03d", dir, f / 100)
+      if (f % 100 == 0)
+        system("mkdir -p " path)
+      path = sprintf("%s/%05d.txt", path, f)
+      size = 1024 + int(rand() * 7 * 1024)
+      for (n = 0; n < size; n += length(line) + 1) {
+        line = (i++ % 100 == 0 ? "hit " : "miss ") substr(filler, 1, 35 + int(rand() * 80))
+        print line > path
+      }
+      close(path)
+    }
+  }'
+fi
+
+drop_cache() {
+  find "$@" -type f -exec dd if={} iflag=nocache count=0 status=none \;
+}
+
+warm_cache() {
+  find "$@" -type f -exec cat {} + > /dev/null
+}
+
+FILE_SIZE=$(stat -c %s "$FILE")
+TREE_SIZE=$(find "$TREE" -type f -printf "%s\n" | awk '{ n += $1 } END { print n }')
+
+# run workload cache recursive target size
+run() {
+  local workload=$1 cache=$2 flags=$3 target=$4 size=$5
+  for io in $BACKENDS; do
+    $cache "$target"
+    start=$(date +%s.%N)
+    $PROG $flags --io=$io -c '^hit' "$target" > /dev/null
+    end=$(date +%s.%N)
+    awk -v w=$workload -v io=$io -v s=$start -v e=$end -v n=$size \
+      'BEGIN { t = e - s; printf "%-12s %-8s %9.3f %9.1f\n", w, io, t, n / t / 1e6 }'
+  done
+}
+
+printf "%-12s %-8s %9s %9s\n" workload backend seconds MB/s
+{
+  run cold drop_cache "" "$FILE" $FILE_SIZE
+  run hot warm_cache "" "$FILE" $FILE_SIZE
+  run small-cold drop_cache -r "$TREE" $TREE_SIZE
+  run small-hot warm_cache -r "$TREE" $TREE_SIZE
+} | tee "$RESULTS"
+
+awk '
+  $3 > 0 && (!($1 in best) || $3 < time[$1]) { best[$1] = $2; time[$1] = $3 }
+  { if (!($1 in seen)) { seen[$1] = 1; order[n++] = $1 } }
+  END {
+    print ""
+    for (i = 0; i < n; i++)
+      printf "fastest on %-12s %s\n", order[i] ":", best[order[i]]
+  }' "$RESULTS"
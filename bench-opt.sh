@@ -0,0 +1,119 @@
+#!/bin/bash
+#
+# What each codegen profile (-O and --march) costs to compile and gives back
+# while scanning: for each shape of pattern, the time jgrep-jit takes to
+# compile the matcher and its throughput on a big file with every profile.
+# An input of a few MB is better served by a profile that compiles fast, a
+# big one by the fastest scan; the break-even column tells where the line is.
+#
+# usage: bench-opt.sh [program]
+#
+# The program defaults to ./jgrep-jit and may carry options, e.g.
+# bench-opt.sh "./jgrep-jit -j 4". The input, of $BENCH_MB MiB (default 64),
+# is generated once. Every run is repeated $BENCH_REPEAT times (default 3)
+# and the fastest one is kept. compile_ms is a run on an empty input without
+# the cache; the scan runs load the matcher from a warm cache, so they time
+# the scan alone. Prints one line per pattern and profile:
+#
+#   shape profile compile_ms seconds MB/s breakeven_MB
+#
+# where breakeven_MB is the input size above which the profile beats the
+# first one (O0) once its compile time is counted, or "-" if it never does.
+
+BENCH_MB=${BENCH_MB:-64}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+PROG=${1:-./jgrep-jit}
+FILE=bench-opt.txt
+
+PROFILES=(
+  "-O0"
+  "-O1"
+  "-O2"
+  "-O3"
+  "-O2 --march=native"
+  "-O3 --march=native"
+)
+
+# shape:options:regexp
+SHAPES=(
+  "literal::needle"
+  "folded:-i:NeeDLe"
+  "class::[0-9][0-9]*-[a-f]x"
+  "anchored::^hit.*warn$"
+  "star::h*i*t* *e*r*ror.*w*a*warn"
+  "backtrack:--codegen=backtrack:e.*e.*e.*e.*k$"
+)
+
+export JGREP_CACHE_DIR=$(mktemp -d)
+EMPTY=$(mktemp)
+trap 'rm -rf "$JGREP_CACHE_DIR" "$EMPTY"' EXIT
+
+if [ ! -f "$FILE" ]; then
+  echo "generating $FILE ($BENCH_MB MiB)" >&2
+  # Lines of 40 to 120 bytes, one in 100 matching the anchored and star
+  # shapes and one in 1000 the others
+  awk -v size=$((BENCH_MB * 1024 * 1024)) 'BEGIN {
+    srand(1)
+    filler = "the quick brown fox jumps over the lazy dog again and again "
+    filler = filler filler
+    for (n = 0; n < size; n += length(line) + 1) {
+      line = substr(filler, 1 + int(rand() * 10), 40 + int(rand() * 80))
+      if (i % 100 == 0)
+        line = "hit error " line " warn"
+      if (i++ % 1000 == 500)
+        line = line " 42-fx needle"
+      print line
+    }
+  }' > "$FILE"
+fi
+
+SIZE=$(stat -c %s "$FILE")
+cat "$FILE" > /dev/null
+
+# Seconds of the fastest of BENCH_REPEAT runs of a command
+fastest() {
+  local best=
+  for ((r = 0; r < BENCH_REPEAT; r++)); do
+    local start=$(date +%s.%N)
+    "$@" > /dev/null
+    local end=$(date +%s.%N)
+    best=$(awk -v s=$start -v e=$end -v b="$best" \
+      'BEGIN { t = e - s; print ((b == "" || t < b) ? t : b) }')
+  done
+  echo $best
+}
+
+printf "%-10s %-20s %10s %9s %9s %12s\n" shape profile compile_ms seconds MB/s breakeven_MB
+for shape in "${SHAPES[@]}"; do
+  name=${shape%%:*}
+  rest=${shape#*:}
+  read -r -a args <<< "${rest%%:*}"
+  args+=("${rest#*:}")
+  base_compile=
+  base_seconds=
+  for profile in "${PROFILES[@]}"; do
+    read -r -a opts <<< "$profile"
+    compile=$(fastest $PROG "${opts[@]}" --no-cache "${args[@]}" "$EMPTY")
+
+    # Caches the matcher
+    $PROG "${opts[@]}" "${args[@]}" "$FILE" > /dev/null
+
+    t=$(fastest $PROG -c "${opts[@]}" "${args[@]}" "$FILE")
+    base_compile=${base_compile:-$compile}
+    base_seconds=${base_seconds:-$t}
+    awk -v s=$name -v p="$profile" -v c=$compile -v t=$t -v n=$SIZE \
+        -v c0=$base_compile -v t0=$base_seconds 'BEGIN {
+      # Seconds per byte saved by the scan against compile seconds lost
+      saved = (t0 - t) / n
+      if (p == "-O0")
+        breakeven = "-"
+      else if (c <= c0 && saved >= 0)
+        breakeven = "0"
+      else if (saved <= 0)
+        breakeven = "-"
+      else
+        breakeven = sprintf("%.1f", (c - c0) / saved / 1e6)
+      printf "%-10s %-20s %10.1f %9.3f %9.1f %12s\n", s, p, c * 1000, t, n / t / 1e6, breakeven
+    }'
+  done
+done
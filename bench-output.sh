@@ -0,0 +1,51 @@
+#!/bin/bash
+#
+# Cost of writing the hits: throughput of the jgrep programs on inputs where
+# 1%, 50% and 100% of the lines match.
+#
+# usage: bench-output.sh [program...]
+#
+# Each program may carry options, e.g. bench-output.sh "./jgrep-jit -j 4".
+#
+# The inputs, of $BENCH_MB MiB each (default 128), are generated once. The
+# hits are written to a file of $TMPDIR rather than to /dev/null, whose
+# writes cost nothing. Prints one line per program and match rate:
+#
+#   program match% seconds MB/s
+
+BENCH_MB=${BENCH_MB:-128}
+OUT=${TMPDIR:-/tmp}/jgrep-bench-output.$$
+if [ $# -eq 0 ]; then
+  set -- ./jgrep-basic ./jgrep-jit ./jgrep-concurrent
+fi
+
+trap 'rm -f "$OUT"' EXIT
+
+printf "%-24s %7s %9s %9s\n" program match% seconds MB/s
+for rate in 1 50 100; do
+  FILE=bench-output-$rate.txt
+  if [ ! -f "$FILE" ]; then
+    echo "generating $FILE ($BENCH_MB MiB)" >&2
+    # Lines of 40 to 120 bytes, 'rate' in 100 of them starting with "hit"
+    awk -v rate=$rate -v size=$((BENCH_MB * 1024 * 1024)) 'BEGIN {
+      srand(1)
+      filler = "the quick brown fox jumps over the lazy dog again and again "
+      filler = filler filler
+      for (n = 0; n < size; n += length(line) + 1) {
+        line = (i++ % 100 < rate ? "hit " : "miss ") substr(filler, 1, 35 + int(rand() * 80))
+        print line
+      }
+    }' > "$FILE"
+  fi
+
+  SIZE=$(stat -c %s "$FILE")
+  cat "$FILE" > /dev/null
+
+  for prog in "$@"; do
+    start=$(date +%s.%N)
+    $prog '^hit' "$FILE" > "$OUT"
+    end=$(date +%s.%N)
+    awk -v p="$prog" -v r=$rate -v s=$start -v e=$end -v n=$SIZE \
+      'BEGIN { t = e - s; printf "%-24s %7d %9.3f %9.1f\n", p, r, t, n / t / 1e6 }'
+  done
+done
@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Throughput of the jgrep programs as the number of scanning threads grows.
+#
+# usage: bench-scaling.sh [file [regex [max-threads]]]
+#
+# Without a file, a synthetic one of $BENCH_MB MiB (default 256) is generated
+# once. Prints one line per program and thread count:
+#
+#   program threads seconds MB/s
+
+FILE=${1:-}
+REGEX=${2:-'a.*b.*c'}
+MAX_THREADS=${3:-$(nproc)}
+BENCH_MB=${BENCH_MB:-256}
+
+if [ -z "$FILE" ]; then
+  FILE=bench-input.txt
+  if [ ! -f "$FILE" ]; then
+    echo "generating $FILE ($BENCH_MB MiB)" >&2
+    # Lines of random lowercase words, few of them matching the default regex
+    head -c $((BENCH_MB * 1024 * 1024 * 3 / 4)) /dev/urandom \
+      | base64 -w 76 | tr 'A-Z0-9+/' 'a-zj-z  ' > "$FILE"
+  fi
+fi
+
+SIZE=$(stat -c %s "$FILE")
+
+threads="1"
+t=2
+while [ $t -le $MAX_THREADS ]; do
+  threads="$threads $t"
+  t=$((t * 2))
+done
+case " $threads " in
+  *" $MAX_THREADS "*) ;;
+  *) threads="$threads $MAX_THREADS" ;;
+esac
+
+# Warm the page cache so that every run measures the scan, not the disk
+cat "$FILE" > /dev/null
+
+printf "%-18s %7s %9s %9s\n" program threads seconds MB/s
+for prog in ./jgrep-basic ./jgrep-jit ./jgrep-concurrent; do
+  for j in $threads; do
+    start=$(date +%s.%N)
+    $prog -j $j "$REGEX" "$FILE" > /dev/null
+    end=$(date +%s.%N)
+    awk -v p=$prog -v j=$j -v s=$start -v e=$end -v n=$SIZE \
+      'BEGIN { t = e - s; printf "%-18s %7d %9.3f %9.1f\n", p, j, t, n / t / 1e6 }'
+  done
+done
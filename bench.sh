@@ -0,0 +1,151 @@
+#!/bin/bash
+#
+# Throughput benchmark of jgrep-basic, jgrep-jit and jgrep-concurrent over a
+# matrix of synthetic corpora and pattern shapes.
+#
+# usage: bench.sh [results-file]
+#
+# Corpora are generated once in bench-corpus/, one per combination of
+#
+#   BENCH_SIZES         sizes in MiB (default "1 32")
+#   BENCH_LINE_LENGTHS  average line lengths in bytes (default "40 400")
+#   BENCH_HIT_RATES     percentages of matching lines (default "1 50")
+#
+# Every run is repeated BENCH_REPEAT times (default 3) and the fastest one is
+# kept. Results are tab-separated, one line per program, corpus and pattern,
+# written to stdout and to the results file (default
+# bench-results/<commit>.tsv) so that runs of different commits can be
+# compared with bench-compare.sh:
+#
+#   commit program pattern size_mb line_length hit_rate seconds MB/s compile_ms first_output_ms
+#
+# compile_ms is the time to build the matcher without the cache, measured on
+# an empty input, minus the time jgrep-basic takes on it. first_output_ms is
+# the time until the first hit is written. The matchers are cached before the
+# throughput runs, so seconds and MB/s measure the scan.
+
+BENCH_SIZES=${BENCH_SIZES:-1 32}
+BENCH_LINE_LENGTHS=${BENCH_LINE_LENGTHS:-40 400}
+BENCH_HIT_RATES=${BENCH_HIT_RATES:-1 50}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+
+PROGRAMS="./jgrep-basic ./jgrep-jit ./jgrep-concurrent"
+
+# Every hit line starts with "hit", has "error" followed by "warn" and ends
+# with "end", so that each shape matches the same lines
+PATTERNS=(
+  literal 'error'
+  dotstar 'error.*warn'
+  anchored-start '^hit'
+  anchored-end 'end$'
+  star-heavy 'h*i*t* *e*r*ror.*w*a*warn'
+)
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+if ! git diff --quiet HEAD -- '*.c' '*.h' 2>/dev/null; then
+  COMMIT="$COMMIT-dirty"
+fi
+RESULTS=${1:-bench-results/$COMMIT.tsv}
+mkdir -p "$(dirname "$RESULTS")" bench-corpus
+
+# The cache of this run only, so that compile times are not hidden by a
+# previous run and no run measures a stale entry
+export JGREP_CACHE_DIR=$(mktemp -d)
+EMPTY=$(mktemp)
+trap 'rm -rf "$JGREP_CACHE_DIR" "$EMPTY"' EXIT
+
+now() {
+  date +%s.%N
+}
+
+# Seconds of the fastest of BENCH_REPEAT runs of a command
+fastest() {
+  local best=
+  for ((r = 0; r < BENCH_REPEAT; r++)); do
+    local start=$(now)
+    "$@" > /dev/null
+    local end=$(now)
+    best=$(awk -v s=$start -v e=$end -v b="$best" \
+      'BEGIN { t = e - s; print ((b == "" || t < b) ? t : b) }')
+  done
+  echo $best
+}
+
+# Seconds until the first byte of output. head exits after it, and the
+# program dies of SIGPIPE on its next write.
+first_output() {
+  local best=
+  for ((r = 0; r < BENCH_REPEAT; r++)); do
+    local start=$(now)
+    "$@" | head -c 1 > /dev/null
+    local end=$(now)
+    best=$(awk -v s=$start -v e=$end -v b="$best" \
+      'BEGIN { t = e - s; print ((b == "" || t < b) ? t : b) }')
+  done
+  echo $best
+}
+
+corpus() {
+  local size=$1 length=$2 rate=$3
+  local file=bench-corpus/$size-$length-$rate.txt
+  if [ ! -f "$file" ]; then
+    echo "generating $file" >&2
+    awk -v size=$((size * 1024 * 1024)) -v len=$length -v rate=$rate 'BEGIN {
+      srand(1)
+      filler = "the quick brown fox jumps over the lazy dog "
+      while (length(filler) < 2 * len)
+        filler = filler filler
+      for (n = 0; n < size; n += length(line) + 1) {
+        l = int(len / 2 + rand() * len)
+        if (i++ % 100 < rate)
+          line = "hit error " substr(filler, 1, l > 20 ? l - 20 : 0) " warn end"
+        else
+          line = substr(filler, 1 + int(rand() * 8), l)
+        print line
+      }
+    }' > "$file"
+  fi
+  echo $file
+}
+
+declare -A compile_ms
+
+printf "commit\tprogram\tpattern\tsize_mb\tline_length\thit_rate\tseconds\tMB/s\tcompile_ms\tfirst_output_ms\n" \
+  | tee "$RESULTS"
+
+for ((p = 0; p < ${#PATTERNS[@]}; p += 2)); do
+  shape=${PATTERNS[p]}
+  regex=${PATTERNS[p + 1]}
+
+  # Startup alone, then startup and compile
+  base=$(fastest ./jgrep-basic "$regex" "$EMPTY")
+  for prog in $PROGRAMS; do
+    t=$(fastest $prog --no-cache --jit=blocking "$regex" "$EMPTY")
+    compile_ms[$prog]=$(awk -v t=$t -v b=$base 'BEGIN { c = (t - b) * 1000; printf "%.3f", (c > 0 ? c : 0) }')
+  done
+
+  for size in $BENCH_SIZES; do
+    for length in $BENCH_LINE_LENGTHS; do
+      for rate in $BENCH_HIT_RATES; do
+        file=$(corpus $size $length $rate)
+        bytes=$(stat -c %s "$file")
+        cat "$file" > /dev/null
+
+        for prog in $PROGRAMS; do
+          # Caches the matcher
+          $prog "$regex" "$file" > /dev/null
+
+          seconds=$(fastest $prog "$regex" "$file")
+          first=$(first_output $prog "$regex" "$file")
+          awk -v c=$COMMIT -v p=${prog#./} -v s=$shape -v mb=$size -v l=$length -v r=$rate \
+            -v t=$seconds -v n=$bytes -v cm=${compile_ms[$prog]} -v f=$first 'BEGIN {
+              printf "%s\t%s\t%s\t%d\t%d\t%d\t%.4f\t%.1f\t%s\t%.3f\n",
+                c, p, s, mb, l, r, t, n / t / 1e6, cm, f * 1000
+            }'
+        done
+      done
+    done
+  done | tee -a "$RESULTS"
+done
+
+echo "results in $RESULTS" >&2
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jgrep-ac.h"
+
+int ac_build(struct ac_automaton *ac, const struct ac_literal *literals, int num_literals,
+    int ignore_case)
+{
+  memset(ac, 0, sizeof(*ac));
+
+  // Class 0 is every byte that appears in no literal
+  ac->num_classes = 1;
+  for (int i = 0; i < num_literals; i++)
+    for (int j = 0; j < literals[i].length; j++)
+    {
+      unsigned char c = literals[i].text[j];
+      if (ac->byte_class[c] == 0)
+        ac->byte_class[c] = ac->num_classes++;
+    }
+  if (ignore_case)
+    for (int c = 'A'; c <= 'Z'; c++)
+      ac->byte_class[c] = ac->byte_class[c - 'A' + 'a'];
+
+  size_t max_states = 1;
+  for (int i = 0; i < num_literals; i++)
+    max_states += literals[i].length;
+
+  int num_classes = ac->num_classes;
+  ac->next = malloc(sizeof(*ac->next) * max_states * num_classes);
+  ac->flags = calloc(max_states, sizeof(*ac->flags));
+  ac->candidates = calloc(max_states, sizeof(*ac->candidates));
+  int32_t *fail = malloc(sizeof(*fail) * max_states);
+  int32_t *queue = malloc(sizeof(*queue) * max_states);
+  if (ac->next == NULL || ac->flags == NULL || ac->candidates == NULL
+      || fail == NULL || queue == NULL)
+    goto error;
+
+  // The trie, with -1 for missing edges
+  memset(ac->next, -1, sizeof(*ac->next) * num_classes);
+  ac->num_states = 1;
+  for (int i = 0; i < num_literals; i++)
+  {
+    int s = 0;
+    for (int j = 0; j < literals[i].length; j++)
+    {
+      int c = ac->byte_class[(unsigned char)literals[i].text[j]];
+      int32_t *edge = &ac->next[(size_t)s * num_classes + c];
+      if (*edge < 0)
+      {
+        *edge = ac->num_states++;
+        memset(&ac->next[(size_t)*edge * num_classes], -1, sizeof(*ac->next) * num_classes);
+      }
+      s = *edge;
+    }
+
+    if (literals[i].part < 0)
+      ac->flags[s] |= AC_MATCH;
+    else
+    {
+      ac->flags[s] |= AC_CANDIDATE;
+      ac->candidates[s] |= (uint64_t)1 << literals[i].part;
+    }
+  }
+
+  // Breadth first, so that the failure state of every state (the longest
+  // proper suffix of its string that is in the trie) is complete before it is
+  // used. Missing edges are replaced by the edges of the failure state.
+  int head = 0, tail = 0;
+  for (int c = 0; c < num_classes; c++)
+  {
+    int32_t *edge = &ac->next[c];
+    if (*edge < 0)
+      *edge = 0;
+    else
+    {
+      fail[*edge] = 0;
+      queue[tail++] = *edge;
+    }
+  }
+
+  while (head < tail)
+  {
+    int s = queue[head++];
+    ac->flags[s] |= ac->flags[fail[s]];
+    ac->candidates[s] |= ac->candidates[fail[s]];
+
+    for (int c = 0; c < num_classes; c++)
+    {
+      int32_t *edge = &ac->next[(size_t)s * num_classes + c];
+      int32_t fallback = ac->next[(size_t)fail[s] * num_classes + c];
+      if (*edge < 0)
+        *edge = fallback;
+      else
+      {
+        fail[*edge] = fallback;
+        queue[tail++] = *edge;
+      }
+    }
+  }
+
+  free(fail);
+  free(queue);
+  return 0;
+
+error:
+  free(fail);
+  free(queue);
+  ac_free(ac);
+  return -1;
+}
+
+void ac_free(struct ac_automaton *ac)
+{
+  free(ac->next);
+  free(ac->flags);
+  free(ac->candidates);
+  memset(ac, 0, sizeof(*ac));
+}
@@ -0,0 +1,48 @@
+#ifndef JGREP_AC_H
+#define JGREP_AC_H
+
+#include <stdint.h>
+
+// Aho-Corasick automaton of a set of literals, with its failure links folded
+// into a complete transition table: matching reads every byte of the line
+// once and follows one transition per byte.
+//
+// Bytes that appear in no literal all behave the same, so the table has a
+// column per byte class rather than per byte, which keeps it small enough
+// for thousands of literals.
+//
+// Every literal is either a whole pattern, so finding it means the line
+// matches, or the literal part of a more complex pattern, which only makes
+// that pattern worth checking. The latter are numbered 0 to 63 and reported
+// as a bit mask.
+enum
+{
+  AC_MATCH = 1,     // A whole pattern ends here
+  AC_CANDIDATE = 2, // A literal part ends here, see candidates
+};
+
+struct ac_automaton
+{
+  int num_states;  // State 0 is the start
+  int num_classes;
+  uint8_t byte_class[256];
+  int32_t *next;   // next[state * num_classes + class]
+  uint8_t *flags;  // AC_MATCH and AC_CANDIDATE of each state
+  uint64_t *candidates; // Literal parts ending in each state
+};
+
+struct ac_literal
+{
+  const char *text;
+  int length;
+  int part;        // -1 for a whole pattern, else 0 to 63
+};
+
+// With 'ignore_case', the literals are in lowercase and every uppercase ASCII
+// letter of the text shares the byte class of its lowercase. Returns 0 on
+// success and -1 if out of memory.
+int ac_build(struct ac_automaton *ac, const struct ac_literal *literals, int num_literals,
+    int ignore_case);
+void ac_free(struct ac_automaton *ac);
+
+#endif // JGREP_AC_H
@@ -2,76 +2,86 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
-static int matchstar(int c, const char *regexp, const char *text);
+#include "jgrep-input.h"
+#include "jgrep-interp.h"
+#include "jgrep-options.h"
+#include "jgrep-scan.h"
+#include "jgrep-stats.h"
+#include "jgrep-walk.h"
 
-/* matchhere: search for regexp at beginning of text */
-static int matchhere(const char *regexp, const char *text)
-{
-    if (regexp[0] == '\0')
-        return 1;
-    if (regexp[1] == '*')
-        return matchstar(regexp[0], regexp+2, text);
-    if (regexp[0] == '$' && regexp[1] == '\0')
-        return *text == '\0';
-    if (*text!='\0' && (regexp[0]=='.' || regexp[0]==*text))
-        return matchhere(regexp+1, text+1);
-    return 0;
-}
+static const struct re_list *patterns;
 
-/* matchstar: search for c*regexp at beginning of text */
-static int matchstar(int c, const char *regexp, const char *text)
+/* interpret: runs the interpreter with the signature of match_fun_t */
+static int interpret(const char *text, const char *end)
 {
-    do {    /* a * matches zero or more instances */
-        if (matchhere(regexp, text))
-            return 1;
-    } while (*text != '\0' && (*text++ == c || c == '.'));
-    return 0;
-
+    return interp_match(patterns, text, end);
 }
 
-/* match: search for regexp anywhere in text */
-static int match(const char *regexp, const char *text)
+/* scan: returns the number of matching lines, and in errors the number of
+   files that could not be searched */
+static long long scan(const struct options *options, int *errors)
 {
-    if (regexp[0] == '^')
-        return matchhere(regexp+1, text);
-    do {    /* must look even if string is empty */
-        if (matchhere(regexp, text))
-            return 1;
-    } while (*text++ != '\0');
-    return 0;
-}
+    struct matcher matcher = { interpret, NULL };
 
-int main(int argc, char *argv[])
-{
-    if (argc != 3)
+    double start = stats_now_ns();
+
+    if (options->recursive || options->num_filenames > 1)
     {
-        fprintf(stderr, "usage: %s regex filename\n", argv[0]);
-        exit(EXIT_FAILURE);
+        long long matched = grep_tree(options->filenames, options->num_filenames, options->recursive,
+                &matcher, options->num_threads, &options->mode, options->io_backend, errors);
+        stats_add_phase(STATS_SCAN, start);
+        return matched;
     }
 
-    const char* regexp = argv[1];
+    // Regular files are scanned in place unless --io says otherwise; anything
+    // else (pipes, character devices, ...) is read through a ring of buffers
+    const char *filename = options->filenames[0];
+    const char *name = input_display_name(filename);
+    *errors = 0;
+    struct input_map map;
+    if (input_uses_mmap(options->io_backend) && input_map_open(&map, filename) == 0)
+    {
+        long long matched = grep_mapped(&map, name, &matcher, options->num_threads, &options->mode);
+        input_map_close(&map);
+        stats_add_phase(STATS_SCAN, start);
+        return matched;
+    }
 
-    FILE *f = fopen(argv[2], "r");
-    if (f == NULL)
+    struct input_reader reader;
+    if (input_reader_open(&reader, filename, options->io_backend) != 0)
     {
         fprintf(stderr, "error opening file '%s': %s\n",
-                argv[2],
+                filename,
                 strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    char* line = NULL;
-    size_t length = 0;
+    long long matched = grep_stream(&reader, name, &matcher, options->num_threads, &options->mode);
 
-    while (getline(&line, &length, f) != -1)
-    {
-      if (match(regexp, line))
-        fprintf(stdout, "%s", line);
-    }
+    stats_add_phase(STATS_SCAN, start);
+    return matched;
+}
+
+int main(int argc, char *argv[])
+{
+    struct options options;
+    parse_options(argc, argv, &options);
+    /* As in grep, empty -f files give no pattern, which matches no line */
+    if (options.no_patterns)
+        return EXIT_FAILURE;
+
+    patterns = &options.patterns;
+    stats_init(options.stats);
+    stats_set_io(input_backend_name(options.io_backend));
 
-    free(line);
-    fclose(f);
+    int errors;
+    long long matched = scan(&options, &errors);
 
-    return 0;
+    stats_print("jgrep-basic", options.regexp);
+    // -q tells whether anything matched, even if some files could not be read
+    if (options.mode.output == SCAN_QUIET)
+        return matched > 0 ? 0 : EXIT_FAILURE;
+    return errors == 0 ? 0 : EXIT_FAILURE;
 }
@@ -0,0 +1,470 @@
+#define _GNU_SOURCE // asprintf
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <libgccjit.h>
+
+#include "jgrep-cache.h"
+#include "jgrep-codegen.h"
+
+enum { DEFAULT_MAX_MB = 64 };
+// The cache directory followed by the name of an entry
+enum { ENTRY_PATH_MAX = PATH_MAX + NAME_MAX + 2 };
+// A temp file of jit_cache_store older than this is left over by a run that
+// exited while storing (the compile thread of jgrep-concurrent is detached)
+enum { STALE_TMP_SECONDS = 60 };
+
+// Name of the function of every cached object that returns its whole key
+#define KEY_FUNCTION_NAME "jgrep_cache_key"
+#define STATS_FILE_NAME "stats"
+
+static int mkdir_p(char *path)
+{
+  for (char *p = path + 1; *p != '\0'; p++)
+  {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    int res = mkdir(path, 0755);
+    *p = '/';
+    if (res != 0 && errno != EEXIST)
+      return -1;
+  }
+  if (mkdir(path, 0755) != 0 && errno != EEXIST)
+    return -1;
+  return 0;
+}
+
+void jit_cache_init(struct jit_cache *cache, int enabled, int report)
+{
+  memset(cache, 0, sizeof(*cache));
+  cache->report = report;
+  cache->max_bytes = (size_t)DEFAULT_MAX_MB * 1024 * 1024;
+
+  const char *max_mb = getenv("JGREP_CACHE_MAX_MB");
+  if (max_mb != NULL)
+  {
+    char *end;
+    long n = strtol(max_mb, &end, 10);
+    if (*max_mb != '\0' && *end == '\0' && n >= 0)
+      cache->max_bytes = (size_t)n * 1024 * 1024;
+  }
+
+  if (!enabled)
+    return;
+
+  const char *dir = getenv("JGREP_CACHE_DIR");
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  int n;
+  if (dir != NULL && dir[0] != '\0')
+    n = snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+  else if (xdg != NULL && xdg[0] != '\0')
+    n = snprintf(cache->dir, sizeof(cache->dir), "%s/jgrep", xdg);
+  else if (home != NULL && home[0] != '\0')
+    n = snprintf(cache->dir, sizeof(cache->dir), "%s/.cache/jgrep", home);
+  else
+    n = -1;
+
+  if (n < 0 || (size_t)n >= sizeof(cache->dir) || mkdir_p(cache->dir) != 0)
+  {
+    if (report)
+      fprintf(stderr, "jgrep: cache disabled: no usable directory\n");
+    cache->dir[0] = '\0';
+  }
+}
+
+// Reads the fields of /proc/cpuinfo that tell what code the CPU can run. The
+// model name is kept readable, the rest (mostly the feature flags) is hashed.
+static char cpu_identity[256];
+static pthread_once_t cpu_identity_once = PTHREAD_ONCE_INIT;
+
+static unsigned long long hash_bytes(unsigned long long h, const char *s, size_t n)
+{
+  // FNV-1a
+  for (size_t i = 0; i < n; i++)
+  {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+#define HASH_INIT 14695981039346656037ULL
+
+static void init_cpu_identity(void)
+{
+  static const char *const fields[] = {
+    "vendor_id", "cpu family", "model", "stepping", "flags",
+    "Features", "CPU implementer", "CPU architecture", "CPU variant", "CPU part",
+  };
+
+  char model_name[128] = "unknown";
+  unsigned long long h = HASH_INIT;
+
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  if (f != NULL)
+  {
+    char *line = NULL;
+    size_t length = 0;
+    ssize_t n;
+    // Only the first processor: the others are the same
+    while ((n = getline(&line, &length, f)) > 1)
+    {
+      char *colon = strchr(line, ':');
+      if (colon == NULL)
+        continue;
+      size_t key_length = colon - line;
+      while (key_length > 0 && (line[key_length - 1] == ' ' || line[key_length - 1] == '\t'))
+        key_length--;
+
+      if (key_length == strlen("model name") && strncmp(line, "model name", key_length) == 0)
+      {
+        snprintf(model_name, sizeof(model_name), "%s", colon + 1 + (colon[1] == ' '));
+        model_name[strcspn(model_name, "\n")] = '\0';
+        continue;
+      }
+
+      for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+        if (key_length == strlen(fields[i]) && strncmp(line, fields[i], key_length) == 0)
+          h = hash_bytes(h, line, n);
+    }
+    free(line);
+    fclose(f);
+  }
+
+  snprintf(cpu_identity, sizeof(cpu_identity), "%s %016llx", model_name, h);
+}
+
+// The whole key of an entry. The pattern goes last, so it may hold anything.
+static char *make_key(const char *regexp, int flags,
+    const struct codegen_profile *profile, enum codegen_mode mode)
+{
+  pthread_once(&cpu_identity_once, init_cpu_identity);
+
+  int major = 0, minor = 0, patchlevel = 0;
+#ifdef LIBGCCJIT_HAVE_gcc_jit_version
+  major = gcc_jit_version_major();
+  minor = gcc_jit_version_minor();
+  patchlevel = gcc_jit_version_patchlevel();
+#endif
+
+  char profile_name[128];
+  char *key;
+  if (asprintf(&key, "jgrep codegen %d %s\nlibgccjit %d.%d.%d\ncpu %s\n%s\nflags %d\n%s",
+        JGREP_CODEGEN_VERSION, codegen_mode_name(mode), major, minor, patchlevel, cpu_identity,
+        codegen_profile_name(profile, profile_name, sizeof(profile_name)), flags, regexp) < 0)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return key;
+}
+
+static void make_path(const struct jit_cache *cache, const char *key,
+    char *path, size_t size)
+{
+  snprintf(path, size, "%s/%016llx.so",
+      cache->dir, hash_bytes(HASH_INIT, key, strlen(key)));
+}
+
+// Adds to the totals of the stats file and returns them in 'totals', which may
+// be NULL. The file is locked so that concurrent runs do not lose updates.
+static void update_stats(const struct jit_cache *cache,
+    long hits, long misses, long evictions, long totals[3])
+{
+  char path[ENTRY_PATH_MAX];
+  snprintf(path, sizeof(path), "%s/" STATS_FILE_NAME, cache->dir);
+
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return;
+  flock(fd, LOCK_EX);
+
+  char buffer[256];
+  ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  buffer[n > 0 ? n : 0] = '\0';
+
+  long current[3] = { 0, 0, 0 };
+  sscanf(buffer, "hits %ld\nmisses %ld\nevictions %ld",
+      &current[0], &current[1], &current[2]);
+  current[0] += hits;
+  current[1] += misses;
+  current[2] += evictions;
+
+  if (hits != 0 || misses != 0 || evictions != 0)
+  {
+    int length = snprintf(buffer, sizeof(buffer), "hits %ld\nmisses %ld\nevictions %ld\n",
+        current[0], current[1], current[2]);
+    if (ftruncate(fd, 0) == 0 && pwrite(fd, buffer, length, 0) != length)
+      fprintf(stderr, "jgrep: cannot update '%s'\n", path);
+  }
+
+  if (totals != NULL)
+    memcpy(totals, current, sizeof(current));
+
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+static void count_miss(struct jit_cache *cache, const char *path)
+{
+  atomic_fetch_add(&cache->misses, 1);
+  update_stats(cache, 0, 1, 0, NULL);
+  if (cache->report)
+    fprintf(stderr, "jgrep: cache miss %s\n", path);
+}
+
+// Opens 'path' and checks that it was compiled for 'key'
+static int open_entry(const char *path, const char *key, struct matcher *matcher)
+{
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL)
+    return -1;
+
+  const char *(*get_key)(void) = (const char *(*)(void))dlsym(handle, KEY_FUNCTION_NAME);
+  matcher->match = (match_fun_t)dlsym(handle, "match");
+  matcher->scan = (scan_fun_t)dlsym(handle, "scan");
+  if (get_key == NULL || matcher->match == NULL || matcher->scan == NULL
+      || strcmp(get_key(), key) != 0)
+  {
+    dlclose(handle);
+    return -1;
+  }
+
+  // The handle stays open for the rest of the run, like a gcc_jit_result
+  return 0;
+}
+
+int jit_cache_load(struct jit_cache *cache, const char *regexp, int flags,
+    const struct codegen_profile *profile, enum codegen_mode mode, struct matcher *matcher)
+{
+  if (cache->dir[0] == '\0')
+    return -1;
+
+  char *key = make_key(regexp, flags, profile, mode);
+  char path[ENTRY_PATH_MAX];
+  make_path(cache, key, path, sizeof(path));
+
+  int res = open_entry(path, key, matcher);
+  free(key);
+
+  if (res != 0)
+  {
+    count_miss(cache, path);
+    return -1;
+  }
+
+  // Eviction removes the entries with the oldest modification time first
+  utimensat(AT_FDCWD, path, NULL, 0);
+
+  atomic_fetch_add(&cache->hits, 1);
+  update_stats(cache, 1, 0, 0, NULL);
+  if (cache->report)
+    fprintf(stderr, "jgrep: cache hit %s\n", path);
+
+  return 0;
+}
+
+int jit_cache_contains(struct jit_cache *cache, const char *regexp, int flags,
+    const struct codegen_profile *profile, enum codegen_mode mode)
+{
+  if (cache->dir[0] == '\0')
+    return 0;
+
+  char *key = make_key(regexp, flags, profile, mode);
+  char path[ENTRY_PATH_MAX];
+  make_path(cache, key, path, sizeof(path));
+  free(key);
+
+  return access(path, R_OK) == 0;
+}
+
+struct entry
+{
+  char name[NAME_MAX + 1];
+  off_t size;
+  struct timespec mtime;
+};
+
+static int compare_entry_age(const void *a, const void *b)
+{
+  const struct entry *x = a, *y = b;
+  if (x->mtime.tv_sec != y->mtime.tv_sec)
+    return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+  if (x->mtime.tv_nsec != y->mtime.tv_nsec)
+    return x->mtime.tv_nsec < y->mtime.tv_nsec ? -1 : 1;
+  return 0;
+}
+
+// Lists the entries of the cache, removing the stale temp files of
+// jit_cache_store on the way. Returns their number, or -1 on errors.
+static int list_entries(const struct jit_cache *cache, struct entry **entries, size_t *total_bytes)
+{
+  *entries = NULL;
+  *total_bytes = 0;
+
+  DIR *d = opendir(cache->dir);
+  if (d == NULL)
+    return -1;
+
+  int num_entries = 0, capacity = 0;
+
+  time_t now = time(NULL);
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL)
+  {
+    size_t length = strlen(e->d_name);
+    struct stat st;
+    if (length >= 4 && strcmp(e->d_name + length - 4, ".tmp") == 0)
+    {
+      if (fstatat(dirfd(d), e->d_name, &st, 0) == 0 && S_ISREG(st.st_mode)
+          && now - st.st_mtim.tv_sec > STALE_TMP_SECONDS)
+        unlinkat(dirfd(d), e->d_name, 0);
+      continue;
+    }
+    if (length < 3 || strcmp(e->d_name + length - 3, ".so") != 0)
+      continue;
+
+    if (fstatat(dirfd(d), e->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+      continue;
+
+    if (num_entries == capacity)
+    {
+      capacity = capacity ? 2 * capacity : 64;
+      struct entry *p = realloc(*entries, sizeof(**entries) * capacity);
+      if (p == NULL)
+        break;
+      *entries = p;
+    }
+
+    struct entry *entry = &(*entries)[num_entries++];
+    snprintf(entry->name, sizeof(entry->name), "%s", e->d_name);
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    *total_bytes += st.st_size;
+  }
+
+  closedir(d);
+  return num_entries;
+}
+
+// Removes the least recently used entries until the cache fits its limit.
+// The entry just stored is kept even if it does not fit on its own.
+static void evict(struct jit_cache *cache, const char *keep)
+{
+  struct entry *entries;
+  size_t total_bytes;
+  int num_entries = list_entries(cache, &entries, &total_bytes);
+  if (num_entries < 0)
+    return;
+
+  int evicted = 0;
+  if (total_bytes > cache->max_bytes)
+  {
+    qsort(entries, num_entries, sizeof(*entries), compare_entry_age);
+    for (int i = 0; i < num_entries && total_bytes > cache->max_bytes; i++)
+    {
+      if (strcmp(entries[i].name, keep) == 0)
+        continue;
+      char path[ENTRY_PATH_MAX];
+      snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+      if (unlink(path) != 0)
+        continue;
+      total_bytes -= entries[i].size;
+      evicted++;
+      if (cache->report)
+        fprintf(stderr, "jgrep: cache evicted %s\n", path);
+    }
+  }
+  free(entries);
+
+  if (evicted > 0)
+  {
+    atomic_fetch_add(&cache->evictions, evicted);
+    update_stats(cache, 0, 0, evicted, NULL);
+  }
+}
+
+static void generate_code_key(gcc_jit_context *ctx, const char *key)
+{
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+  gcc_jit_function *get_key = gcc_jit_context_new_function(ctx, NULL,
+      GCC_JIT_FUNCTION_EXPORTED,
+      const_char_ptr_type,
+      KEY_FUNCTION_NAME,
+      0, NULL, 0);
+  gcc_jit_block *block = gcc_jit_function_new_block(get_key, "entry");
+  gcc_jit_block_end_with_return(block, NULL, gcc_jit_context_new_string_literal(ctx, key));
+}
+
+int jit_cache_store(struct jit_cache *cache, gcc_jit_context *ctx,
+    const char *regexp, int flags, const struct codegen_profile *profile,
+    enum codegen_mode mode, struct matcher *matcher)
+{
+  if (cache->dir[0] == '\0')
+    return -1;
+
+  char *key = make_key(regexp, flags, profile, mode);
+  char path[ENTRY_PATH_MAX];
+  make_path(cache, key, path, sizeof(path));
+
+  generate_code_key(ctx, key);
+
+  // Written aside and renamed, so that concurrent runs never load a partially
+  // written object
+  static atomic_int tmp_counter;
+  char tmp_path[ENTRY_PATH_MAX + 32];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.%d.tmp",
+      path, (long)getpid(), atomic_fetch_add(&tmp_counter, 1));
+
+  gcc_jit_context_compile_to_file(ctx, GCC_JIT_OUTPUT_KIND_DYNAMIC_LIBRARY, tmp_path);
+  if (gcc_jit_context_get_first_error(ctx) != NULL || rename(tmp_path, path) != 0)
+  {
+    unlink(tmp_path);
+    free(key);
+    return -1;
+  }
+
+  evict(cache, strrchr(path, '/') + 1);
+
+  int res = open_entry(path, key, matcher);
+  free(key);
+  return res;
+}
+
+void jit_cache_print_report(struct jit_cache *cache)
+{
+  if (cache->dir[0] == '\0')
+  {
+    fprintf(stderr, "cache: disabled\n");
+    return;
+  }
+
+  long totals[3];
+  update_stats(cache, 0, 0, 0, totals);
+
+  struct entry *entries;
+  size_t total_bytes;
+  int num_entries = list_entries(cache, &entries, &total_bytes);
+  free(entries);
+
+  fprintf(stderr, "cache: %s\n", cache->dir);
+  fprintf(stderr, "  this run: %d hits, %d misses, %d evictions\n",
+      atomic_load(&cache->hits), atomic_load(&cache->misses), atomic_load(&cache->evictions));
+  fprintf(stderr, "  all runs: %ld hits, %ld misses, %ld evictions\n",
+      totals[0], totals[1], totals[2]);
+  fprintf(stderr, "  entries:  %d (%zu of %zu bytes)\n",
+      num_entries < 0 ? 0 : num_entries, total_bytes, cache->max_bytes);
+}
@@ -0,0 +1,67 @@
+#ifndef JGREP_CACHE_H
+#define JGREP_CACHE_H
+
+#include <limits.h>
+#include <stdatomic.h>
+
+#include <libgccjit.h>
+
+#include "jgrep-codegen.h"
+#include "jgrep-scan.h"
+
+// A directory of matchers compiled to shared objects, so that running the same
+// pattern again loads it with dlopen instead of calling libgccjit.
+//
+// An entry is keyed on the pattern and its flags (see re_parse), the codegen
+// profile (the optimization level and -march), the codegen mode, the version
+// of libgccjit, the CPU and JGREP_CODEGEN_VERSION. The whole key is compiled
+// into the shared object and checked after loading it, so that a collision of
+// the hashed file names is a miss rather than a wrong matcher.
+//
+// The least recently used entries are removed when the directory grows over
+// its size limit. Hits, misses and evictions are also counted in a "stats"
+// file of the directory, across runs.
+struct jit_cache
+{
+  char dir[PATH_MAX]; // Empty if the cache is disabled
+  size_t max_bytes;
+  int report;         // Print hits and misses to stderr
+
+  // This run
+  atomic_int hits;
+  atomic_int misses;
+  atomic_int evictions;
+};
+
+// The directory is $JGREP_CACHE_DIR, else $XDG_CACHE_HOME/jgrep, else
+// $HOME/.cache/jgrep. It is created if needed. Its size limit is
+// $JGREP_CACHE_MAX_MB megabytes (64 by default).
+//
+// If 'enabled' is zero or there is no usable directory, loads always miss and
+// stores always fail, so callers need no special case.
+void jit_cache_init(struct jit_cache *cache, int enabled, int report);
+
+// Fills 'matcher' with the cached "match" and "scan" of 'regexp' with 'flags'
+// generated in 'mode' and compiled with 'profile'. Returns 0 on a hit and -1
+// on a miss.
+int jit_cache_load(struct jit_cache *cache, const char *regexp, int flags,
+    const struct codegen_profile *profile, enum codegen_mode mode, struct matcher *matcher);
+
+// Whether the cache has an entry for 'regexp' with 'flags' compiled with
+// 'profile' in 'mode'.
+// Unlike jit_cache_load it opens nothing and counts no hit or miss.
+int jit_cache_contains(struct jit_cache *cache, const char *regexp, int flags,
+    const struct codegen_profile *profile, enum codegen_mode mode);
+
+// Compiles 'ctx', which must hold the code of 'regexp' with 'flags' in 'mode'
+// with 'profile', into the cache and fills 'matcher' with its functions. Returns
+// -1 if it could not be stored, in which case the caller can still compile
+// 'ctx' in memory.
+int jit_cache_store(struct jit_cache *cache, gcc_jit_context *ctx,
+    const char *regexp, int flags, const struct codegen_profile *profile,
+    enum codegen_mode mode, struct matcher *matcher);
+
+// Prints to stderr the hits and misses of this run and of all runs
+void jit_cache_print_report(struct jit_cache *cache);
+
+#endif // JGREP_CACHE_H
@@ -0,0 +1,2121 @@
+#define _GNU_SOURCE // memrchr
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <libgccjit.h>
+
+#include "jgrep-ac.h"
+#include "jgrep-codegen.h"
+#include "jgrep-dfa.h"
+#include "jgrep-regexp.h"
+
+// Beyond this many states the switch-based DFA gets too large to be worth
+// compiling, and the backtracking matcher is generated instead
+enum { DFA_MAX_STATES = 256 };
+
+// Whenever the DFA of the regexp is small enough, match is a state machine that
+// reads every byte once (see generate_code_dfa). Otherwise the generated code
+// follows the recursive matcher of jgrep-interp.c, either as a single function
+// that backtracks on its own (see generate_code_backtrack) or, with
+// CODEGEN_CALLS, as a function per x* and x?. The text is delimited by an end
+// pointer instead of a NUL:
+//
+//   matchhere(atoms, text, end)
+//       - no atom left : match
+//       - x*           : try the rest of the atoms at every position reached
+//                        by consuming zero or more x
+//       - x?           : try the rest of the atoms at text, then after
+//                        consuming one x
+//       - final '$'    : match if text == end or *text == '\n'
+//       - x            : consume one char of the set of x (never past end or
+//                        a '\n')
+//
+//   match(text, end)
+//       - '^' anchors matchhere at text, otherwise it is tried at every
+//         position of [text, end], including end itself
+//       - unanchored regexps that must start with a literal c (after dropping
+//         leading x* and x? that cannot change the outcome) only try
+//         matchhere at the positions of c, found with memchr
+//
+// The atoms come from re_parse. Literals and '.' are tested with comparisons,
+// other sets with a lookup in a 256-bit table. With -i a letter is a folded
+// literal: it is tested as (*text | 0x20) == c, and searched for in both cases
+// at once with jgrep_memchr2.
+
+// Names only have to be unique within a context, and a context is built by a
+// single thread, so every thread numbers its own names: generate_code_regexp
+// may run on several threads at once, each with its own context. libgccjit
+// copies the names it is given, so the buffers can be reused right away.
+static const char* new_block_name(void)
+{
+  static _Thread_local int n = 0;
+  enum { SIZE = 32 };
+  static _Thread_local char c[SIZE];
+
+  snprintf(c, SIZE, "block-%02d", n);
+  c[SIZE-1] = '\0';
+
+  n++;
+
+  return c;
+}
+
+static const char* new_function_name(void)
+{
+  static _Thread_local int n = 0;
+  enum { SIZE = 32 };
+  static _Thread_local char c[SIZE];
+
+  snprintf(c, SIZE, "matchhere_%d", n);
+  c[SIZE-1] = '\0';
+
+  n++;
+
+  return c;
+}
+
+static const char* new_local_name(void)
+{
+  static _Thread_local int n = 0;
+  enum { SIZE = 32 };
+  static _Thread_local char c[SIZE];
+
+  snprintf(c, SIZE, "tmp_%d", n);
+  c[SIZE-1] = '\0';
+
+  n++;
+
+  return c;
+}
+
+#ifdef LIBGCCJIT_HAVE_gcc_jit_global_set_initializer
+static const char* new_table_name(void)
+{
+  static _Thread_local int n = 0;
+  enum { SIZE = 32 };
+  static _Thread_local char c[SIZE];
+
+  snprintf(c, SIZE, "set_%d", n);
+  c[SIZE-1] = '\0';
+
+  n++;
+
+  return c;
+}
+#endif
+
+static void generate_return_zero(gcc_jit_context* ctx, gcc_jit_function *fun, gcc_jit_block** return_zero)
+{
+  if (*return_zero == NULL)
+  {
+    gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+    *return_zero = gcc_jit_function_new_block(fun, new_block_name());
+    gcc_jit_block_end_with_return(
+        *return_zero, /* loc */ NULL,
+        gcc_jit_context_zero(ctx, int_type));
+  }
+}
+
+// &text[1]
+static gcc_jit_rvalue *generate_text_plus_one(gcc_jit_context *ctx, gcc_jit_rvalue *text)
+{
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+
+  return gcc_jit_context_new_cast(
+      ctx, /* loc */ NULL,
+      gcc_jit_lvalue_get_address(
+        gcc_jit_context_new_array_access(
+          ctx, /* loc */ NULL,
+          text,
+          gcc_jit_context_one(ctx, int_type)),
+        /* loc */ NULL),
+      const_char_ptr_type);
+}
+
+// text == end || *text == '\n'
+//
+// A bool rvalue. The logical or short-circuits, so text is never dereferenced
+// once it has reached end.
+static gcc_jit_rvalue *generate_end_of_line_check(gcc_jit_context *ctx, gcc_jit_rvalue *text, gcc_jit_rvalue *end)
+{
+  gcc_jit_type *bool_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_BOOL);
+  gcc_jit_type *char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CHAR);
+
+  return gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+      GCC_JIT_BINARY_OP_LOGICAL_OR, bool_type,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ,
+        text,
+        end),
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ,
+        gcc_jit_lvalue_as_rvalue(
+          gcc_jit_rvalue_dereference(text, /* loc */ NULL)),
+        gcc_jit_context_new_rvalue_from_int(ctx, char_type, '\n')));
+}
+
+const char *jgrep_memchr(const char *begin, const char *end, int c)
+{
+  return memchr(begin, c, end - begin);
+}
+
+const char *jgrep_memrchr(const char *begin, const char *end, int c)
+{
+  return memrchr(begin, c, end - begin);
+}
+
+const char *jgrep_memchr2(const char *begin, const char *end, int c1, int c2)
+{
+  const char *p = begin;
+#ifdef __SSE2__
+  __m128i v1 = _mm_set1_epi8((char)c1);
+  __m128i v2 = _mm_set1_epi8((char)c2);
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    int mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, v1), _mm_cmpeq_epi8(chunk, v2)));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; p != end; p++)
+    if (*p == (char)c1 || *p == (char)c2)
+      return p;
+  return NULL;
+}
+
+// const char *jgrep_memchr(const char *begin, const char *end, int c);
+static gcc_jit_function *generate_memchr_import(gcc_jit_context *ctx, struct codegen_imports *imports)
+{
+  if (imports->memchr != NULL)
+    return imports->memchr;
+
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+
+  gcc_jit_param *params[] = {
+    gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "begin"),
+    gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "end"),
+    gcc_jit_context_new_param(ctx, /* loc */ NULL, int_type, "c"),
+  };
+  imports->memchr = gcc_jit_context_new_function(ctx, /* loc */ NULL,
+      GCC_JIT_FUNCTION_IMPORTED, const_char_ptr_type, "jgrep_memchr",
+      3, params, /* is_variadic */ 0);
+  return imports->memchr;
+}
+
+// const char *jgrep_memchr2(const char *begin, const char *end, int c1, int c2);
+static gcc_jit_function *generate_memchr2_import(gcc_jit_context *ctx, struct codegen_imports *imports)
+{
+  if (imports->memchr2 != NULL)
+    return imports->memchr2;
+
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+
+  gcc_jit_param *params[] = {
+    gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "begin"),
+    gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "end"),
+    gcc_jit_context_new_param(ctx, /* loc */ NULL, int_type, "c1"),
+    gcc_jit_context_new_param(ctx, /* loc */ NULL, int_type, "c2"),
+  };
+  imports->memchr2 = gcc_jit_context_new_function(ctx, /* loc */ NULL,
+      GCC_JIT_FUNCTION_IMPORTED, const_char_ptr_type, "jgrep_memchr2",
+      4, params, /* is_variadic */ 0);
+  return imports->memchr2;
+}
+
+// const char *jgrep_memrchr(const char *begin, const char *end, int c);
+static gcc_jit_function *generate_memrchr_import(gcc_jit_context *ctx, struct codegen_imports *imports)
+{
+  if (imports->memrchr != NULL)
+    return imports->memrchr;
+
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+
+  gcc_jit_param *params[] = {
+    gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "begin"),
+    gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "end"),
+    gcc_jit_context_new_param(ctx, /* loc */ NULL, int_type, "c"),
+  };
+  imports->memrchr = gcc_jit_context_new_function(ctx, /* loc */ NULL,
+      GCC_JIT_FUNCTION_IMPORTED, const_char_ptr_type, "jgrep_memrchr",
+      3, params, /* is_variadic */ 0);
+  return imports->memrchr;
+}
+
+// jgrep_memchr(text, end, c), or jgrep_memchr2(text, end, c, other) if
+// 'other' is not c
+static gcc_jit_rvalue *generate_memchr_call(gcc_jit_context *ctx, struct codegen_imports *imports,
+    gcc_jit_rvalue *text, gcc_jit_rvalue *end, int c, int other)
+{
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+
+  gcc_jit_rvalue *args[] = {
+    text,
+    end,
+    gcc_jit_context_new_rvalue_from_int(ctx, int_type, c),
+    gcc_jit_context_new_rvalue_from_int(ctx, int_type, other),
+  };
+  if (other == c)
+    return gcc_jit_context_new_call(ctx, /* loc */ NULL,
+        generate_memchr_import(ctx, imports), 3, args);
+  return gcc_jit_context_new_call(ctx, /* loc */ NULL,
+      generate_memchr2_import(ctx, imports), 4, args);
+}
+
+// The uppercase of a folded literal, else the literal itself
+static int other_case(const struct re_atom *atom)
+{
+  return atom->folded ? atom->literal - 'a' + 'A' : atom->literal;
+}
+
+#ifdef LIBGCCJIT_HAVE_gcc_jit_global_set_initializer
+// An internal global array of 'num_elements' of 'element_type' holding 'data'
+static gcc_jit_lvalue *generate_table(gcc_jit_context *ctx,
+    gcc_jit_type *element_type, size_t element_size, const char *name,
+    const void *data, int num_elements)
+{
+  gcc_jit_lvalue *table = gcc_jit_context_new_global(ctx, /* loc */ NULL,
+      GCC_JIT_GLOBAL_INTERNAL,
+      gcc_jit_context_new_array_type(ctx, /* loc */ NULL, element_type, num_elements),
+      name);
+  gcc_jit_global_set_initializer(table, data, element_size * num_elements);
+  return table;
+}
+
+// table[index]
+static gcc_jit_rvalue *generate_table_load(gcc_jit_context *ctx,
+    gcc_jit_lvalue *table, gcc_jit_rvalue *index)
+{
+  return gcc_jit_lvalue_as_rvalue(
+      gcc_jit_context_new_array_access(ctx, /* loc */ NULL,
+        gcc_jit_lvalue_as_rvalue(table),
+        index));
+}
+#endif
+
+// The set of each atom of 'pattern' that is neither a literal nor '.', as a
+// table of 32 bytes with bit c % 8 of byte c / 8 set for each byte c in it
+// (see generate_atom_has). The other atoms, and every atom without global
+// initializers, get NULL.
+static gcc_jit_lvalue **generate_atom_tables(gcc_jit_context *ctx, const struct re_pattern *pattern)
+{
+  gcc_jit_lvalue **tables = calloc(pattern->num_atoms + 1, sizeof(*tables));
+
+#ifdef LIBGCCJIT_HAVE_gcc_jit_global_set_initializer
+  gcc_jit_type *unsigned_char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_UNSIGNED_CHAR);
+  for (int i = 0; i < pattern->num_atoms; i++)
+  {
+    const struct re_atom *atom = &pattern->atoms[i];
+    if (atom->literal < 0 && !atom->any)
+      tables[i] = generate_table(ctx, unsigned_char_type, 1, new_table_name(),
+          atom->set, sizeof(atom->set));
+  }
+#else
+  (void)ctx;
+#endif
+
+  return tables;
+}
+
+// Whether *text is in the set of 'atom', as a bool rvalue. text must not be
+// end.
+//
+//   - a literal c: *text == c
+//   - a folded literal c: ((unsigned char)*text | 0x20) == c. Only c and its
+//     uppercase, which differs from it in that bit alone, pass.
+//   - a set with a table: (table[(unsigned char)*text >> 3] >> (*text & 7)) & 1
+//   - a set without one: one comparison per range of bytes in it
+static gcc_jit_rvalue *generate_atom_has(gcc_jit_context *ctx, const struct re_atom *atom,
+    gcc_jit_lvalue *table, gcc_jit_rvalue *text)
+{
+  gcc_jit_type *bool_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_BOOL);
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CHAR);
+  gcc_jit_type *unsigned_char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_UNSIGNED_CHAR);
+
+  gcc_jit_rvalue *byte = gcc_jit_lvalue_as_rvalue(gcc_jit_rvalue_dereference(text, /* loc */ NULL));
+  if (atom->literal >= 0 && !atom->folded)
+    return gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ,
+        byte,
+        gcc_jit_context_new_rvalue_from_int(ctx, char_type, (char)atom->literal));
+
+  gcc_jit_rvalue *c = gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+      gcc_jit_context_new_cast(ctx, /* loc */ NULL, byte, unsigned_char_type),
+      int_type);
+  if (atom->folded)
+    return gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ,
+        gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+          GCC_JIT_BINARY_OP_BITWISE_OR, int_type,
+          c,
+          gcc_jit_context_new_rvalue_from_int(ctx, int_type, 0x20)),
+        gcc_jit_context_new_rvalue_from_int(ctx, int_type, atom->literal));
+
+#ifdef LIBGCCJIT_HAVE_gcc_jit_global_set_initializer
+  if (table != NULL)
+  {
+    gcc_jit_rvalue *bits = gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+        generate_table_load(ctx, table,
+          gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+            GCC_JIT_BINARY_OP_RSHIFT, int_type,
+            c,
+            gcc_jit_context_new_rvalue_from_int(ctx, int_type, 3))),
+        int_type);
+    return gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_NE,
+        gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+          GCC_JIT_BINARY_OP_BITWISE_AND, int_type,
+          gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+            GCC_JIT_BINARY_OP_RSHIFT, int_type,
+            bits,
+            gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+              GCC_JIT_BINARY_OP_BITWISE_AND, int_type,
+              c,
+              gcc_jit_context_new_rvalue_from_int(ctx, int_type, 7))),
+          gcc_jit_context_one(ctx, int_type)),
+        gcc_jit_context_zero(ctx, int_type));
+  }
+#else
+  (void)table;
+#endif
+
+  gcc_jit_rvalue *has = gcc_jit_context_new_rvalue_from_int(ctx, bool_type, 0);
+  for (int low = 0; low < 256; low++)
+  {
+    if (!re_atom_has(atom, low))
+      continue;
+    int high = low;
+    while (high < 255 && re_atom_has(atom, high + 1))
+      high++;
+
+    gcc_jit_rvalue *in_range = gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+        GCC_JIT_BINARY_OP_LOGICAL_AND, bool_type,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_GE, c, gcc_jit_context_new_rvalue_from_int(ctx, int_type, low)),
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_LE, c, gcc_jit_context_new_rvalue_from_int(ctx, int_type, high)));
+    has = gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+        GCC_JIT_BINARY_OP_LOGICAL_OR, bool_type, has, in_range);
+    low = high;
+  }
+  return has;
+}
+
+// Ends 'block' with a jump to 'on_match' if text is before end and *text is
+// in the set of 'atom', and to 'on_mismatch' otherwise
+static void generate_atom_test(gcc_jit_context *ctx, gcc_jit_function *fun,
+    gcc_jit_block *block, const struct re_atom *atom, gcc_jit_lvalue *table,
+    gcc_jit_rvalue *text, gcc_jit_rvalue *end,
+    gcc_jit_block *on_match, gcc_jit_block *on_mismatch)
+{
+  if (atom->any)
+  {
+    gcc_jit_block_end_with_conditional(block, /* loc */ NULL,
+        generate_end_of_line_check(ctx, text, end),
+        on_mismatch,
+        on_match);
+    return;
+  }
+
+  gcc_jit_block *check = gcc_jit_function_new_block(fun, new_block_name());
+  gcc_jit_block_end_with_conditional(block, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ, text, end),
+      on_mismatch,
+      check);
+  gcc_jit_block_end_with_conditional(check, /* loc */ NULL,
+      generate_atom_has(ctx, atom, table, text),
+      on_match,
+      on_mismatch);
+}
+
+// Parses 'regexp', which callers of generate_code_regexp have checked
+static void parse_pattern(struct re_pattern *pattern, const char *regexp, int flags)
+{
+  if (re_parse(pattern, regexp, flags, NULL) == NULL)
+  {
+    fprintf(stderr, "jgrep: invalid regexp '%s'\n", regexp);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// The literal atom every match of an unanchored 'pattern' starts with once
+// its skippable prefix is dropped, or NULL if there is none
+static const struct re_atom *required_first_literal(const struct re_pattern *pattern)
+{
+  int first = re_skippable_prefix(pattern);
+  if (pattern->anchored || first == pattern->num_atoms || pattern->atoms[first].literal < 0)
+    return NULL;
+  return &pattern->atoms[first];
+}
+
+// matchhere for the atoms of 'pattern' from the i-th on
+static gcc_jit_function *generate_code_matchhere(gcc_jit_context *ctx, const struct re_pattern *pattern,
+    gcc_jit_lvalue **tables, int i, const char* function_name)
+{
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+
+  gcc_jit_param *param_text = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "text");
+  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(param_text);
+  gcc_jit_param *param_end = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "end");
+  gcc_jit_rvalue *rval_end = gcc_jit_param_as_rvalue(param_end);
+
+  // matchhere
+  gcc_jit_param* params[] = { param_text, param_end };
+  gcc_jit_function *matchhere = gcc_jit_context_new_function(ctx, /* loc */ NULL,
+      GCC_JIT_FUNCTION_INTERNAL, int_type, function_name,
+      2, params, /* is_variadic */ 0);
+  gcc_jit_block* current_block = gcc_jit_function_new_block(matchhere, new_block_name());
+
+  gcc_jit_rvalue* text_plus_one = generate_text_plus_one(ctx, rval_text);
+
+  gcc_jit_block* return_zero = NULL;
+
+  gcc_jit_block* return_one = gcc_jit_function_new_block(matchhere, new_block_name());
+  gcc_jit_block_end_with_return(
+      return_one, /* loc */ NULL,
+      gcc_jit_context_one(ctx, int_type));
+
+  // Now go creating
+  for (;; i++)
+  {
+    if (i == pattern->num_atoms && pattern->dollar)
+    {
+      generate_return_zero(ctx, matchhere, &return_zero);
+
+      // if (text == end || *text == '\n')
+      //    return 1;
+      // return 0;
+      gcc_jit_block_end_with_conditional(
+          current_block, /* loc */ NULL,
+          generate_end_of_line_check(ctx, rval_text, rval_end),
+          return_one,
+          return_zero);
+
+      break; // We are done
+    }
+    else if (i == pattern->num_atoms)
+    {
+      gcc_jit_block_end_with_jump(
+          current_block, /* loc */ NULL,
+          return_one);
+      break; // We are done
+    }
+
+    const struct re_atom *atom = &pattern->atoms[i];
+    if (atom->repeat == RE_STAR)
+    {
+      // Generate code for the remaining regular expression
+      gcc_jit_function *remaining_regexp_match = generate_code_matchhere(ctx, pattern, tables, i + 1, new_function_name());
+
+      gcc_jit_block* loop_body = gcc_jit_function_new_block(matchhere, new_block_name());
+      gcc_jit_block* loop_check = gcc_jit_function_new_block(matchhere, new_block_name());
+      gcc_jit_block* loop_next = gcc_jit_function_new_block(matchhere, new_block_name());
+
+      gcc_jit_block_end_with_jump(current_block, /* loc */ NULL, loop_body);
+
+      gcc_jit_rvalue* args[] = { rval_text, rval_end };
+      gcc_jit_rvalue* match_remainder =
+        gcc_jit_context_new_comparison(
+            ctx, /* loc */ NULL,
+            GCC_JIT_COMPARISON_NE,
+            gcc_jit_context_new_call(ctx, /* loc */ NULL,
+              remaining_regexp_match, 2, args),
+            gcc_jit_context_zero(ctx, int_type));
+
+      gcc_jit_block_end_with_conditional(loop_body, /* loc */ NULL,
+          match_remainder,
+          return_one,
+          loop_check);
+
+      generate_return_zero(ctx, matchhere, &return_zero);
+
+      // if (text == end || !has(atom, *text))
+      //    return 0;
+      // text = &text[1];
+      generate_atom_test(ctx, matchhere, loop_check, atom, tables[i],
+          rval_text, rval_end, loop_next, return_zero);
+
+      gcc_jit_block_add_assignment(loop_next, /* loc */ NULL,
+          gcc_jit_param_as_lvalue(param_text),
+          text_plus_one);
+      gcc_jit_block_end_with_jump(loop_next, /* loc */ NULL, loop_body);
+
+      break; // We are done
+    }
+    else if (atom->repeat == RE_OPTIONAL)
+    {
+      gcc_jit_function *remaining_regexp_match = generate_code_matchhere(ctx, pattern, tables, i + 1, new_function_name());
+
+      gcc_jit_block* consume = gcc_jit_function_new_block(matchhere, new_block_name());
+      gcc_jit_block* check_block = gcc_jit_function_new_block(matchhere, new_block_name());
+
+      // if (remaining(text, end))
+      //    return 1;
+      gcc_jit_rvalue* args[] = { rval_text, rval_end };
+      gcc_jit_block_end_with_conditional(current_block, /* loc */ NULL,
+          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+            GCC_JIT_COMPARISON_NE,
+            gcc_jit_context_new_call(ctx, /* loc */ NULL,
+              remaining_regexp_match, 2, args),
+            gcc_jit_context_zero(ctx, int_type)),
+          return_one,
+          check_block);
+
+      // if (text == end || !has(atom, *text))
+      //    return 0;
+      // return remaining(&text[1], end);
+      generate_return_zero(ctx, matchhere, &return_zero);
+      generate_atom_test(ctx, matchhere, check_block, atom, tables[i],
+          rval_text, rval_end, consume, return_zero);
+
+      gcc_jit_rvalue* consumed_args[] = { text_plus_one, rval_end };
+      gcc_jit_block_end_with_return(consume, /* loc */ NULL,
+          gcc_jit_context_new_call(ctx, /* loc */ NULL,
+            remaining_regexp_match, 2, consumed_args));
+
+      break; // We are done
+    }
+    else
+    {
+      generate_return_zero(ctx, matchhere, &return_zero);
+
+      gcc_jit_block* next_block = gcc_jit_function_new_block(matchhere, new_block_name());
+
+      // if (text == end || !has(atom, *text))
+      //    return 0;
+      generate_atom_test(ctx, matchhere, current_block, atom, tables[i],
+          rval_text, rval_end, next_block, return_zero);
+
+      // text = &text[1]; // pointer arithmetic
+      gcc_jit_block_add_assignment(next_block, /* loc */ NULL,
+          gcc_jit_param_as_lvalue(param_text),
+          text_plus_one);
+
+      // Chain the code
+      current_block = next_block;
+    }
+  }
+
+  // char c[64];
+  // snprintf(c, 63, "%s.dot", function_name);
+  // c[63] = '\0';
+
+  // gcc_jit_function_dump_to_dot(matchhere, c);
+
+  return matchhere;
+}
+
+#ifdef LIBGCCJIT_HAVE_SWITCH_STATEMENTS
+// If every byte but one (and '\n', which ends the line) leaves 'state'
+// unchanged, returns that byte and sets 'other' to it. If two bytes leave it
+// for the same state, like both cases of a letter with -i, returns the first
+// and sets 'other' to the second. Otherwise returns -1.
+static int exit_bytes(const struct dfa *dfa, int state, int *other)
+{
+  int exit_byte = -1;
+  *other = -1;
+  for (int c = 0; c < 256; c++)
+  {
+    if (c == '\n' || dfa->states[state].next[c] == state)
+      continue;
+    if (*other != -1)
+      return -1;
+    if (exit_byte != -1)
+      *other = c;
+    else
+      exit_byte = c;
+  }
+  if (*other == -1)
+    *other = exit_byte;
+  else if (dfa->states[state].next[*other] != dfa->states[state].next[exit_byte])
+    return -1;
+  return exit_byte;
+}
+
+static gcc_jit_block *dfa_target_block(gcc_jit_context *ctx, gcc_jit_function *match,
+    gcc_jit_block **state_blocks, gcc_jit_block **return_one, gcc_jit_block **return_zero,
+    int state)
+{
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+
+  if (state == DFA_ACCEPT)
+  {
+    if (*return_one == NULL)
+    {
+      *return_one = gcc_jit_function_new_block(match, new_block_name());
+      gcc_jit_block_end_with_return(
+          *return_one, /* loc */ NULL,
+          gcc_jit_context_one(ctx, int_type));
+    }
+    return *return_one;
+  }
+  if (state == DFA_REJECT)
+  {
+    generate_return_zero(ctx, match, return_zero);
+    return *return_zero;
+  }
+  return state_blocks[state];
+}
+
+// match, as a state machine with one block per DFA state:
+//
+//   state_s:
+//     if (text == end)
+//       return accept_at_end(s);
+//     c = (unsigned char)*text;
+//     text = &text[1];
+//     switch (c) {
+//       case 'a' ... 'c': goto state_t;
+//       ...
+//       default: goto state_u;
+//     }
+//
+// States that only leave on a single byte b, like the start state of most
+// unanchored regexps, find it with jgrep_memchr instead, and states that
+// leave on b or b2 for the same state with jgrep_memchr2:
+//
+//   state_s:
+//     text = jgrep_memchr(text, end, b);
+//     if (text == NULL)
+//       return accept_at_end(s);
+//     text = &text[1];
+//     goto state_next(s, b);
+static gcc_jit_function *generate_code_dfa(gcc_jit_context *ctx, const struct dfa *dfa,
+    const char *function_name, enum gcc_jit_function_kind kind, struct codegen_imports *imports)
+{
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *unsigned_char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_UNSIGNED_CHAR);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+
+  gcc_jit_param *param_text = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "text");
+  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(param_text);
+  gcc_jit_param *param_end = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "end");
+  gcc_jit_rvalue *rval_end = gcc_jit_param_as_rvalue(param_end);
+
+  gcc_jit_param* params[] = { param_text, param_end };
+  gcc_jit_function *match = gcc_jit_context_new_function(ctx, /* loc */ NULL,
+      kind, int_type, function_name,
+      2, params, /* is_variadic */ 0);
+
+  // The first block of a function is its entry
+  gcc_jit_block *entry = gcc_jit_function_new_block(match, new_block_name());
+
+  gcc_jit_lvalue *c = gcc_jit_function_new_local(match, /* loc */ NULL, int_type, new_local_name());
+  gcc_jit_block *return_one = NULL;
+  gcc_jit_block *return_zero = NULL;
+
+  gcc_jit_block **state_blocks = calloc(dfa->num_states, sizeof(*state_blocks));
+  gcc_jit_case **cases = calloc(256, sizeof(*cases));
+  for (int s = DFA_ACCEPT + 1; s < dfa->num_states; s++)
+    state_blocks[s] = gcc_jit_function_new_block(match, new_block_name());
+
+  gcc_jit_block_end_with_jump(entry, /* loc */ NULL,
+      dfa_target_block(ctx, match, state_blocks, &return_one, &return_zero, dfa->start));
+
+  for (int s = DFA_ACCEPT + 1; s < dfa->num_states; s++)
+  {
+    const struct dfa_state *state = &dfa->states[s];
+    gcc_jit_block *at_end = dfa_target_block(ctx, match, state_blocks, &return_one, &return_zero,
+        state->accept_at_end ? DFA_ACCEPT : DFA_REJECT);
+
+    int other;
+    int exit_byte = exit_bytes(dfa, s, &other);
+    if (exit_byte != -1)
+    {
+
+      gcc_jit_block *found = gcc_jit_function_new_block(match, new_block_name());
+
+      gcc_jit_block_add_assignment(state_blocks[s], /* loc */ NULL,
+          gcc_jit_param_as_lvalue(param_text),
+          generate_memchr_call(ctx, imports, rval_text, rval_end, exit_byte, other));
+      gcc_jit_block_end_with_conditional(state_blocks[s], /* loc */ NULL,
+          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+            GCC_JIT_COMPARISON_EQ,
+            rval_text,
+            gcc_jit_context_null(ctx, const_char_ptr_type)),
+          at_end,
+          found);
+
+      gcc_jit_block_add_assignment(found, /* loc */ NULL,
+          gcc_jit_param_as_lvalue(param_text),
+          generate_text_plus_one(ctx, rval_text));
+      gcc_jit_block_end_with_jump(found, /* loc */ NULL,
+          dfa_target_block(ctx, match, state_blocks, &return_one, &return_zero,
+            state->next[exit_byte]));
+      continue;
+    }
+
+    gcc_jit_block *read = gcc_jit_function_new_block(match, new_block_name());
+
+    gcc_jit_block_end_with_conditional(state_blocks[s], /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_EQ,
+          rval_text,
+          rval_end),
+        at_end,
+        read);
+
+    // c = (unsigned char)*text;
+    // text = &text[1];
+    gcc_jit_block_add_assignment(read, /* loc */ NULL,
+        c,
+        gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+          gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+            gcc_jit_lvalue_as_rvalue(
+              gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)),
+            unsigned_char_type),
+          int_type));
+    gcc_jit_block_add_assignment(read, /* loc */ NULL,
+        gcc_jit_param_as_lvalue(param_text),
+        generate_text_plus_one(ctx, rval_text));
+
+    // The most frequent target becomes the default, the others get one case
+    // per run of consecutive bytes
+    int default_state = state->next[0];
+    {
+      int best = 0;
+      int *counts = calloc(dfa->num_states, sizeof(int));
+      for (int b = 0; b < 256; b++)
+      {
+        int n = ++counts[state->next[b]];
+        if (n > best)
+        {
+          best = n;
+          default_state = state->next[b];
+        }
+      }
+      free(counts);
+    }
+
+    int num_cases = 0;
+    for (int b = 0; b < 256; )
+    {
+      int target = state->next[b];
+      int last = b;
+      while (last + 1 < 256 && state->next[last + 1] == target)
+        last++;
+
+      if (target != default_state)
+        cases[num_cases++] = gcc_jit_context_new_case(ctx,
+            gcc_jit_context_new_rvalue_from_int(ctx, int_type, b),
+            gcc_jit_context_new_rvalue_from_int(ctx, int_type, last),
+            dfa_target_block(ctx, match, state_blocks, &return_one, &return_zero, target));
+
+      b = last + 1;
+    }
+
+    gcc_jit_block_end_with_switch(read, /* loc */ NULL,
+        gcc_jit_lvalue_as_rvalue(c),
+        dfa_target_block(ctx, match, state_blocks, &return_one, &return_zero, default_state),
+        num_cases, cases);
+  }
+
+  free(cases);
+  free(state_blocks);
+
+  return match;
+}
+#endif
+
+// match, unanchored, for a regexp starting with the literal 'first':
+//
+//   for (;;) {
+//     text = jgrep_memchr(text, end, first);
+//     if (text == NULL)
+//       return 0;
+//     if (matchhere(text, end))
+//       return 1;
+//     text = &text[1];
+//   }
+static void generate_code_match_prefiltered(gcc_jit_context *ctx,
+    gcc_jit_function *match, gcc_jit_function *matchhere,
+    gcc_jit_param *param_text, gcc_jit_param *param_end, const struct re_atom *first,
+    struct codegen_imports *imports)
+{
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+
+  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(param_text);
+  gcc_jit_rvalue *rval_end = gcc_jit_param_as_rvalue(param_end);
+
+  gcc_jit_block* search = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block* candidate = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block* advance = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block* return_one = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block* return_zero = gcc_jit_function_new_block(match, new_block_name());
+
+  gcc_jit_block_add_assignment(search, /* loc */ NULL,
+      gcc_jit_param_as_lvalue(param_text),
+      generate_memchr_call(ctx, imports, rval_text, rval_end, first->literal, other_case(first)));
+  gcc_jit_block_end_with_conditional(search, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ,
+        rval_text,
+        gcc_jit_context_null(ctx, const_char_ptr_type)),
+      return_zero,
+      candidate);
+
+  gcc_jit_rvalue* args[] = { rval_text, rval_end };
+  gcc_jit_block_end_with_conditional(candidate, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_NE,
+        gcc_jit_context_new_call(ctx, /* loc */ NULL, matchhere, 2, args),
+        gcc_jit_context_zero(ctx, int_type)),
+      return_one,
+      advance);
+
+  gcc_jit_block_add_assignment(advance, /* loc */ NULL,
+      gcc_jit_param_as_lvalue(param_text),
+      generate_text_plus_one(ctx, rval_text));
+  gcc_jit_block_end_with_jump(advance, /* loc */ NULL, search);
+
+  gcc_jit_block_end_with_return(
+      return_one, /* loc */ NULL,
+      gcc_jit_context_one(ctx, int_type));
+  gcc_jit_block_end_with_return(
+      return_zero, /* loc */ NULL,
+      gcc_jit_context_zero(ctx, int_type));
+}
+
+// A single function matching a regexp, where generate_code_matchhere has a
+// function per x* and x?. Each of them is a choice point that saves the
+// position reached before trying the rest of the regexp, and when the rest
+// fails it restores it and makes another choice: x* consumes one more x, x?
+// consumes its x if it has not already. This is the backtracking of matchhere
+// with an explicit stack in place of the calls. The choice points are entered
+// left to right and given up right to left, so the stack never holds more
+// than one position per choice point and its top at every block is known
+// here: a failure jumps straight to the retry block of the closest choice
+// point on its left, or to the next start position.
+//
+// Whether the rest of the regexp after an x* matches only depends on where it
+// starts, so once an x* has tried every position it reaches from 'entry' up
+// to 'text', entering it again anywhere in between fails at once. A .* that
+// runs out fails the whole match, where the calls would give up one frame at
+// a time: it has tried the rest of the regexp at every position up to the end
+// of the line, and every later attempt would enter it again at one of those
+// positions, since starts and choice points only move forward.
+//
+//   int match(const char *text, const char *end)
+//   {
+//     const char *start = text;
+//     tried_end_k = NULL;      // For every x* but .*
+//   try_start:                 // Unanchored with a 'first': memchr for it
+//     text = start;
+//     ...                      // x: if text == end or !has(x, *text),
+//                              // goto retry_<k-1>
+//     if (tried_end_k != NULL && tried_begin_k <= text && text <= tried_end_k)
+//       goto retry_<k-1>;      // x*
+//     entry_k = text;
+//   star_k:
+//     saved_k = text;
+//     ...                      // The rest of the regexp
+//     return 1;
+//   retry_k:
+//     text = saved_k;
+//     if (text != end && has(x, *text)) {
+//       text = &text[1];
+//       goto star_k;
+//     }
+//     tried_begin_k = entry_k;
+//     tried_end_k = text;
+//     goto retry_<k-1>;        // .*: return 0, without entry_k or tried_*_k
+//     ...
+//     saved_j = text;          // x?
+//   optional_j:
+//     ...                      // The rest of the regexp
+//   retry_j:
+//     if (saved_j == NULL)
+//       goto retry_<j-1>;
+//     text = saved_j;
+//     saved_j = NULL;
+//     if (text == end || !has(x, *text))
+//       goto retry_<j-1>;
+//     text = &text[1];
+//     goto optional_j;
+//   retry_-1:                  // Anchored: return 0
+//     if (start == end)
+//       return 0;
+//     start = &start[1];
+//     goto try_start;
+//   }
+struct backtrack_choice
+{
+  const struct re_atom *atom;
+  gcc_jit_lvalue *table;
+  gcc_jit_lvalue *saved;
+  gcc_jit_block *loop;  // Where the rest of the regexp starts
+  gcc_jit_block *retry; // Made when some failure needs it
+
+  // For x* only
+  int cut;              // A .*, which needs no entry or tried_*
+  gcc_jit_lvalue *entry;
+  gcc_jit_lvalue *tried_begin;
+  gcc_jit_lvalue *tried_end;
+};
+
+struct backtrack
+{
+  gcc_jit_context *ctx;
+  gcc_jit_function *match;
+  gcc_jit_param *param_text;
+  gcc_jit_param *param_end;
+  gcc_jit_lvalue *start;
+  gcc_jit_block *try_start;  // Or the memchr for 'first'
+  gcc_jit_block *restart;    // Retry block of the start position
+  gcc_jit_block *return_zero;
+  int anchored;
+  const struct re_atom *first;
+  struct backtrack_choice *choices;
+};
+
+// The block a failure jumps to when 'top' is the closest choice point on its
+// left (-1 for none). Unreachable blocks are errors, so retry blocks are only
+// made once a failure needs them.
+static gcc_jit_block *backtrack_fail_block(struct backtrack *bt, int top)
+{
+  gcc_jit_context *ctx = bt->ctx;
+  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(bt->param_text);
+  gcc_jit_rvalue *rval_end = gcc_jit_param_as_rvalue(bt->param_end);
+  gcc_jit_rvalue *rval_start = gcc_jit_lvalue_as_rvalue(bt->start);
+
+  if (top < 0)
+  {
+    if (bt->restart != NULL)
+      return bt->restart;
+
+    generate_return_zero(ctx, bt->match, &bt->return_zero);
+    if (bt->anchored)
+    {
+      bt->restart = bt->return_zero;
+      return bt->restart;
+    }
+
+    bt->restart = gcc_jit_function_new_block(bt->match, new_block_name());
+    gcc_jit_block *advance = bt->restart;
+    if (bt->first == NULL)
+    {
+      // Must look even if the line is empty, so end itself is tried too
+      advance = gcc_jit_function_new_block(bt->match, new_block_name());
+      gcc_jit_block_end_with_conditional(bt->restart, /* loc */ NULL,
+          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+            GCC_JIT_COMPARISON_EQ, rval_start, rval_end),
+          bt->return_zero,
+          advance);
+    }
+    gcc_jit_block_add_assignment(advance, /* loc */ NULL, bt->start,
+        generate_text_plus_one(ctx, rval_start));
+    gcc_jit_block_end_with_jump(advance, /* loc */ NULL, bt->try_start);
+    return bt->restart;
+  }
+
+  struct backtrack_choice *choice = &bt->choices[top];
+  if (choice->retry != NULL)
+    return choice->retry;
+
+  choice->retry = gcc_jit_function_new_block(bt->match, new_block_name());
+  gcc_jit_block *fail = choice->cut ? NULL : backtrack_fail_block(bt, top - 1);
+  gcc_jit_block *next = gcc_jit_function_new_block(bt->match, new_block_name());
+
+  if (choice->atom->repeat == RE_STAR && choice->cut)
+  {
+    generate_return_zero(ctx, bt->match, &bt->return_zero);
+    gcc_jit_block_add_assignment(choice->retry, /* loc */ NULL,
+        gcc_jit_param_as_lvalue(bt->param_text),
+        gcc_jit_lvalue_as_rvalue(choice->saved));
+    generate_atom_test(ctx, bt->match, choice->retry, choice->atom, choice->table,
+        rval_text, rval_end, next, bt->return_zero);
+  }
+  else if (choice->atom->repeat == RE_STAR)
+  {
+    gcc_jit_block *exhausted = gcc_jit_function_new_block(bt->match, new_block_name());
+
+    gcc_jit_block_add_assignment(choice->retry, /* loc */ NULL,
+        gcc_jit_param_as_lvalue(bt->param_text),
+        gcc_jit_lvalue_as_rvalue(choice->saved));
+    generate_atom_test(ctx, bt->match, choice->retry, choice->atom, choice->table,
+        rval_text, rval_end, next, exhausted);
+
+    gcc_jit_block_add_assignment(exhausted, /* loc */ NULL, choice->tried_begin,
+        gcc_jit_lvalue_as_rvalue(choice->entry));
+    gcc_jit_block_add_assignment(exhausted, /* loc */ NULL, choice->tried_end, rval_text);
+    gcc_jit_block_end_with_jump(exhausted, /* loc */ NULL, fail);
+  }
+  else
+  {
+    gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+    gcc_jit_rvalue *null = gcc_jit_context_null(ctx, const_char_ptr_type);
+    gcc_jit_block *consume = gcc_jit_function_new_block(bt->match, new_block_name());
+
+    gcc_jit_block_end_with_conditional(choice->retry, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_EQ, gcc_jit_lvalue_as_rvalue(choice->saved), null),
+        fail,
+        consume);
+
+    gcc_jit_block_add_assignment(consume, /* loc */ NULL,
+        gcc_jit_param_as_lvalue(bt->param_text),
+        gcc_jit_lvalue_as_rvalue(choice->saved));
+    gcc_jit_block_add_assignment(consume, /* loc */ NULL, choice->saved, null);
+    generate_atom_test(ctx, bt->match, consume, choice->atom, choice->table,
+        rval_text, rval_end, next, fail);
+  }
+
+  gcc_jit_block_add_assignment(next, /* loc */ NULL,
+      gcc_jit_param_as_lvalue(bt->param_text),
+      generate_text_plus_one(ctx, rval_text));
+  gcc_jit_block_end_with_jump(next, /* loc */ NULL, choice->loop);
+
+  return choice->retry;
+}
+
+static gcc_jit_function *generate_code_backtrack(gcc_jit_context *ctx, const struct re_pattern *pattern,
+    gcc_jit_lvalue **tables, const char *function_name, enum gcc_jit_function_kind kind,
+    struct codegen_imports *imports)
+{
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *bool_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_BOOL);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+  gcc_jit_rvalue *null = gcc_jit_context_null(ctx, const_char_ptr_type);
+
+  struct backtrack bt = { .ctx = ctx };
+  bt.param_text = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "text");
+  bt.param_end = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "end");
+  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(bt.param_text);
+  gcc_jit_rvalue *rval_end = gcc_jit_param_as_rvalue(bt.param_end);
+
+  gcc_jit_param* params[] = { bt.param_text, bt.param_end };
+  bt.match = gcc_jit_context_new_function(ctx, /* loc */ NULL,
+      kind, int_type, function_name,
+      2, params, /* is_variadic */ 0);
+  bt.start = gcc_jit_function_new_local(bt.match, /* loc */ NULL, const_char_ptr_type, "start");
+  gcc_jit_rvalue *rval_start = gcc_jit_lvalue_as_rvalue(bt.start);
+
+  bt.anchored = pattern->anchored;
+  bt.first = required_first_literal(pattern);
+  bt.choices = calloc(pattern->num_atoms + 1, sizeof(*bt.choices));
+  int i = re_skippable_prefix(pattern);
+
+  // The first block of a function is its entry. It ends once every x* has
+  // set up its locals.
+  gcc_jit_block *entry = gcc_jit_function_new_block(bt.match, new_block_name());
+  gcc_jit_block *current_block = gcc_jit_function_new_block(bt.match, new_block_name());
+  gcc_jit_block_add_assignment(entry, /* loc */ NULL, bt.start, rval_text);
+
+  if (bt.first != NULL)
+  {
+    // start = jgrep_memchr(start, end, first);
+    // if (start == NULL)
+    //   return 0;
+    // text = &start[1];  // first is already matched
+    bt.try_start = gcc_jit_function_new_block(bt.match, new_block_name());
+    gcc_jit_block_add_assignment(bt.try_start, /* loc */ NULL, bt.start,
+        generate_memchr_call(ctx, imports, rval_start, rval_end,
+          bt.first->literal, other_case(bt.first)));
+    generate_return_zero(ctx, bt.match, &bt.return_zero);
+    gcc_jit_block_end_with_conditional(bt.try_start, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_EQ,
+          rval_start,
+          null),
+        bt.return_zero,
+        current_block);
+    gcc_jit_block_add_assignment(current_block, /* loc */ NULL,
+        gcc_jit_param_as_lvalue(bt.param_text),
+        generate_text_plus_one(ctx, rval_start));
+    i++;
+  }
+  else
+  {
+    bt.try_start = current_block;
+    gcc_jit_block_add_assignment(current_block, /* loc */ NULL,
+        gcc_jit_param_as_lvalue(bt.param_text), rval_start);
+  }
+
+  gcc_jit_block* return_one = gcc_jit_function_new_block(bt.match, new_block_name());
+  gcc_jit_block_end_with_return(return_one, /* loc */ NULL,
+      gcc_jit_context_one(ctx, int_type));
+
+  int num_choices = 0;
+  for (;; i++)
+  {
+    if (i == pattern->num_atoms && pattern->dollar)
+    {
+      // if (text == end || *text == '\n')
+      //    return 1;
+      // goto retry_<k-1>;
+      gcc_jit_block_end_with_conditional(current_block, /* loc */ NULL,
+          generate_end_of_line_check(ctx, rval_text, rval_end),
+          return_one,
+          backtrack_fail_block(&bt, num_choices - 1));
+      break;
+    }
+    else if (i == pattern->num_atoms)
+    {
+      gcc_jit_block_end_with_jump(current_block, /* loc */ NULL, return_one);
+      break;
+    }
+
+    const struct re_atom *atom = &pattern->atoms[i];
+    if (atom->repeat == RE_STAR && atom->any)
+    {
+      // saved_k = text;
+      struct backtrack_choice *choice = &bt.choices[num_choices++];
+      choice->atom = atom;
+      choice->cut = 1;
+      choice->saved = gcc_jit_function_new_local(bt.match, /* loc */ NULL, const_char_ptr_type, new_local_name());
+      choice->loop = gcc_jit_function_new_block(bt.match, new_block_name());
+      gcc_jit_block_end_with_jump(current_block, /* loc */ NULL, choice->loop);
+      gcc_jit_block_add_assignment(choice->loop, /* loc */ NULL, choice->saved, rval_text);
+
+      current_block = choice->loop;
+    }
+    else if (atom->repeat == RE_STAR)
+    {
+      struct backtrack_choice *choice = &bt.choices[num_choices];
+      choice->atom = atom;
+      choice->table = tables[i];
+      choice->saved = gcc_jit_function_new_local(bt.match, /* loc */ NULL, const_char_ptr_type, new_local_name());
+      choice->entry = gcc_jit_function_new_local(bt.match, /* loc */ NULL, const_char_ptr_type, new_local_name());
+      choice->tried_begin = gcc_jit_function_new_local(bt.match, /* loc */ NULL, const_char_ptr_type, new_local_name());
+      choice->tried_end = gcc_jit_function_new_local(bt.match, /* loc */ NULL, const_char_ptr_type, new_local_name());
+      choice->loop = gcc_jit_function_new_block(bt.match, new_block_name());
+      gcc_jit_block_add_assignment(entry, /* loc */ NULL, choice->tried_end, null);
+
+      // if (tried_end_k != NULL && tried_begin_k <= text && text <= tried_end_k)
+      //   goto retry_<k-1>;
+      // entry_k = text;
+      gcc_jit_rvalue *rval_tried_end = gcc_jit_lvalue_as_rvalue(choice->tried_end);
+      gcc_jit_rvalue *tried = gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+          GCC_JIT_BINARY_OP_LOGICAL_AND, bool_type,
+          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+            GCC_JIT_COMPARISON_NE, rval_tried_end, null),
+          gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+            GCC_JIT_BINARY_OP_LOGICAL_AND, bool_type,
+            gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+              GCC_JIT_COMPARISON_LE, gcc_jit_lvalue_as_rvalue(choice->tried_begin), rval_text),
+            gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+              GCC_JIT_COMPARISON_LE, rval_text, rval_tried_end)));
+      gcc_jit_block *enter = gcc_jit_function_new_block(bt.match, new_block_name());
+      gcc_jit_block_end_with_conditional(current_block, /* loc */ NULL,
+          tried,
+          backtrack_fail_block(&bt, num_choices - 1),
+          enter);
+      gcc_jit_block_add_assignment(enter, /* loc */ NULL, choice->entry, rval_text);
+      gcc_jit_block_end_with_jump(enter, /* loc */ NULL, choice->loop);
+
+      // saved_k = text;
+      gcc_jit_block_add_assignment(choice->loop, /* loc */ NULL, choice->saved, rval_text);
+
+      num_choices++;
+      current_block = choice->loop;
+    }
+    else if (atom->repeat == RE_OPTIONAL)
+    {
+      // saved_k = text;
+      struct backtrack_choice *choice = &bt.choices[num_choices++];
+      choice->atom = atom;
+      choice->table = tables[i];
+      choice->saved = gcc_jit_function_new_local(bt.match, /* loc */ NULL, const_char_ptr_type, new_local_name());
+      choice->loop = gcc_jit_function_new_block(bt.match, new_block_name());
+      gcc_jit_block_add_assignment(current_block, /* loc */ NULL, choice->saved, rval_text);
+      gcc_jit_block_end_with_jump(current_block, /* loc */ NULL, choice->loop);
+
+      current_block = choice->loop;
+    }
+    else
+    {
+      // if (text == end || !has(atom, *text))
+      //    goto retry_<k-1>;
+      // text = &text[1];
+      gcc_jit_block* next_block = gcc_jit_function_new_block(bt.match, new_block_name());
+      generate_atom_test(ctx, bt.match, current_block, atom, tables[i],
+          rval_text, rval_end, next_block, backtrack_fail_block(&bt, num_choices - 1));
+
+      gcc_jit_block_add_assignment(next_block, /* loc */ NULL,
+          gcc_jit_param_as_lvalue(bt.param_text),
+          generate_text_plus_one(ctx, rval_text));
+      current_block = next_block;
+    }
+  }
+
+  gcc_jit_block_end_with_jump(entry, /* loc */ NULL, bt.try_start);
+
+  free(bt.choices);
+  return bt.match;
+}
+
+// match for CODEGEN_CALLS: matchhere at every start position
+static gcc_jit_function *generate_code_calls(gcc_jit_context *ctx, const struct re_pattern *pattern,
+    gcc_jit_lvalue **tables, const char *function_name, enum gcc_jit_function_kind kind,
+    struct codegen_imports *imports)
+{
+  gcc_jit_function* matchhere = generate_code_matchhere(ctx, pattern, tables,
+      re_skippable_prefix(pattern), new_function_name());
+  const struct re_atom *first = required_first_literal(pattern);
+  // match function
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+
+  gcc_jit_param *param_text = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "text");
+  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(param_text);
+  gcc_jit_param *param_end = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "end");
+  gcc_jit_rvalue *rval_end = gcc_jit_param_as_rvalue(param_end);
+
+  gcc_jit_param* params[] = { param_text, param_end };
+  gcc_jit_function *match = gcc_jit_context_new_function(ctx, /* loc */ NULL,
+      kind, int_type, function_name,
+      2, params, /* is_variadic */ 0);
+
+  gcc_jit_rvalue* args[] = { rval_text, rval_end };
+  gcc_jit_rvalue* call_to_matchhere = gcc_jit_context_new_call(ctx, /* loc */ NULL,
+      matchhere,
+      2, args);
+  if (first != NULL)
+  {
+    generate_code_match_prefiltered(ctx, match, matchhere, param_text, param_end, first, imports);
+  }
+  else if (pattern->anchored)
+  {
+    gcc_jit_block* block = gcc_jit_function_new_block(match, new_block_name());
+
+    gcc_jit_block_end_with_return(
+        block, /* loc */ NULL,
+        gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+            GCC_JIT_COMPARISON_NE,
+            call_to_matchhere,
+            gcc_jit_context_zero(ctx, int_type)),
+          int_type));
+  }
+  else
+  {
+    gcc_jit_block* loop_body = gcc_jit_function_new_block(match, new_block_name());
+    gcc_jit_block* return_one = gcc_jit_function_new_block(match, new_block_name());
+    gcc_jit_block* condition_check = gcc_jit_function_new_block(match, new_block_name());
+    gcc_jit_block* advance = gcc_jit_function_new_block(match, new_block_name());
+    gcc_jit_block* return_zero = gcc_jit_function_new_block(match, new_block_name());
+
+    gcc_jit_block_end_with_conditional(
+        loop_body, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_NE,
+          call_to_matchhere,
+          gcc_jit_context_zero(ctx, int_type)),
+        return_one,
+        condition_check);
+
+    gcc_jit_block_end_with_return(
+        return_one, /* loc */ NULL,
+        gcc_jit_context_one(ctx, int_type));
+
+    // Must look even if the line is empty, so end itself is tried too
+    gcc_jit_block_end_with_conditional(
+        condition_check, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_NE,
+          rval_text,
+          rval_end),
+        advance,
+        return_zero);
+
+    gcc_jit_block_add_assignment(
+        advance, /* loc */ NULL,
+        gcc_jit_param_as_lvalue(param_text),
+        generate_text_plus_one(ctx, rval_text));
+    gcc_jit_block_end_with_jump(advance, /* loc */ NULL, loop_body);
+
+    gcc_jit_block_end_with_return(
+        return_zero, /* loc */ NULL,
+        gcc_jit_context_zero(ctx, int_type));
+  }
+  // gcc_jit_function_dump_to_dot(match, "match.dot");
+
+  // gcc_jit_context_dump_to_file(ctx, "generated-regex.dump", /* update-locations */ 1);
+  // gcc_jit_context_set_bool_option(ctx, GCC_JIT_BOOL_OPTION_DEBUGINFO, 1);
+
+  return match;
+}
+
+// Generates the code of a single regexp (no '\n') as function 'function_name'
+static gcc_jit_function *generate_code_pattern(gcc_jit_context *ctx, const char* regexp,
+    int flags, const char *function_name, enum gcc_jit_function_kind kind,
+    enum codegen_mode mode, struct codegen_imports *imports)
+{
+#ifdef LIBGCCJIT_HAVE_SWITCH_STATEMENTS
+  struct dfa dfa;
+  if (mode == CODEGEN_AUTO && dfa_build(&dfa, regexp, flags, DFA_MAX_STATES) == 0)
+  {
+    gcc_jit_function *match = generate_code_dfa(ctx, &dfa, function_name, kind, imports);
+    dfa_free(&dfa);
+    return match;
+  }
+#endif
+
+  struct re_pattern pattern;
+  parse_pattern(&pattern, regexp, flags);
+  gcc_jit_lvalue **tables = generate_atom_tables(ctx, &pattern);
+
+  gcc_jit_function *match;
+  if (mode == CODEGEN_CALLS)
+    match = generate_code_calls(ctx, &pattern, tables, function_name, kind, imports);
+  else
+    match = generate_code_backtrack(ctx, &pattern, tables, function_name, kind, imports);
+
+  free(tables);
+  re_pattern_free(&pattern);
+  return match;
+}
+
+// The candidate patterns are tracked in a 64-bit mask
+enum { MAX_CANDIDATE_PATTERNS = 64 };
+
+// A list this short goes through dfa_build first: the cost of the subset
+// construction grows with the length of the list
+enum { DFA_MAX_LIST_LENGTH = 512 };
+
+#ifdef LIBGCCJIT_HAVE_gcc_jit_global_set_initializer
+// The Aho-Corasick scan of match for a list of patterns, run from 'entry':
+//
+//   begin = text;
+//   state = 0;
+//   for (; text != end && *text != '\n'; text = &text[1]) {
+//     state = next[state * num_classes + byte_class[(unsigned char)*text]];
+//     if (flags[state] != 0) {
+//       if (flags[state] & AC_MATCH)
+//         return 1;
+//       candidates |= candidate_table[state];
+//     }
+//   }
+//   goto verify;
+//
+// 'candidates' is NULL if no pattern is a candidate.
+static void generate_code_ac_scan(gcc_jit_context *ctx, gcc_jit_function *match,
+    const struct ac_automaton *ac,
+    gcc_jit_block *entry, gcc_jit_block *verify, gcc_jit_block *return_one,
+    gcc_jit_param *param_text, gcc_jit_param *param_end, gcc_jit_lvalue *candidates)
+{
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CHAR);
+  gcc_jit_type *unsigned_char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_UNSIGNED_CHAR);
+  gcc_jit_type *unsigned_short_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_UNSIGNED_SHORT);
+  gcc_jit_type *mask_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_UNSIGNED_LONG_LONG);
+
+  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(param_text);
+  gcc_jit_rvalue *rval_end = gcc_jit_param_as_rvalue(param_end);
+
+  // Tables are as narrow as their values allow, to stay in cache
+  int num_entries = ac->num_states * ac->num_classes;
+  gcc_jit_lvalue *next;
+  if (ac->num_states <= 0x10000)
+  {
+    unsigned short *narrow = malloc(sizeof(*narrow) * num_entries);
+    for (int i = 0; i < num_entries; i++)
+      narrow[i] = ac->next[i];
+    next = generate_table(ctx, unsigned_short_type, sizeof(*narrow), "ac_next", narrow, num_entries);
+    free(narrow);
+  }
+  else
+  {
+    int *wide = malloc(sizeof(*wide) * num_entries);
+    for (int i = 0; i < num_entries; i++)
+      wide[i] = ac->next[i];
+    next = generate_table(ctx, int_type, sizeof(*wide), "ac_next", wide, num_entries);
+    free(wide);
+  }
+  gcc_jit_lvalue *byte_class = generate_table(ctx, unsigned_char_type, 1, "ac_byte_class",
+      ac->byte_class, 256);
+  gcc_jit_lvalue *flags = generate_table(ctx, unsigned_char_type, 1, "ac_flags",
+      ac->flags, ac->num_states);
+  gcc_jit_lvalue *candidate_table = NULL;
+  if (candidates != NULL)
+  {
+    unsigned long long *masks = malloc(sizeof(*masks) * ac->num_states);
+    for (int i = 0; i < ac->num_states; i++)
+      masks[i] = ac->candidates[i];
+    candidate_table = generate_table(ctx, mask_type, sizeof(*masks), "ac_candidates",
+        masks, ac->num_states);
+    free(masks);
+  }
+
+  gcc_jit_lvalue *state = gcc_jit_function_new_local(match, /* loc */ NULL, int_type, new_local_name());
+  gcc_jit_lvalue *c = gcc_jit_function_new_local(match, /* loc */ NULL, int_type, new_local_name());
+
+  gcc_jit_block *loop = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block *read = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block *step = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block *hit = gcc_jit_function_new_block(match, new_block_name());
+
+  gcc_jit_block_add_assignment(entry, /* loc */ NULL, state, gcc_jit_context_zero(ctx, int_type));
+  gcc_jit_block_end_with_jump(entry, /* loc */ NULL, loop);
+
+  gcc_jit_block_end_with_conditional(loop, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ,
+        rval_text,
+        rval_end),
+      verify,
+      read);
+
+  gcc_jit_block_end_with_conditional(read, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ,
+        gcc_jit_lvalue_as_rvalue(
+          gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)),
+        gcc_jit_context_new_rvalue_from_int(ctx, char_type, '\n')),
+      verify,
+      step);
+
+  // c = byte_class[(unsigned char)*text];
+  // text = &text[1];
+  // state = next[state * num_classes + c];
+  gcc_jit_block_add_assignment(step, /* loc */ NULL,
+      c,
+      gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+        generate_table_load(ctx, byte_class,
+          gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+            gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+              gcc_jit_lvalue_as_rvalue(
+                gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)),
+              unsigned_char_type),
+            int_type)),
+        int_type));
+  gcc_jit_block_add_assignment(step, /* loc */ NULL,
+      gcc_jit_param_as_lvalue(param_text),
+      generate_text_plus_one(ctx, rval_text));
+  gcc_jit_block_add_assignment(step, /* loc */ NULL,
+      state,
+      gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+        generate_table_load(ctx, next,
+          gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+            GCC_JIT_BINARY_OP_PLUS, int_type,
+            gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+              GCC_JIT_BINARY_OP_MULT, int_type,
+              gcc_jit_lvalue_as_rvalue(state),
+              gcc_jit_context_new_rvalue_from_int(ctx, int_type, ac->num_classes)),
+            gcc_jit_lvalue_as_rvalue(c))),
+        int_type));
+
+  gcc_jit_rvalue *state_flags = gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+      generate_table_load(ctx, flags, gcc_jit_lvalue_as_rvalue(state)),
+      int_type);
+  gcc_jit_block_end_with_conditional(step, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ,
+        state_flags,
+        gcc_jit_context_zero(ctx, int_type)),
+      loop,
+      hit);
+
+  gcc_jit_rvalue *is_match = gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+      GCC_JIT_COMPARISON_NE,
+      gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+        GCC_JIT_BINARY_OP_BITWISE_AND, int_type,
+        state_flags,
+        gcc_jit_context_new_rvalue_from_int(ctx, int_type, AC_MATCH)),
+      gcc_jit_context_zero(ctx, int_type));
+  if (candidates == NULL)
+  {
+    // Every state with flags is a match
+    gcc_jit_block_end_with_jump(hit, /* loc */ NULL, return_one);
+    return;
+  }
+
+  gcc_jit_block *record = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block_end_with_conditional(hit, /* loc */ NULL, is_match, return_one, record);
+
+  gcc_jit_block_add_assignment_op(record, /* loc */ NULL,
+      candidates,
+      GCC_JIT_BINARY_OP_BITWISE_OR,
+      generate_table_load(ctx, candidate_table, gcc_jit_lvalue_as_rvalue(state)));
+  gcc_jit_block_end_with_jump(record, /* loc */ NULL, loop);
+}
+#endif
+
+// match for a list of regexps separated by '\n':
+//
+//   - regexps that are plain literals are found by an Aho-Corasick automaton
+//     that scans the line once
+//   - the others get a function each, pattern_i. The longest literal part of
+//     the first MAX_CANDIDATE_PATTERNS of them goes into the automaton too,
+//     and pattern_i only runs if its part was seen. The rest always run.
+static gcc_jit_function *generate_code_pattern_list(gcc_jit_context *ctx, const char *list,
+    int flags, const char *function_name, enum gcc_jit_function_kind kind,
+    enum codegen_mode mode, struct codegen_imports *imports)
+{
+  // An empty pattern matches every line
+  size_t list_length = strlen(list);
+  if (list[0] == '\n' || list[list_length - 1] == '\n' || strstr(list, "\n\n") != NULL)
+    return generate_code_pattern(ctx, "", flags, function_name, kind, mode, imports);
+
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+  gcc_jit_type *mask_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_UNSIGNED_LONG_LONG);
+
+  int num_patterns = 1;
+  for (const char *p = list; *p != '\0'; p++)
+    num_patterns += *p == '\n';
+
+  char **patterns = calloc(num_patterns, sizeof(*patterns));
+  char **texts = calloc(num_patterns, sizeof(*texts)); // Of the literal parts
+  struct ac_literal *literals = calloc(num_patterns, sizeof(*literals));
+  int *parts = calloc(num_patterns, sizeof(*parts));
+  int num_literals = 0;
+  int num_parts = 0;
+
+  for (int i = 0; i < num_patterns; i++)
+  {
+    size_t length = strcspn(list, "\n");
+    patterns[i] = strndup(list, length);
+    list += length + (list[length] == '\n');
+
+    struct re_pattern pattern;
+    parse_pattern(&pattern, patterns[i], flags);
+    int literal_length;
+    int first = re_required_literal(&pattern, &literal_length);
+    texts[i] = malloc(literal_length + 1);
+    for (int j = 0; j < literal_length; j++)
+    {
+      // The automaton only folds case with -i, so a [aA] of a pattern
+      // without it is checked on its own
+      if (pattern.atoms[first + j].folded && !(flags & RE_IGNORE_CASE))
+        literal_length = 0;
+      else
+        texts[i][j] = pattern.atoms[first + j].literal;
+    }
+    int whole = literal_length == pattern.num_atoms && !pattern.anchored && !pattern.dollar;
+    re_pattern_free(&pattern);
+
+    parts[i] = -2; // Not a literal, always checked
+    if (whole)
+      parts[i] = -1; // The whole pattern is a literal
+    else if (literal_length > 0 && num_parts < MAX_CANDIDATE_PATTERNS)
+      parts[i] = num_parts++;
+
+#ifdef LIBGCCJIT_HAVE_gcc_jit_global_set_initializer
+    if (parts[i] != -2)
+    {
+      literals[num_literals].text = texts[i];
+      literals[num_literals].length = literal_length;
+      literals[num_literals].part = parts[i];
+      num_literals++;
+    }
+#else
+    // Without tables there is no scan to find the literals, so every pattern
+    // is checked on its own
+    parts[i] = -2;
+#endif
+  }
+
+  gcc_jit_param *param_text = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "text");
+  gcc_jit_param *param_end = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "end");
+  gcc_jit_param* params[] = { param_text, param_end };
+
+  // Patterns that are not plain literals
+  gcc_jit_function **pattern_funs = calloc(num_patterns, sizeof(*pattern_funs));
+  for (int i = 0; i < num_patterns; i++)
+  {
+    if (parts[i] == -1)
+      continue;
+    char name[32];
+    snprintf(name, sizeof(name), "pattern_%d", i);
+    pattern_funs[i] = generate_code_pattern(ctx, patterns[i], flags, name,
+        GCC_JIT_FUNCTION_INTERNAL, mode, imports);
+  }
+
+  gcc_jit_function *match = gcc_jit_context_new_function(ctx, /* loc */ NULL,
+      kind, int_type, function_name,
+      2, params, /* is_variadic */ 0);
+
+  // The first block of a function is its entry
+  gcc_jit_block *entry = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block *verify = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block *return_one = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_block_end_with_return(return_one, /* loc */ NULL, gcc_jit_context_one(ctx, int_type));
+
+  // The scan moves text, the patterns get the whole line
+  gcc_jit_lvalue *begin = gcc_jit_function_new_local(match, /* loc */ NULL, const_char_ptr_type, "begin");
+  gcc_jit_block_add_assignment(entry, /* loc */ NULL, begin, gcc_jit_param_as_rvalue(param_text));
+
+  gcc_jit_lvalue *candidates = NULL;
+  if (num_parts > 0)
+  {
+    candidates = gcc_jit_function_new_local(match, /* loc */ NULL, mask_type, "candidates");
+    gcc_jit_block_add_assignment(entry, /* loc */ NULL, candidates, gcc_jit_context_zero(ctx, mask_type));
+  }
+
+#ifdef LIBGCCJIT_HAVE_gcc_jit_global_set_initializer
+  struct ac_automaton ac;
+  if (num_literals > 0 && ac_build(&ac, literals, num_literals, flags & RE_IGNORE_CASE) == 0)
+  {
+    generate_code_ac_scan(ctx, match, &ac, entry, verify, return_one,
+        param_text, param_end, candidates);
+    ac_free(&ac);
+  }
+  else
+#endif
+  {
+    gcc_jit_block_end_with_jump(entry, /* loc */ NULL, verify);
+  }
+
+  // if ((candidates >> part) & 1)    (only for patterns with a part)
+  //   if (pattern_i(begin, end))
+  //     return 1;
+  // ...
+  // return 0;
+  gcc_jit_rvalue *args[] = {
+    gcc_jit_lvalue_as_rvalue(begin),
+    gcc_jit_param_as_rvalue(param_end),
+  };
+  gcc_jit_block *current = verify;
+  for (int i = 0; i < num_patterns; i++)
+  {
+    if (pattern_funs[i] == NULL)
+      continue;
+
+    gcc_jit_block *call = gcc_jit_function_new_block(match, new_block_name());
+    gcc_jit_block *next = gcc_jit_function_new_block(match, new_block_name());
+
+    if (parts[i] >= 0)
+      gcc_jit_block_end_with_conditional(current, /* loc */ NULL,
+          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+            GCC_JIT_COMPARISON_NE,
+            gcc_jit_context_new_binary_op(ctx, /* loc */ NULL,
+              GCC_JIT_BINARY_OP_BITWISE_AND, mask_type,
+              gcc_jit_lvalue_as_rvalue(candidates),
+              gcc_jit_context_new_rvalue_from_long(ctx, mask_type, (long)(1ULL << parts[i]))),
+            gcc_jit_context_zero(ctx, mask_type)),
+          call,
+          next);
+    else
+      gcc_jit_block_end_with_jump(current, /* loc */ NULL, call);
+
+    gcc_jit_block_end_with_conditional(call, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_NE,
+          gcc_jit_context_new_call(ctx, /* loc */ NULL, pattern_funs[i], 2, args),
+          gcc_jit_context_zero(ctx, int_type)),
+        return_one,
+        next);
+
+    current = next;
+  }
+  gcc_jit_block_end_with_return(current, /* loc */ NULL, gcc_jit_context_zero(ctx, int_type));
+
+  for (int i = 0; i < num_patterns; i++)
+  {
+    free(patterns[i]);
+    free(texts[i]);
+  }
+  free(patterns);
+  free(texts);
+  free(literals);
+  free(parts);
+  free(pattern_funs);
+  return match;
+}
+
+// Bytes of text in rough order of frequency, most frequent first. Bytes not
+// listed are rarer than any listed.
+static const char common_bytes[] = " etaoinsrhldcumfpgwybvkxjqz\t_.,-=/:0123456789";
+
+// The rarest byte of the longest literal that every match of 'regexp'
+// contains, or '\0' if there is none. Sets 'other' to its uppercase if it is
+// folded, else to the byte itself.
+static char required_rare_byte(const char *regexp, int flags, char *other)
+{
+  struct re_pattern pattern;
+  parse_pattern(&pattern, regexp, flags);
+
+  int length;
+  const struct re_atom *literal = &pattern.atoms[re_required_literal(&pattern, &length)];
+
+  char rarest = '\0';
+  int rarest_rank = -1;
+  *other = '\0';
+  for (int i = 0; i < length; i++)
+  {
+    const char *common = strchr(common_bytes, literal[i].literal);
+    int rank = common != NULL ? common - common_bytes : (int)sizeof(common_bytes);
+    if (rank > rarest_rank)
+    {
+      rarest = literal[i].literal;
+      *other = other_case(&literal[i]);
+      rarest_rank = rank;
+    }
+  }
+
+  re_pattern_free(&pattern);
+  return rarest;
+}
+
+// long scan(const char *begin, const char *end,
+//     const char **hits, long max_hits, const char **next)
+// {
+//   const char *line = begin;
+//   long num_hits = 0;
+//   const char *p = NULL;
+//   int misses = 0;
+//   while (line != end && num_hits != max_hits) {
+//     // Only with a byte 'rare' that every matching line contains: the lines
+//     // before the next one, at 'p', cannot match. Skipping them is worth a
+//     // search back only when they are long enough, and when the byte keeps
+//     // turning up close by, looking for it only costs, so it stops.
+//     if (misses < MAX_FILTER_MISSES) {
+//       if (p < line) {
+//         p = jgrep_memchr(line, end, rare);  // Or memchr2 for both cases
+//         if (p == NULL) {
+//           line = end;
+//           break;
+//         }
+//         if (p < &line[MIN_SKIP])
+//           misses++;
+//       }
+//       if (p >= &line[MIN_SKIP]) {
+//         const char *start = jgrep_memrchr(line, p, '\n');
+//         if (start != NULL) {
+//           line = &start[1];
+//           misses = 0;
+//         }
+//       }
+//     }
+//
+//     const char *line_end = jgrep_memchr(line, end, '\n');
+//     if (line_end == NULL)
+//       line_end = end;
+//     if (match(line, line_end))
+//       hits[num_hits++] = line;
+//     line = line_end == end ? end : &line_end[1];
+//   }
+//   *next = line;
+//   return num_hits;
+// }
+//
+// 'match' is the internal matcher of the regexp: an exported function could
+// be interposed, so calls to it could not be inlined.
+enum { MAX_FILTER_MISSES = 16, MIN_SKIP = 64 };
+static void generate_code_scan(gcc_jit_context *ctx, gcc_jit_function *match,
+    char rare, char rare_other, struct codegen_imports *imports)
+{
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *long_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_LONG);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+  gcc_jit_type *const_char_ptr_ptr_type = gcc_jit_type_get_pointer(const_char_ptr_type);
+
+  gcc_jit_param *param_begin = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "begin");
+  gcc_jit_param *param_end = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "end");
+  gcc_jit_param *param_hits = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_ptr_type, "hits");
+  gcc_jit_param *param_max_hits = gcc_jit_context_new_param(ctx, /* loc */ NULL, long_type, "max_hits");
+  gcc_jit_param *param_next = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_ptr_type, "next");
+  gcc_jit_rvalue *rval_end = gcc_jit_param_as_rvalue(param_end);
+
+  gcc_jit_param *params[] = { param_begin, param_end, param_hits, param_max_hits, param_next };
+  gcc_jit_function *scan = gcc_jit_context_new_function(ctx, /* loc */ NULL,
+      GCC_JIT_FUNCTION_EXPORTED, long_type, "scan",
+      5, params, /* is_variadic */ 0);
+
+  gcc_jit_lvalue *line = gcc_jit_function_new_local(scan, /* loc */ NULL, const_char_ptr_type, "line");
+  gcc_jit_lvalue *line_end = gcc_jit_function_new_local(scan, /* loc */ NULL, const_char_ptr_type, "line_end");
+  gcc_jit_lvalue *num_hits = gcc_jit_function_new_local(scan, /* loc */ NULL, long_type, "num_hits");
+  gcc_jit_lvalue *p = gcc_jit_function_new_local(scan, /* loc */ NULL, const_char_ptr_type, "p");
+  gcc_jit_lvalue *misses = gcc_jit_function_new_local(scan, /* loc */ NULL, int_type, "misses");
+  gcc_jit_rvalue *rval_line = gcc_jit_lvalue_as_rvalue(line);
+  gcc_jit_rvalue *rval_line_end = gcc_jit_lvalue_as_rvalue(line_end);
+  gcc_jit_rvalue *rval_num_hits = gcc_jit_lvalue_as_rvalue(num_hits);
+  gcc_jit_rvalue *null = gcc_jit_context_null(ctx, const_char_ptr_type);
+
+  gcc_jit_block *entry = gcc_jit_function_new_block(scan, new_block_name());
+  gcc_jit_block *loop_check = gcc_jit_function_new_block(scan, new_block_name());
+  gcc_jit_block *hits_check = gcc_jit_function_new_block(scan, new_block_name());
+  gcc_jit_block *find_end = gcc_jit_function_new_block(scan, new_block_name());
+  gcc_jit_block *last_line = gcc_jit_function_new_block(scan, new_block_name());
+  gcc_jit_block *try_line = gcc_jit_function_new_block(scan, new_block_name());
+  gcc_jit_block *record = gcc_jit_function_new_block(scan, new_block_name());
+  gcc_jit_block *advance = gcc_jit_function_new_block(scan, new_block_name());
+  gcc_jit_block *next_line = gcc_jit_function_new_block(scan, new_block_name());
+  gcc_jit_block *done = gcc_jit_function_new_block(scan, new_block_name());
+
+  gcc_jit_block_add_assignment(entry, /* loc */ NULL, line, gcc_jit_param_as_rvalue(param_begin));
+  gcc_jit_block_add_assignment(entry, /* loc */ NULL, num_hits, gcc_jit_context_zero(ctx, long_type));
+  gcc_jit_block_add_assignment(entry, /* loc */ NULL, p, null);
+  gcc_jit_block_add_assignment(entry, /* loc */ NULL, misses, gcc_jit_context_zero(ctx, int_type));
+  gcc_jit_block_end_with_jump(entry, /* loc */ NULL, loop_check);
+
+  gcc_jit_block_end_with_conditional(loop_check, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ, rval_line, rval_end),
+      done,
+      hits_check);
+
+  gcc_jit_block *first_block = find_end;
+  if (rare != '\0')
+  {
+    gcc_jit_block *filter_check = gcc_jit_function_new_block(scan, new_block_name());
+    gcc_jit_block *find_start = gcc_jit_function_new_block(scan, new_block_name());
+    gcc_jit_block *no_more = gcc_jit_function_new_block(scan, new_block_name());
+    gcc_jit_block *move_start = gcc_jit_function_new_block(scan, new_block_name());
+    gcc_jit_block *miss = gcc_jit_function_new_block(scan, new_block_name());
+    gcc_jit_block *cached_check = gcc_jit_function_new_block(scan, new_block_name());
+    gcc_jit_block *cached_skip_check = gcc_jit_function_new_block(scan, new_block_name());
+    gcc_jit_block *found_skip_check = gcc_jit_function_new_block(scan, new_block_name());
+    gcc_jit_block *search_back = gcc_jit_function_new_block(scan, new_block_name());
+    gcc_jit_rvalue *rval_p = gcc_jit_lvalue_as_rvalue(p);
+
+    first_block = filter_check;
+
+    gcc_jit_block_end_with_conditional(filter_check, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_LT,
+          gcc_jit_lvalue_as_rvalue(misses),
+          gcc_jit_context_new_rvalue_from_int(ctx, int_type, MAX_FILTER_MISSES)),
+        cached_check,
+        find_end);
+
+    gcc_jit_block_end_with_conditional(cached_check, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_LT, rval_p, rval_line),
+        find_start,
+        cached_skip_check);
+
+    gcc_jit_rvalue *skip_limit = gcc_jit_context_new_cast(ctx, /* loc */ NULL,
+        gcc_jit_lvalue_get_address(
+          gcc_jit_context_new_array_access(ctx, /* loc */ NULL, rval_line,
+            gcc_jit_context_new_rvalue_from_int(ctx, int_type, MIN_SKIP)),
+          /* loc */ NULL),
+        const_char_ptr_type);
+    gcc_jit_block_end_with_conditional(cached_skip_check, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_LT, rval_p, skip_limit),
+        find_end,
+        search_back);
+    gcc_jit_block_end_with_conditional(found_skip_check, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_LT, rval_p, skip_limit),
+        miss,
+        search_back);
+
+    gcc_jit_block_add_assignment(find_start, /* loc */ NULL, p,
+        generate_memchr_call(ctx, imports, rval_line, rval_end,
+          (unsigned char)rare, (unsigned char)rare_other));
+
+    gcc_jit_block_add_assignment(no_more, /* loc */ NULL, line, rval_end);
+    gcc_jit_block_end_with_jump(no_more, /* loc */ NULL, done);
+
+    gcc_jit_function *memrchr_fun = generate_memrchr_import(ctx, imports);
+
+    gcc_jit_block_end_with_conditional(find_start, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_EQ, rval_p, null),
+        no_more,
+        found_skip_check);
+
+    // The start is looked for in line_end, which is free until find_end
+    gcc_jit_rvalue *memrchr_args[] = {
+      rval_line,
+      rval_p,
+      gcc_jit_context_new_rvalue_from_int(ctx, int_type, '\n'),
+    };
+    gcc_jit_block_add_assignment(search_back, /* loc */ NULL, line_end,
+        gcc_jit_context_new_call(ctx, /* loc */ NULL, memrchr_fun, 3, memrchr_args));
+    gcc_jit_block_end_with_conditional(search_back, /* loc */ NULL,
+        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+          GCC_JIT_COMPARISON_EQ, rval_line_end, null),
+        find_end,
+        move_start);
+
+    gcc_jit_block_add_assignment(move_start, /* loc */ NULL, line,
+        generate_text_plus_one(ctx, rval_line_end));
+    gcc_jit_block_add_assignment(move_start, /* loc */ NULL, misses, gcc_jit_context_zero(ctx, int_type));
+    gcc_jit_block_end_with_jump(move_start, /* loc */ NULL, find_end);
+
+    gcc_jit_block_add_assignment_op(miss, /* loc */ NULL, misses,
+        GCC_JIT_BINARY_OP_PLUS, gcc_jit_context_one(ctx, int_type));
+    gcc_jit_block_end_with_jump(miss, /* loc */ NULL, find_end);
+  }
+
+  gcc_jit_block_end_with_conditional(hits_check, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ, rval_num_hits, gcc_jit_param_as_rvalue(param_max_hits)),
+      done,
+      first_block);
+
+  gcc_jit_block_add_assignment(find_end, /* loc */ NULL, line_end,
+      generate_memchr_call(ctx, imports, rval_line, rval_end, '\n', '\n'));
+  gcc_jit_block_end_with_conditional(find_end, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ, rval_line_end, null),
+      last_line,
+      try_line);
+
+  gcc_jit_block_add_assignment(last_line, /* loc */ NULL, line_end, rval_end);
+  gcc_jit_block_end_with_jump(last_line, /* loc */ NULL, try_line);
+
+  gcc_jit_rvalue *match_args[] = { rval_line, rval_line_end };
+  gcc_jit_block_end_with_conditional(try_line, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_NE,
+        gcc_jit_context_new_call(ctx, /* loc */ NULL, match, 2, match_args),
+        gcc_jit_context_zero(ctx, int_type)),
+      record,
+      advance);
+
+  gcc_jit_block_add_assignment(record, /* loc */ NULL,
+      gcc_jit_context_new_array_access(ctx, /* loc */ NULL,
+        gcc_jit_param_as_rvalue(param_hits), rval_num_hits),
+      rval_line);
+  gcc_jit_block_add_assignment_op(record, /* loc */ NULL, num_hits,
+      GCC_JIT_BINARY_OP_PLUS, gcc_jit_context_one(ctx, long_type));
+  gcc_jit_block_end_with_jump(record, /* loc */ NULL, advance);
+
+  gcc_jit_block_add_assignment(advance, /* loc */ NULL, line, rval_line_end);
+  gcc_jit_block_end_with_conditional(advance, /* loc */ NULL,
+      gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
+        GCC_JIT_COMPARISON_EQ, rval_line_end, rval_end),
+      loop_check,
+      next_line);
+
+  gcc_jit_block_add_assignment(next_line, /* loc */ NULL, line,
+      generate_text_plus_one(ctx, rval_line_end));
+  gcc_jit_block_end_with_jump(next_line, /* loc */ NULL, loop_check);
+
+  gcc_jit_block_add_assignment(done, /* loc */ NULL,
+      gcc_jit_rvalue_dereference(gcc_jit_param_as_rvalue(param_next), /* loc */ NULL),
+      rval_line);
+  gcc_jit_block_end_with_return(done, /* loc */ NULL, rval_num_hits);
+}
+
+// int match(const char *text, const char *end)
+// {
+//   return match_line(text, end);
+// }
+//
+// The exported entry point of the internal 'match_line', for callers matching
+// one line at a time
+static void generate_code_match_export(gcc_jit_context *ctx, gcc_jit_function *match_line)
+{
+  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
+  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
+
+  gcc_jit_param *param_text = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "text");
+  gcc_jit_param *param_end = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "end");
+  gcc_jit_param *params[] = { param_text, param_end };
+  gcc_jit_function *match = gcc_jit_context_new_function(ctx, /* loc */ NULL,
+      GCC_JIT_FUNCTION_EXPORTED, int_type, "match",
+      2, params, /* is_variadic */ 0);
+
+  gcc_jit_block *block = gcc_jit_function_new_block(match, new_block_name());
+  gcc_jit_rvalue *args[] = {
+    gcc_jit_param_as_rvalue(param_text),
+    gcc_jit_param_as_rvalue(param_end),
+  };
+  gcc_jit_block_end_with_return(block, /* loc */ NULL,
+      gcc_jit_context_new_call(ctx, /* loc */ NULL, match_line, 2, args));
+}
+
+const char *codegen_mode_name(enum codegen_mode mode)
+{
+  switch (mode)
+  {
+    case CODEGEN_AUTO: return "auto";
+    case CODEGEN_BACKTRACK: return "backtrack";
+    case CODEGEN_CALLS: return "calls";
+  }
+  return "unknown";
+}
+
+void codegen_set_profile(gcc_jit_context *ctx, const struct codegen_profile *profile)
+{
+  gcc_jit_context_set_int_option(ctx, GCC_JIT_INT_OPTION_OPTIMIZATION_LEVEL, profile->opt_level);
+  if (profile->march == NULL)
+    return;
+
+#ifdef LIBGCCJIT_HAVE_gcc_jit_context_add_command_line_option
+  char option[256];
+  snprintf(option, sizeof(option), "-march=%s", profile->march);
+  gcc_jit_context_add_command_line_option(ctx, option);
+#else
+  static atomic_int warned;
+  if (atomic_exchange(&warned, 1) == 0)
+    fprintf(stderr, "jgrep: this libgccjit cannot take -march=%s, ignored\n", profile->march);
+#endif
+}
+
+const char *codegen_profile_name(const struct codegen_profile *profile, char *name, size_t size)
+{
+  if (profile->march == NULL)
+    snprintf(name, size, "O%d", profile->opt_level);
+  else
+    snprintf(name, size, "O%d -march=%s", profile->opt_level, profile->march);
+  return name;
+}
+
+void codegen_parent_init(struct codegen_parent *parent, gcc_jit_context *ctx)
+{
+  parent->ctx = ctx;
+  memset(&parent->imports, 0, sizeof(parent->imports));
+  generate_memchr_import(ctx, &parent->imports);
+  generate_memchr2_import(ctx, &parent->imports);
+  generate_memrchr_import(ctx, &parent->imports);
+}
+
+void generate_code_regexp(gcc_jit_context *ctx, const char* regexp, int flags,
+    enum codegen_mode mode)
+{
+  generate_code_regexp_child(ctx, NULL, regexp, flags, mode);
+}
+
+void generate_code_regexp_child(gcc_jit_context *ctx, const struct codegen_parent *parent,
+    const char* regexp, int flags, enum codegen_mode mode)
+{
+  // A copy, so that the imports a child adds do not end up in the parent. The
+  // parent is still written: libgccjit records in it the types the child
+  // asks for, so children must be built one at a time, under a lock of the
+  // caller (parent_lock in jgrep-lib.c).
+  struct codegen_imports imports = { NULL };
+  if (parent != NULL)
+    imports = parent->imports;
+  gcc_jit_function *match_line = NULL;
+  char rare = '\0';
+  char rare_other = '\0';
+
+  if (strchr(regexp, '\n') == NULL)
+  {
+    match_line = generate_code_pattern(ctx, regexp, flags, "match_line",
+        GCC_JIT_FUNCTION_INTERNAL, mode, &imports);
+    rare = required_rare_byte(regexp, flags, &rare_other);
+  }
+
+#ifdef LIBGCCJIT_HAVE_SWITCH_STATEMENTS
+  // A short list fits in one DFA, which is exact and needs no patterns
+  // checked on their own
+  struct dfa dfa;
+  if (match_line == NULL && mode == CODEGEN_AUTO && strlen(regexp) <= DFA_MAX_LIST_LENGTH
+      && dfa_build(&dfa, regexp, flags, DFA_MAX_STATES) == 0)
+  {
+    match_line = generate_code_dfa(ctx, &dfa, "match_line", GCC_JIT_FUNCTION_INTERNAL, &imports);
+    dfa_free(&dfa);
+  }
+#endif
+
+  if (match_line == NULL)
+    match_line = generate_code_pattern_list(ctx, regexp, flags, "match_line",
+        GCC_JIT_FUNCTION_INTERNAL, mode, &imports);
+
+  generate_code_match_export(ctx, match_line);
+  generate_code_scan(ctx, match_line, rare, rare_other, &imports);
+}
@@ -0,0 +1,102 @@
+#ifndef JGREP_CODEGEN_H
+#define JGREP_CODEGEN_H
+
+#include <stddef.h>
+
+#include <libgccjit.h>
+
+// The exported "match" function built by generate_code_regexp is a
+// match_fun_t: it returns nonzero if the regexp matches somewhere in the line
+// [begin, end), so it can point straight into a mapped file or a read buffer.
+// The exported "scan" is a scan_fun_t running "match" over a buffer of lines.
+#include "jgrep-scan.h"
+
+// Identifies the code generated by this version of jgrep. Matchers compiled
+// by other versions must not be reused (see jgrep-cache.h), so bump it
+// whenever generate_code_regexp changes the code it emits.
+#define JGREP_CODEGEN_VERSION 6
+
+// Called from the generated code to jump to the next candidate position of an
+// unanchored regexp. Returns the first c in [begin, end) or NULL. Programs
+// using generate_code_regexp must be linked with -rdynamic so that the JIT'd
+// code can resolve it.
+const char *jgrep_memchr(const char *begin, const char *end, int c);
+
+// Same, for the last c in [begin, end)
+const char *jgrep_memrchr(const char *begin, const char *end, int c);
+
+// Same, for the first c1 or c2 in [begin, end), 16 bytes at a time with SSE2.
+// With -i it finds both cases of a letter in one pass.
+const char *jgrep_memchr2(const char *begin, const char *end, int c1, int c2);
+
+// How the patterns that are not plain literals are turned into code
+enum codegen_mode
+{
+  CODEGEN_AUTO,      // A DFA when it is small enough, else CODEGEN_BACKTRACK
+  CODEGEN_BACKTRACK, // A function per pattern that backtracks on its own
+  CODEGEN_CALLS,     // A function per x*, called at every position it reaches
+};
+
+const char *codegen_mode_name(enum codegen_mode mode);
+
+// How libgccjit compiles the generated code: its optimization level, 0 to 3,
+// and the CPU to compile for as in gcc's -march, or NULL for the default
+// target. "native" makes the code use all the CPU jgrep runs on has, but it may
+// not run anywhere else.
+struct codegen_profile
+{
+  int opt_level;
+  const char *march;
+};
+
+#define CODEGEN_PROFILE_DEFAULT { 2, NULL }
+
+// Sets the options of 'profile' on 'ctx'. A libgccjit that takes no command
+// line options compiles for its default target, with a warning if 'march' is
+// set.
+void codegen_set_profile(gcc_jit_context *ctx, const struct codegen_profile *profile);
+
+// Writes the name of 'profile', e.g. "O2" or "O3 -march=native", into 'name'
+// and returns it
+const char *codegen_profile_name(const struct codegen_profile *profile, char *name, size_t size);
+
+// The functions of jgrep the generated code calls. A context declares each of
+// them once, however many functions use it.
+struct codegen_imports
+{
+  gcc_jit_function *memchr;
+  gcc_jit_function *memchr2;
+  gcc_jit_function *memrchr;
+};
+
+// Generates the code of functions "match" and "scan" for 'regexp' into 'ctx'. As in grep,
+// a '\n' separates patterns and the line matches if any of them matches. The
+// regexp must be valid with 'flags' (see re_parse_list in jgrep-regexp.h).
+// Several threads may generate code at once, each into a context of its own.
+void generate_code_regexp(gcc_jit_context *ctx, const char* regexp, int flags,
+    enum codegen_mode mode);
+
+// What the code of every regexp shares, declared once in a long-lived parent
+// context: the imports of the helpers above. The code of each regexp then goes
+// to a child context of it (see gcc_jit_context_new_child_context), which also
+// inherits its options.
+struct codegen_parent
+{
+  gcc_jit_context *ctx;
+  struct codegen_imports imports;
+};
+
+// Declares the shared functions in 'ctx', which must not change once it has
+// children
+void codegen_parent_init(struct codegen_parent *parent, gcc_jit_context *ctx);
+
+// generate_code_regexp into 'ctx', a child context of parent->ctx, calling
+// the functions the parent declares. This writes to the parent too: libgccjit
+// makes and caches there the types a child asks for, and the pointer and const
+// types derived from them. Children of the same parent must therefore be
+// generated, and compiled, one at a time. With a NULL 'parent' it is
+// generate_code_regexp.
+void generate_code_regexp_child(gcc_jit_context *ctx, const struct codegen_parent *parent,
+    const char* regexp, int flags, enum codegen_mode mode);
+
+#endif // JGREP_CODEGEN_H
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "jgrep.h"
+
+// Compile throughput of libjgrep: builds the same patterns with
+// jgrep_compile_all on one thread, then on every CPU, each time in child
+// contexts of the shared parent and in contexts of their own
+// (JGREP_OWN_CONTEXT). Every run is a process of its own, so that it starts
+// from the same memory. Prints for each run the time, the mean latency of a
+// pattern and how much of it goes to building its code and to compiling it
+// (see jgrep_compile_times), the patterns per second and the memory the
+// process grew by while building them, matchers included:
+//
+//   contexts threads seconds ms/pattern codegen_ms compile_ms patterns/s rss_MiB KiB/pattern
+//
+// libgccjit compiles one context at a time in the whole process, so with more
+// threads in own contexts compile_ms grows by the time each one waits for the
+// others while codegen_ms stays the same. Children wait instead for the lock
+// of the shared context, before building their code, which neither counts.
+//
+// usage: jgrep-compile-bench [num_patterns [num_threads]]
+//
+// The patterns, 1000 by default, are a fixed mix of literals, classes, x*,
+// x+, x? and anchors, all different, so that the literal search, the DFA and
+// the backtracking matcher are all built. num_threads
+// defaults to the number of CPUs.
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Pattern 'i' of the mix, in 'buffer'
+static void make_pattern(char *buffer, size_t size, int i)
+{
+  static const char *words[] = {
+    "error", "warning", "timeout", "refused", "panic", "denied", "retry", "closed",
+  };
+  static const char *pieces[] = {
+    "[0-9]+", "[a-z]*", " *", ".", "[[:alpha:]]?", "x*", "[^ ]+", "id=",
+  };
+  const char *word = words[i % 8];
+  const char *piece = pieces[(i / 8) % 8];
+  switch ((i / 64) % 4)
+  {
+    case 0: snprintf(buffer, size, "%s%d", word, i); break;
+    case 1: snprintf(buffer, size, "%s%s%d", word, piece, i); break;
+    case 2: snprintf(buffer, size, "^%s%s.*%d$", piece, word, i); break;
+    default: snprintf(buffer, size, "%d%s%s%s", i, piece, word, piece); break;
+  }
+}
+
+// Resident memory of the process, in bytes
+static long long resident_bytes(void)
+{
+  long long size, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f != NULL)
+  {
+    if (fscanf(f, "%lld %lld", &size, &resident) != 2)
+      resident = 0;
+    fclose(f);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void run(const char *const *patterns, int num_patterns, int flags, int num_threads)
+{
+  struct jgrep_matcher **matchers = calloc(num_patterns, sizeof(*matchers));
+  const char **errors = calloc(num_patterns, sizeof(*errors));
+  if (matchers == NULL || errors == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  long long rss = resident_bytes();
+  double start = now();
+  int failed = jgrep_compile_all(patterns, num_patterns, flags, num_threads, matchers, errors);
+  double seconds = now() - start;
+  rss = resident_bytes() - rss;
+  double codegen_seconds, compile_seconds;
+  jgrep_compile_times(&codegen_seconds, &compile_seconds);
+  if (failed > 0)
+  {
+    for (int i = 0; i < num_patterns; i++)
+      if (matchers[i] == NULL)
+      {
+        fprintf(stderr, "cannot compile '%s': %s\n", patterns[i], errors[i]);
+        break;
+      }
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%-9s %7d %9.3f %10.2f %10.2f %10.2f %10.1f %8.1f %11.1f\n",
+      flags & JGREP_OWN_CONTEXT ? "own" : "child", num_threads, seconds,
+      seconds * 1e3 / num_patterns * num_threads, codegen_seconds * 1e3 / num_patterns,
+      compile_seconds * 1e3 / num_patterns, num_patterns / seconds,
+      rss / 1048576.0, rss / 1024.0 / num_patterns);
+
+  for (int i = 0; i < num_patterns; i++)
+    jgrep_free(matchers[i]);
+  free(matchers);
+  free(errors);
+}
+
+// Runs 'run' in a child process
+static void run_apart(const char *const *patterns, int num_patterns, int flags, int num_threads)
+{
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0)
+  {
+    run(patterns, num_patterns, flags, num_threads);
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  int num_patterns = argc > 1 ? atoi(argv[1]) : 1000;
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int num_threads = argc > 2 ? atoi(argv[2]) : (num_cpus > 0 ? num_cpus : 1);
+  if (num_patterns <= 0 || num_threads <= 0)
+  {
+    fprintf(stderr, "usage: %s [num_patterns [num_threads]]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  enum { PATTERN_SIZE = 64 };
+  char (*buffers)[PATTERN_SIZE] = calloc(num_patterns, PATTERN_SIZE);
+  const char **patterns = calloc(num_patterns, sizeof(*patterns));
+  if (buffers == NULL || patterns == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < num_patterns; i++)
+  {
+    make_pattern(buffers[i], PATTERN_SIZE, i);
+    patterns[i] = buffers[i];
+  }
+
+  printf("%-9s %7s %9s %10s %10s %10s %10s %8s %11s\n",
+      "contexts", "threads", "seconds", "ms/pattern", "codegen_ms", "compile_ms", "patterns/s",
+      "rss_MiB", "KiB/pattern");
+  static const int flags[] = { JGREP_OWN_CONTEXT, 0 };
+  for (int i = 0; i < 2; i++)
+  {
+    run_apart(patterns, num_patterns, flags[i], 1);
+    if (num_threads > 1)
+      run_apart(patterns, num_patterns, flags[i], num_threads);
+  }
+
+  free(patterns);
+  free(buffers);
+  return 0;
+}
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jgrep.h"
+
+// Compiles patterns with jgrep_compile_all on several threads at once, in
+// child contexts of the shared parent and in contexts of their own, and
+// checks that every matcher finds the same lines as the interpreter. Built
+// with -fsanitize=thread by "make test-tsan", it also checks that the
+// threads share nothing they should not.
+//
+// usage: jgrep-compile-test [num_patterns [num_threads]]
+//
+// num_patterns defaults to 64 and num_threads to 4. Prints "ok" and exits
+// with 0 if every matcher agrees.
+
+// Pattern 'i', in 'buffer'
+static void make_pattern(char *buffer, size_t size, int i)
+{
+  static const char *words[] = { "error", "warn", "id", "ok" };
+  static const char *pieces[] = { "[0-9]+", "[a-z]*", " *", "." };
+  const char *word = words[i % 4];
+  const char *piece = pieces[(i / 4) % 4];
+  switch ((i / 16) % 4)
+  {
+    case 0: snprintf(buffer, size, "%s%d", word, i % 10); break;
+    case 1: snprintf(buffer, size, "%s%s%d", word, piece, i % 10); break;
+    case 2: snprintf(buffer, size, "^%s%s", piece, word); break;
+    default: snprintf(buffer, size, "%d%s%s$", i % 10, piece, word); break;
+  }
+}
+
+// Lines that each of the patterns matches some of, in 'text'
+static size_t make_text(char *text, size_t size)
+{
+  static const char *words[] = { "error", "warn", "id", "ok", "x", "" };
+  size_t length = 0;
+  unsigned seed = 1;
+  while (length + 64 < size)
+  {
+    seed = seed * 1103515245 + 12345;
+    length += snprintf(text + length, size - length, "%u%s%s %s%u\n",
+        (seed >> 8) % 10, words[(seed >> 12) % 6], (seed >> 16) % 3 ? "" : " ",
+        words[(seed >> 20) % 6], (seed >> 24) % 10);
+  }
+  return length;
+}
+
+static struct jgrep_matcher **compile_all(const char *const *patterns, int num_patterns,
+    int flags, int num_threads)
+{
+  struct jgrep_matcher **matchers = calloc(num_patterns, sizeof(*matchers));
+  const char **errors = calloc(num_patterns, sizeof(*errors));
+  if (matchers == NULL || errors == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  if (jgrep_compile_all(patterns, num_patterns, flags, num_threads, matchers, errors) > 0)
+  {
+    for (int i = 0; i < num_patterns; i++)
+      if (matchers[i] == NULL)
+        fprintf(stderr, "cannot compile '%s': %s\n", patterns[i], errors[i]);
+    exit(EXIT_FAILURE);
+  }
+  free(errors);
+  return matchers;
+}
+
+// Number of lines of [begin, end) that 'matcher' matches, checking that
+// jgrep_match agrees with jgrep_exec on each of them
+static long count_hits(const struct jgrep_matcher *matcher, const char *begin, const char *end,
+    const char *pattern)
+{
+  enum { MAX_HITS = 16 };
+  const char *hits[MAX_HITS];
+  long total = 0;
+  const char *line = begin;
+  while (begin < end)
+  {
+    const char *next;
+    long num_hits = jgrep_exec(matcher, begin, end, hits, MAX_HITS, &next);
+    for (long h = 0; h < num_hits; h++)
+    {
+      for (; line < hits[h]; line = strchr(line, '\n') + 1)
+        if (jgrep_match(matcher, line, strchr(line, '\n')))
+        {
+          fprintf(stderr, "'%s': jgrep_match matches a line jgrep_exec skips\n", pattern);
+          exit(EXIT_FAILURE);
+        }
+      if (!jgrep_match(matcher, line, strchr(line, '\n')))
+      {
+        fprintf(stderr, "'%s': jgrep_match rejects a line jgrep_exec finds\n", pattern);
+        exit(EXIT_FAILURE);
+      }
+      line = strchr(line, '\n') + 1;
+    }
+    total += num_hits;
+    begin = next;
+  }
+  return total;
+}
+
+int main(int argc, char *argv[])
+{
+  int num_patterns = argc > 1 ? atoi(argv[1]) : 64;
+  int num_threads = argc > 2 ? atoi(argv[2]) : 4;
+  if (num_patterns <= 0 || num_threads <= 0)
+  {
+    fprintf(stderr, "usage: %s [num_patterns [num_threads]]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  enum { PATTERN_SIZE = 32, TEXT_SIZE = 64 * 1024 };
+  char (*buffers)[PATTERN_SIZE] = calloc(num_patterns, PATTERN_SIZE);
+  const char **patterns = calloc(num_patterns, sizeof(*patterns));
+  char *text = malloc(TEXT_SIZE);
+  if (buffers == NULL || patterns == NULL || text == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < num_patterns; i++)
+  {
+    make_pattern(buffers[i], PATTERN_SIZE, i);
+    patterns[i] = buffers[i];
+  }
+  size_t length = make_text(text, TEXT_SIZE);
+
+  struct jgrep_matcher **expected = compile_all(patterns, num_patterns, JGREP_INTERPRET,
+      num_threads);
+  static const int flags[] = { 0, JGREP_OWN_CONTEXT, JGREP_IGNORE_CASE };
+  for (int f = 0; f < 3; f++)
+  {
+    struct jgrep_matcher **matchers = compile_all(patterns, num_patterns, flags[f],
+        num_threads);
+    struct jgrep_matcher **folded = NULL;
+    if (flags[f] & JGREP_IGNORE_CASE)
+      folded = compile_all(patterns, num_patterns, JGREP_INTERPRET | JGREP_IGNORE_CASE,
+          num_threads);
+    for (int i = 0; i < num_patterns; i++)
+    {
+      long want = count_hits((folded ? folded : expected)[i], text, text + length, patterns[i]);
+      long got = count_hits(matchers[i], text, text + length, patterns[i]);
+      if (got != want)
+      {
+        fprintf(stderr, "'%s' with flags %d: %ld lines, the interpreter %ld\n",
+            patterns[i], flags[f], got, want);
+        exit(EXIT_FAILURE);
+      }
+      jgrep_free(matchers[i]);
+      if (folded != NULL)
+        jgrep_free(folded[i]);
+    }
+    free(matchers);
+    free(folded);
+  }
+
+  for (int i = 0; i < num_patterns; i++)
+    jgrep_free(expected[i]);
+  free(expected);
+  free(text);
+  free(patterns);
+  free(buffers);
+  printf("ok\n");
+  return 0;
+}
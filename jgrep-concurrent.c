@@ -5,394 +5,169 @@
 
 #include <pthread.h>
 #include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <libgccjit.h>
 
+#include "jgrep-cache.h"
+#include "jgrep-codegen.h"
+#include "jgrep-costs.h"
+#include "jgrep-input.h"
+#include "jgrep-interp.h"
+#include "jgrep-options.h"
+#include "jgrep-scan.h"
+#include "jgrep-stats.h"
+#include "jgrep-walk.h"
+
 #if EXTRAE_SUPPORT
 #include "extrae_user_events.h"
 #endif
 
-static int matchstar(int c, const char *regexp, const char *text);
+static const char* regexp;
+static const struct re_list *patterns;
+static int regexp_flags;
+static enum codegen_mode codegen_mode;
+static struct jit_cache cache;
 
-/* matchhere: search for regexp at beginning of text */
-static int matchhere(const char *regexp, const char *text)
+/* interpret: runs the interpreter with the signature of the JIT'd match */
+static int interpret(const char *text, const char *end)
 {
-    if (regexp[0] == '\0')
-        return 1;
-    if (regexp[1] == '*')
-        return matchstar(regexp[0], regexp+2, text);
-    if (regexp[0] == '$' && regexp[1] == '\0')
-        return *text == '\0';
-    if (*text!='\0' && (regexp[0]=='.' || regexp[0]==*text))
-        return matchhere(regexp+1, text+1);
-    return 0;
+    return interp_match(patterns, text, end);
 }
 
-/* matchstar: search for c*regexp at beginning of text */
-static int matchstar(int c, const char *regexp, const char *text)
+/* Lines start on the interpreter. The JIT thread first builds a quick O0
+ * matcher and then the optimized one, with the profile of -O and --march (O2
+ * by default), and each is swapped in as soon as it is ready, so that inputs
+ * that end before the optimized compile finishes still get JIT'd code for
+ * most of their lines. */
+enum
 {
-    do {    /* a * matches zero or more instances */
-        if (matchhere(regexp, text))
-            return 1;
-    } while (*text != '\0' && (*text++ == c || c == '.'));
-    return 0;
-
-}
+    TIER_INTERPRETER,
+    TIER_O0,
+    TIER_OPTIMIZED,
+    NUM_TIERS,
+};
 
-/* match: search for regexp anywhere in text */
-static int match(const char *regexp, const char *text)
+struct tier
 {
-    if (regexp[0] == '^')
-        return matchhere(regexp+1, text);
-    do {    /* must look even if string is empty */
-        if (matchhere(regexp, text))
-            return 1;
-    } while (*text++ != '\0');
-    return 0;
-}
+    const char *name;
+    struct codegen_profile profile;
+    struct matcher matcher;
+    atomic_long ready_us; /* Microseconds since the start, -1 until ready */
+    /* Time taken to load the matcher from the cache or to compile it, -1 if
+     * not done. Meaningful once ready_us is set. */
+    double load_ns;
+    double compile_ns;
+};
 
-static const char* new_block_name(void)
-{
-  static int n = 0;
-  enum { SIZE = 16 };
-  static char c[SIZE];
+static struct tier tiers[NUM_TIERS] = {
+    [TIER_INTERPRETER] = { "interpreter", { -1, NULL }, { interpret, NULL }, 0, -1, -1 },
+    [TIER_O0] = { "O0", { 0, NULL }, { NULL, NULL }, -1, -1, -1 },
+    /* Named and set from the options */
+    [TIER_OPTIMIZED] = { NULL, CODEGEN_PROFILE_DEFAULT, { NULL, NULL }, -1, -1, -1 },
+};
 
-  snprintf(c, SIZE, "block-%02d", n);
-  c[SIZE-1] = '\0';
+static struct tier *_Atomic current_tier = &tiers[TIER_INTERPRETER];
 
-  n++;
+static struct timespec start_time;
 
-  return c;
+static long elapsed_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start_time.tv_sec) * 1000000L
+        + (now.tv_nsec - start_time.tv_nsec) / 1000;
 }
 
-static const char* new_function_name(void)
+static double now_ns(void)
 {
-  static int n = 0;
-  enum { SIZE = 16 };
-  static char c[SIZE];
-
-  snprintf(c, SIZE, "matchhere_%d", n);
-  c[SIZE-1] = '\0';
-
-  n++;
-
-  return c;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
 }
 
-static const char* new_local_name(void)
+/* Lines served by each tier, and the bytes scan_tiers went through with it
+ * and the time that took. Every scanning thread counts in its own
+ * counters, so counting does not make the threads share a cache line. The
+ * counters outlive their threads, so they are added up at the end. */
+struct tier_lines
 {
-  static int n = 0;
-  enum { SIZE = 16 };
-  static char c[SIZE];
-
-  snprintf(c, SIZE, "tmp_%d", n);
-  c[SIZE-1] = '\0';
+    long lines[NUM_TIERS];
+    long long scan_bytes[NUM_TIERS];
+    double scan_ns[NUM_TIERS];
+    struct tier_lines *next;
+};
 
-  n++;
+static _Thread_local struct tier_lines *thread_tier_lines;
+/* The JIT'd scan skips lines, so they are counted only if reported */
+static int count_all_tier_lines;
+static struct tier_lines *all_tier_lines;
+static pthread_mutex_t all_tier_lines_lock = PTHREAD_MUTEX_INITIALIZER;
 
-  return c;
+static struct tier_lines *get_thread_tier_lines(void)
+{
+    if (thread_tier_lines == NULL)
+    {
+        thread_tier_lines = calloc(1, sizeof(*thread_tier_lines));
+        if (thread_tier_lines == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_lock(&all_tier_lines_lock);
+        thread_tier_lines->next = all_tier_lines;
+        all_tier_lines = thread_tier_lines;
+        pthread_mutex_unlock(&all_tier_lines_lock);
+    }
+    return thread_tier_lines;
 }
 
-static void generate_return_zero(gcc_jit_context* ctx, gcc_jit_function *fun, gcc_jit_block** return_zero)
+static void count_tier_lines(long lines[NUM_TIERS])
 {
-  if (*return_zero == NULL)
-  {
-    gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
-    *return_zero = gcc_jit_function_new_block(fun, new_block_name());
-    gcc_jit_block_end_with_return(
-        *return_zero, /* loc */ NULL,
-        gcc_jit_context_zero(ctx, int_type));
-  }
+    for (int i = 0; i < NUM_TIERS; i++)
+        lines[i] = 0;
+    pthread_mutex_lock(&all_tier_lines_lock);
+    for (struct tier_lines *t = all_tier_lines; t != NULL; t = t->next)
+        for (int i = 0; i < NUM_TIERS; i++)
+            lines[i] += t->lines[i];
+    pthread_mutex_unlock(&all_tier_lines_lock);
 }
 
-static gcc_jit_function *generate_code_matchhere(gcc_jit_context *ctx, const char* regexp, const char* function_name)
+static void count_tier_scans(long long bytes[NUM_TIERS], double ns[NUM_TIERS])
 {
-  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
-  gcc_jit_type *char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CHAR);
-  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
-
-  gcc_jit_param *param_text = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "text");
-  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(param_text);
-
-  // matchhere
-  gcc_jit_param* params[] = { param_text };
-  gcc_jit_function *matchhere = gcc_jit_context_new_function(ctx, /* loc */ NULL,
-      GCC_JIT_FUNCTION_INTERNAL, int_type, function_name,
-      1, params, /* is_variadic */ 0);
-  gcc_jit_block* current_block = gcc_jit_function_new_block(matchhere, new_block_name());
-
-  gcc_jit_rvalue* text_plus_one = 
-    gcc_jit_context_new_cast(
-        ctx, /* loc */ NULL,
-        gcc_jit_lvalue_get_address(
-          gcc_jit_context_new_array_access(
-            ctx, /* loc */ NULL,
-            rval_text,
-            gcc_jit_context_one(ctx, int_type)),
-          /* loc */ NULL),
-        const_char_ptr_type);
-
-  gcc_jit_block* return_zero = NULL;
-
-  gcc_jit_block* return_one = gcc_jit_function_new_block(matchhere, new_block_name());
-  gcc_jit_block_end_with_return(
-      return_one, /* loc */ NULL,
-      gcc_jit_context_one(ctx, int_type));
-
-  // Now go creating
-  for (;;)
-  {
-    if (regexp[0] == '\0')
-    {
-      gcc_jit_block_end_with_jump(
-          current_block, /* loc */ NULL,
-          return_one);
-      break; // We are done
-    }
-    else if (regexp[1] == '*')
-    {
-      // Generate code for the remaining regular expression
-      gcc_jit_function *remaining_regexp_match = generate_code_matchhere(ctx, regexp + 2, new_function_name());
-
-      gcc_jit_block* loop_body = gcc_jit_function_new_block(matchhere, new_block_name());
-      gcc_jit_block* loop_check = gcc_jit_function_new_block(matchhere, new_block_name());
-
-      gcc_jit_block_end_with_jump(current_block, /* loc */ NULL, loop_body);
-
-      gcc_jit_rvalue* args[] = { rval_text };
-      gcc_jit_rvalue* match_remainder = 
-        gcc_jit_context_new_comparison(
-            ctx, /* loc */ NULL,
-            GCC_JIT_COMPARISON_NE,
-            gcc_jit_context_new_call(ctx, /* loc */ NULL,
-              remaining_regexp_match, 1, args),
-            gcc_jit_context_zero(ctx, int_type));
-
-      gcc_jit_block_end_with_conditional(loop_body, /* loc */ NULL,
-          match_remainder,
-          return_one,
-          loop_check);
-
-      gcc_jit_lvalue* tmp = gcc_jit_function_new_local(matchhere, /* loc */ NULL, char_type, new_local_name());
-      gcc_jit_block_add_assignment(
-          loop_check, /* loc */ NULL,
-          tmp,
-          gcc_jit_lvalue_as_rvalue(
-            gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)));
-
-      gcc_jit_rvalue* check_expr;
-      if (regexp[0] == '.')
-      {
-        check_expr =
-          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-              GCC_JIT_COMPARISON_NE,
-              gcc_jit_lvalue_as_rvalue(tmp),
-              gcc_jit_context_zero(ctx, char_type));
-      }
-      else
-      {
-        check_expr =
-          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-              GCC_JIT_COMPARISON_EQ,
-              gcc_jit_lvalue_as_rvalue(tmp),
-              gcc_jit_context_new_rvalue_from_int(ctx, char_type, regexp[0]));
-      }
-
-      generate_return_zero(ctx, matchhere, &return_zero);
-
-      gcc_jit_block_add_assignment(loop_check, /* loc */ NULL,
-          gcc_jit_param_as_lvalue(param_text),
-          text_plus_one);
-      gcc_jit_block_end_with_conditional(loop_check, /* loc */ NULL,
-          check_expr,
-          loop_body,
-          return_zero);
-
-      break; // We are done
-    }
-    else if (regexp[0] == '$' && regexp[1] == '\0')
-    {
-      gcc_jit_block_end_with_return(
-          current_block, /* loc */ NULL,
-          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-            GCC_JIT_COMPARISON_EQ, 
-            gcc_jit_lvalue_as_rvalue(
-              gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)
-              ),
-            gcc_jit_context_zero(ctx, char_type)));
-
-      regexp++;
-    }
-    else if (regexp[0] == '.')
-    {
-      generate_return_zero(ctx, matchhere, &return_zero);
-
-      gcc_jit_block* next_block = gcc_jit_function_new_block(matchhere, new_block_name());
-
-      // if (*text == '\0')
-      //    return 0;
-      gcc_jit_block_end_with_conditional(
-          current_block, /* loc */ NULL,
-          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-            GCC_JIT_COMPARISON_EQ, 
-            gcc_jit_lvalue_as_rvalue(
-              gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)
-              ),
-            gcc_jit_context_zero(ctx, char_type)),
-          return_zero,
-          next_block);
-
-      // text = &text[1]; // pointer arithmetic
-      gcc_jit_block_add_assignment(next_block, /* loc */ NULL,
-          gcc_jit_param_as_lvalue(param_text),
-          text_plus_one);
-
-      // Chain the code
-      current_block = next_block;
-
-      // Done with the current letter
-      regexp++;
-    }
-    else
+    for (int i = 0; i < NUM_TIERS; i++)
     {
-      generate_return_zero(ctx, matchhere, &return_zero);
-
-      gcc_jit_block* next_block = gcc_jit_function_new_block(matchhere, new_block_name());
-
-      // if (*text != regexp[0])
-      //    return 0;
-      gcc_jit_block_end_with_conditional(
-          current_block, /* loc */ NULL,
-          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-            GCC_JIT_COMPARISON_NE, 
-            gcc_jit_lvalue_as_rvalue(
-              gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)
-              ),
-            gcc_jit_context_new_rvalue_from_int(ctx, char_type, regexp[0])),
-          return_zero,
-          next_block);
-
-      // text = &text[1]; // pointer arithmetic
-      gcc_jit_block_add_assignment(next_block, /* loc */ NULL,
-          gcc_jit_param_as_lvalue(param_text),
-          text_plus_one);
-
-      // Chain the code
-      current_block = next_block;
-
-      // Done with the current letter
-      regexp++;
+        bytes[i] = 0;
+        ns[i] = 0;
     }
-  }
-
-  // char c[64];
-  // snprintf(c, 63, "%s.dot", function_name);
-  // c[63] = '\0';
-
-  // gcc_jit_function_dump_to_dot(matchhere, c);
-
-  return matchhere;
+    pthread_mutex_lock(&all_tier_lines_lock);
+    for (struct tier_lines *t = all_tier_lines; t != NULL; t = t->next)
+        for (int i = 0; i < NUM_TIERS; i++)
+        {
+            bytes[i] += t->scan_bytes[i];
+            ns[i] += t->scan_ns[i];
+        }
+    pthread_mutex_unlock(&all_tier_lines_lock);
 }
 
-void generate_code_regexp(gcc_jit_context *ctx, const char* regexp)
+static void print_tier_report(void)
 {
-  const char* matchhere_regexp = regexp;
-  if (regexp[0] == '^')
-  {
-    matchhere_regexp++;
-  }
-  gcc_jit_function* matchhere = generate_code_matchhere(ctx, matchhere_regexp, "matchhere");
-
-  // match function
-  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
-  gcc_jit_type *char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CHAR);
-  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
-
-  gcc_jit_param *param_text = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "text");
-  gcc_jit_param *param_regex = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "_regex");
-  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(param_text);
-
-  gcc_jit_param* params[] = { param_regex, param_text };
-  gcc_jit_function *match = gcc_jit_context_new_function(ctx, /* loc */ NULL,
-      GCC_JIT_FUNCTION_EXPORTED, int_type, "match",
-      2, params, /* is_variadic */ 0);
-
-  gcc_jit_rvalue* args[] = { rval_text };
-  gcc_jit_rvalue* call_to_matchhere = gcc_jit_context_new_call(ctx, /* loc */ NULL,
-      matchhere,
-      1, args);
-  if (regexp[0] == '^')
-  {
-    gcc_jit_block* block = gcc_jit_function_new_block(match, new_block_name());
-
-    gcc_jit_block_end_with_return(
-        block, /* loc */ NULL,
-        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-          GCC_JIT_COMPARISON_NE, 
-          call_to_matchhere,
-          gcc_jit_context_zero(ctx, int_type)));
-  }
-  else
-  {
-    gcc_jit_block* loop_body = gcc_jit_function_new_block(match, new_block_name());
-    gcc_jit_block* return_one = gcc_jit_function_new_block(match, new_block_name());
-    gcc_jit_block* condition_check = gcc_jit_function_new_block(match, new_block_name());
-    gcc_jit_block* return_zero = gcc_jit_function_new_block(match, new_block_name());
-
-    gcc_jit_block_end_with_conditional(
-        loop_body, /* loc */ NULL,
-        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-          GCC_JIT_COMPARISON_NE, 
-          call_to_matchhere,
-          gcc_jit_context_zero(ctx, int_type)),
-        return_one,
-        condition_check);
-
-    gcc_jit_block_end_with_return(
-        return_one, /* loc */ NULL,
-        gcc_jit_context_one(ctx, int_type));
-
-    gcc_jit_lvalue* tmp = gcc_jit_function_new_local(match, /* loc */ NULL, char_type, new_local_name());
-    gcc_jit_block_add_assignment(
-        condition_check, /* loc */ NULL,
-        tmp,
-        gcc_jit_lvalue_as_rvalue(
-          gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)));
-    gcc_jit_block_add_assignment(
-        condition_check, /* loc */ NULL,
-        gcc_jit_param_as_lvalue(param_text),
-        gcc_jit_context_new_cast(
-          ctx, /* loc */ NULL,
-          gcc_jit_lvalue_get_address(
-            gcc_jit_context_new_array_access(
-              ctx, /* loc */ NULL,
-              rval_text,
-              gcc_jit_context_one(ctx, int_type)),
-            /* loc */ NULL),
-          const_char_ptr_type));
-    gcc_jit_block_end_with_conditional(
-        condition_check, /* loc */ NULL,
-        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-          GCC_JIT_COMPARISON_NE, 
-          gcc_jit_lvalue_as_rvalue(tmp),
-          gcc_jit_context_zero(ctx, char_type)),
-        loop_body,
-        return_zero);
-
-    gcc_jit_block_end_with_return(
-        return_zero, /* loc */ NULL,
-        gcc_jit_context_zero(ctx, int_type));
-  }
-  // gcc_jit_function_dump_to_dot(match, "match.dot");
+    long lines[NUM_TIERS];
+    count_tier_lines(lines);
 
-  // gcc_jit_context_dump_to_file(ctx, "generated-regex.dump", /* update-locations */ 1);
-  // gcc_jit_context_set_bool_option(ctx, GCC_JIT_BOOL_OPTION_DEBUGINFO, 1);
+    for (int i = 0; i < NUM_TIERS; i++)
+    {
+        long ready_us = atomic_load(&tiers[i].ready_us);
+        if (ready_us < 0)
+            fprintf(stderr, "tier %-11s %12ld lines, not ready\n", tiers[i].name, lines[i]);
+        else
+            fprintf(stderr, "tier %-11s %12ld lines, ready at %.3f ms\n",
+                    tiers[i].name, lines[i], ready_us / 1000.0);
+    }
 }
 
-typedef int (*match_fun_t)(const char* regex, const char* text);
-static match_fun_t match_fun;
-static const char* regexp;
-
 #if EXTRAE_SUPPORT
 enum { 
     JIT_EVENT_TYPE = 1000,
@@ -405,72 +180,205 @@ enum {
 };
 #endif
 
-static void* concurrent_jit_run(void *info)
+/* load_tier: loads into 'matcher' the cached matcher compiled with the
+ * profile of 'tier'. Returns 0 on success. */
+static int load_tier(struct tier *tier, struct matcher *matcher)
+{
+    double start = now_ns();
+    double stats_start = stats_now_ns();
+    int res = jit_cache_load(&cache, regexp, regexp_flags, &tier->profile, codegen_mode, matcher);
+    stats_add_phase(STATS_CACHE_LOAD, stats_start);
+    if (res == 0)
+        tier->load_ns = now_ns() - start;
+    return res;
+}
+
+/* compile_tier: compiles into 'matcher' the matcher with the profile of
+ * 'tier' and stores it in the cache. Returns 0 on success. */
+static int compile_tier(struct tier *tier, struct matcher *matcher)
 {
+    double start = now_ns();
+
     gcc_jit_context *ctx;
     ctx = gcc_jit_context_acquire ();
     if (ctx == NULL)
     {
         fprintf(stderr, "acquired JIT context is NULL");
-        return NULL;
+        return -1;
     }
 
-    gcc_jit_context_set_int_option(ctx, GCC_JIT_INT_OPTION_OPTIMIZATION_LEVEL, 2);
+    codegen_set_profile(ctx, &tier->profile);
 
 #if EXTRAE_SUPPORT
     Extrae_event(JIT_EVENT_TYPE, JIT_CODE_GENERATION);
 #endif
+    double stats_start = stats_now_ns();
 
-    generate_code_regexp(ctx, regexp);
+    generate_code_regexp(ctx, regexp, regexp_flags, codegen_mode);
 
+    stats_add_phase(STATS_CODE_GENERATION, stats_start);
 #if EXTRAE_SUPPORT
     Extrae_event(JIT_EVENT_TYPE, 0);
 
     Extrae_event(JIT_EVENT_TYPE, JIT_COMPILATION);
 #endif
-    gcc_jit_result *result = gcc_jit_context_compile(ctx);
+    stats_start = stats_now_ns();
+    // Compiled to a shared object in the cache when possible, in memory
+    // otherwise
+    int stored = jit_cache_store(&cache, ctx, regexp, regexp_flags, &tier->profile, codegen_mode, matcher) == 0;
+    gcc_jit_result *result = NULL;
+    if (!stored)
+        result = gcc_jit_context_compile(ctx);
+    stats_add_phase(STATS_COMPILATION, stats_start);
 #if EXTRAE_SUPPORT
     Extrae_event(JIT_EVENT_TYPE, 0);
 #endif
-    if (result == NULL)
+    if (!stored && result == NULL)
     {
         fprintf(stderr, "compilation failed");
-        return NULL;
+        return -1;
     }
 
+    if (!stored)
+    {
 #if EXTRAE_SUPPORT
-    Extrae_event(JIT_EVENT_TYPE, JIT_GET_CODE);
+        Extrae_event(JIT_EVENT_TYPE, JIT_GET_CODE);
 #endif
+        stats_start = stats_now_ns();
 
-    match_fun_t function_addr = (match_fun_t)gcc_jit_result_get_code(result, "match");
+        matcher->match = (match_fun_t)gcc_jit_result_get_code(result, "match");
+        matcher->scan = (scan_fun_t)gcc_jit_result_get_code(result, "scan");
 
+        stats_add_phase(STATS_GET_CODE, stats_start);
 #if EXTRAE_SUPPORT
-    Extrae_event(JIT_EVENT_TYPE, 0);
+        Extrae_event(JIT_EVENT_TYPE, 0);
 #endif
+    }
 
-#if EXTRAE_SUPPORT
-    if (function_addr == NULL)
+    if (matcher->match == NULL || matcher->scan == NULL)
     {
         fprintf(stderr, "error getting 'match'");
-        return NULL;
+        return -1;
     }
-#endif
 
-    atomic_store(&match_fun, function_addr);
+    tier->compile_ns = now_ns() - start;
+    return 0;
+}
+
+static void promote(struct tier *tier, const struct matcher *matcher)
+{
+    tier->matcher = *matcher;
+    atomic_store(&tier->ready_us, elapsed_us());
+    atomic_store(&current_tier, tier);
+}
+
+/* Lines are interpreted while the JIT tiers are built */
+static void* concurrent_jit_run(void *info)
+{
+    struct tier *o0 = &tiers[TIER_O0];
+    struct tier *optimized = &tiers[TIER_OPTIMIZED];
+
+    // A cached optimized matcher is ready right away, so O0 would not be
+    // used. Nor would it with -O0, which compiles about as fast.
+    struct matcher matcher;
+    int res = load_tier(optimized, &matcher);
+    if (res != 0)
+    {
+        struct matcher quick;
+        if (optimized->profile.opt_level > 0
+                && (load_tier(o0, &quick) == 0 || compile_tier(o0, &quick) == 0))
+            promote(o0, &quick);
+
+        res = compile_tier(optimized, &matcher);
+    }
+    if (res == 0)
+        promote(optimized, &matcher);
+
+    if (cache.report)
+        jit_cache_print_report(&cache);
 
     return NULL;
 }
 
+/* blocking_jit: builds the optimized tier before any line is scanned */
+static void blocking_jit(void)
+{
+    struct tier *optimized = &tiers[TIER_OPTIMIZED];
+
+    struct matcher matcher;
+    if (load_tier(optimized, &matcher) == 0 || compile_tier(optimized, &matcher) == 0)
+        promote(optimized, &matcher);
+
+    if (cache.report)
+        jit_cache_print_report(&cache);
+}
+
+static int match_line(const char *line, const char *end)
+{
+    struct tier *tier = atomic_load(&current_tier);
+#if EXTRAE_SUPPORT
+    Extrae_event(MATCH_EVENT_TYPE, MATCH_RUN);
+#endif
+    int m = tier->matcher.match(line, end);
+#if EXTRAE_SUPPORT
+    Extrae_event(MATCH_EVENT_TYPE, 0);
+#endif
+    get_thread_tier_lines()->lines[tier - tiers]++;
+    return m;
+}
+
+/* scan_tiers: the scan_fun_t of the current tier. The tier is loaded once per
+ * call, which matcher_scan keeps to a slice of lines, so that a swap still
+ * takes effect soon after it happens. */
+static long scan_tiers(const char *begin, const char *end,
+        const char **hits, long max_hits, const char **next)
+{
+    struct tier *tier = atomic_load(&current_tier);
+    long num_hits = 0;
+    long long num_lines = 0;
+    double start = now_ns();
+#if EXTRAE_SUPPORT
+    Extrae_event(MATCH_EVENT_TYPE, MATCH_RUN);
+#endif
+    if (tier->matcher.scan != NULL)
+    {
+        num_hits = tier->matcher.scan(begin, end, hits, max_hits, next);
+        if (count_all_tier_lines)
+            num_lines = count_lines(begin, *next);
+    }
+    else
+    {
+        const char *line = begin;
+        while (line < end && num_hits < max_hits)
+        {
+            const char *eol = memchr(line, '\n', end - line);
+            num_lines++;
+            if (tier->matcher.match(line, eol != NULL ? eol : end))
+                hits[num_hits++] = line;
+            line = eol != NULL ? eol + 1 : end;
+        }
+        *next = line;
+    }
+#if EXTRAE_SUPPORT
+    Extrae_event(MATCH_EVENT_TYPE, 0);
+#endif
+    struct tier_lines *counts = get_thread_tier_lines();
+    counts->lines[tier - tiers] += num_lines;
+    counts->scan_bytes[tier - tiers] += *next - begin;
+    counts->scan_ns[tier - tiers] += now_ns() - start;
+    return num_hits;
+}
+
 int main(int argc, char *argv[])
 {
 #ifdef EXTRAE_SUPPORT
   unsetenv("LD_PRELOAD");
 #endif
-  if (argc != 3)
-  {
-    fprintf(stderr, "usage: %s regex filename\n", argv[0]);
-    exit(EXIT_FAILURE);
-  }
+  struct options options;
+  parse_options(argc, argv, &options);
+  // As in grep, empty -f files give no pattern, which matches no line
+  if (options.no_patterns)
+    return EXIT_FAILURE;
 
 #ifdef EXTRAE_SUPPORT
   {
@@ -489,45 +397,177 @@ int main(int argc, char *argv[])
   }
 #endif
 
-  regexp = strdup(argv[1]);
-  match_fun = match;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  stats_init(options.stats);
+  stats_set_io(input_backend_name(options.io_backend));
+  regexp = strdup(options.regexp);
+  patterns = &options.patterns;
+  regexp_flags = options.regexp_flags;
+  codegen_mode = options.codegen_mode;
+  char profile_name[128];
+  tiers[TIER_OPTIMIZED].profile = options.profile;
+  tiers[TIER_OPTIMIZED].name = codegen_profile_name(&options.profile, profile_name, sizeof(profile_name));
+  stats_set_profile(tiers[TIER_OPTIMIZED].name);
+  atomic_store(&tiers[TIER_INTERPRETER].ready_us, 0);
+  jit_cache_init(&cache, options.use_cache, options.cache_report);
+
+  // Regular files are scanned in place; anything that cannot be mapped
+  // (pipes, character devices, ...) is read through a ring of buffers. The
+  // size of a tree is not known before walking it.
+  int tree = options.recursive || options.num_filenames > 1;
+  const char *filename = options.filenames[0];
+  const char *name = input_display_name(filename);
+  struct input_map map;
+  struct input_reader reader;
+  int mapped = 0;
+  long long size = -1;
+  if (!tree && input_uses_mmap(options.io_backend) && input_map_open(&map, filename) == 0)
+  {
+    mapped = 1;
+    size = map.size;
+  }
+  else if (!tree)
+  {
+    if (input_reader_open(&reader, filename, options.io_backend) != 0)
+    {
+      fprintf(stderr, "error opening file '%s': %s\n",
+          filename,
+          strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    struct stat st;
+    if (fstat(reader.fd, &st) == 0 && S_ISREG(st.st_mode))
+      size = st.st_size;
+  }
+
+  struct cost_model model;
+  cost_model_load(&model, cache.dir);
 
-  pthread_t concurrent_jit;
-  int res = pthread_create(&concurrent_jit, NULL, concurrent_jit_run, NULL);
-  if (res != 0)
+  struct cost_estimate estimate;
+  cost_model_decide(&model, regexp, size, options.num_threads,
+          jit_cache_contains(&cache, regexp, regexp_flags, &tiers[TIER_OPTIMIZED].profile, codegen_mode),
+          &estimate);
+
+  enum jit_strategy strategy = options.jit_strategy;
+  if (strategy == JIT_AUTO)
+    strategy = estimate.strategy;
+
+  if (options.verbose)
   {
-      fprintf(stderr, "cannot create pthread: %s\n", strerror(errno));
+    cost_model_print(&model, &estimate);
+    if (strategy != estimate.strategy)
+      fprintf(stderr, "  overridden: %s\n", jit_strategy_name(strategy));
   }
-  pthread_detach(concurrent_jit);
 
-  FILE *f = fopen(argv[2], "r");
-  if (f == NULL)
+  // Mapped files and the buffers of streams are scanned a slice at a time by
+  // the current tier
+  struct matcher matcher = { match_line, scan_tiers };
+  count_all_tier_lines = options.verbose || options.stats;
+
+  if (strategy == JIT_BLOCKING)
+  {
+    blocking_jit();
+  }
+  else if (strategy == JIT_BACKGROUND)
   {
-    fprintf(stderr, "error opening file '%s': %s\n",
-        argv[2],
-        strerror(errno));
-    exit(EXIT_FAILURE);
+    pthread_t concurrent_jit;
+    int res = pthread_create(&concurrent_jit, NULL, concurrent_jit_run, NULL);
+    if (res != 0)
+      fprintf(stderr, "cannot create pthread: %s\n", strerror(res));
+    else
+      pthread_detach(concurrent_jit);
   }
 
-  char* line = NULL;
-  size_t length = 0;
-  
-  while (getline(&line, &length, f) != -1)
+  double scan_start = now_ns();
+  double stats_start = stats_now_ns();
+  int errors = 0;
+  long long matched;
+  if (tree)
   {
-      match_fun_t pmatch_fun = atomic_load(&match_fun);
-#if EXTRAE_SUPPORT
-      Extrae_event(MATCH_EVENT_TYPE, MATCH_RUN);
-#endif
-      int m = pmatch_fun(regexp, line);
-#if EXTRAE_SUPPORT
-      Extrae_event(MATCH_EVENT_TYPE, 0);
-#endif
-      if (m)
-          fprintf(stdout, "%s", line);
+    matched = grep_tree(options.filenames, options.num_filenames, options.recursive,
+        &matcher, options.num_threads, &options.mode, options.io_backend, &errors);
+  }
+  else if (mapped)
+  {
+    matched = grep_mapped(&map, name, &matcher, options.num_threads, &options.mode);
+    input_map_close(&map);
+  }
+  else
+  {
+    matched = grep_stream(&reader, name, &matcher, options.num_threads, &options.mode);
+  }
+  double scan_ns = now_ns() - scan_start;
+  stats_add_phase(STATS_SCAN, stats_start);
+
+  if (options.verbose)
+  {
+    fflush(stdout);
+    print_tier_report();
   }
 
-  free(line);
-  fclose(f);
+  // What was measured becomes the cost of the next runs. Tiers still being
+  // built when the scan ends tell nothing. -q, -l and -m may stop the scan
+  // long before the end of the input, so the costs are of the bytes the tiers
+  // went through.
+  long long scan_bytes[NUM_TIERS];
+  double tier_scan_ns[NUM_TIERS];
+  count_tier_scans(scan_bytes, tier_scan_ns);
+  long long scanned = 0;
+  for (int i = 0; i < NUM_TIERS; i++)
+    scanned += scan_bytes[i];
+  struct cost_sample sample = {
+    .strategy = strategy,
+    .num_threads = options.num_threads,
+    .size = size < 0 ? size : scanned,
+    .complexity = estimate.complexity,
+    .scan_ns = scan_ns,
+    .compile_o0_ns = -1,
+    .compile_o2_ns = -1,
+    .load_ns = -1,
+  };
+  for (int i = TIER_O0; i < NUM_TIERS; i++)
+  {
+    if (atomic_load(&tiers[i].ready_us) < 0)
+      continue;
+    if (tiers[i].load_ns >= 0)
+      sample.load_ns = tiers[i].load_ns;
+    if (tiers[i].compile_ns >= 0 && i == TIER_O0)
+      sample.compile_o0_ns = tiers[i].compile_ns;
+    if (tiers[i].compile_ns >= 0 && i == TIER_OPTIMIZED)
+      sample.compile_o2_ns = tiers[i].compile_ns;
+  }
+  // The optimized tier gets the share of the scan time that the scanning
+  // threads spent in it, which keeps its cost per byte one of elapsed time
+  // as that of blocking runs
+  double all_tiers_ns = 0;
+  for (int i = 0; i < NUM_TIERS; i++)
+    all_tiers_ns += tier_scan_ns[i];
+  if (strategy != JIT_BLOCKING && all_tiers_ns > 0)
+  {
+    sample.jit_bytes = scan_bytes[TIER_OPTIMIZED];
+    sample.jit_ns = scan_ns * tier_scan_ns[TIER_OPTIMIZED] / all_tiers_ns;
+  }
+  // The model is of the default profile, which the times of others would skew
+  const struct codegen_profile default_profile = CODEGEN_PROFILE_DEFAULT;
+  if (options.profile.opt_level == default_profile.opt_level && options.profile.march == NULL)
+    cost_model_update(&model, &sample);
+
+  // Tiers become ready in their order, so the list is in the order of the
+  // swaps
+  long lines[NUM_TIERS];
+  count_tier_lines(lines);
+  for (int i = 0; i < NUM_TIERS; i++)
+  {
+    long ready_us = atomic_load(&tiers[i].ready_us);
+    if (ready_us >= 0)
+      stats_add_tier(tiers[i].name, ready_us * 1e3, lines[i]);
+  }
+  stats_set_strategy(jit_strategy_name(strategy));
+  stats_print("jgrep-concurrent", regexp);
 
-  return 0;
+  // -q tells whether anything matched, even if some files could not be read
+  if (options.mode.output == SCAN_QUIET)
+    return matched > 0 ? 0 : EXIT_FAILURE;
+  return errors == 0 ? 0 : EXIT_FAILURE;
 }
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "jgrep-costs.h"
+#include "jgrep-regexp.h"
+
+#define COSTS_FILE_NAME "costs"
+
+// Inputs smaller than this are dominated by startup and give noisy per-byte
+// costs, so they are not folded into the averages
+enum { MIN_SAMPLE_BYTES = 256 * 1024 };
+
+// Averages weigh each new sample at least this much, so that they follow
+// changes of the machine (frequency scaling, a new libgccjit, ...)
+#define MIN_SAMPLE_WEIGHT 0.2
+
+// Overhead of starting the compile thread and switching tiers
+#define BACKGROUND_OVERHEAD_NS 100e3
+
+// Until measured, costs of a machine of around 2020. The JIT'd matcher scans
+// about twice as fast as the interpreter runs the simplest pattern.
+static const struct costs default_costs = {
+  .interp_ns_per_byte = 1.0,
+  .jit_ns_per_byte = 0.5,
+  .compile_o0_ns = 50e6,
+  .compile_o2_ns = 100e6,
+  .load_ns = 1e6,
+};
+
+static const struct
+{
+  const char *name;
+  size_t offset;
+} cost_fields[] = {
+  { "interp_ns_per_byte", offsetof(struct costs, interp_ns_per_byte) },
+  { "jit_ns_per_byte", offsetof(struct costs, jit_ns_per_byte) },
+  { "compile_o0_ns", offsetof(struct costs, compile_o0_ns) },
+  { "compile_o2_ns", offsetof(struct costs, compile_o2_ns) },
+  { "load_ns", offsetof(struct costs, load_ns) },
+};
+
+enum { NUM_COST_FIELDS = sizeof(cost_fields) / sizeof(cost_fields[0]) };
+
+static double *cost_field(struct costs *costs, int i)
+{
+  return (double*)((char*)costs + cost_fields[i].offset);
+}
+
+const char *jit_strategy_name(enum jit_strategy strategy)
+{
+  switch (strategy)
+  {
+    case JIT_AUTO: return "auto";
+    case JIT_NEVER: return "interpreter only";
+    case JIT_BACKGROUND: return "background JIT";
+    case JIT_BLOCKING: return "blocking JIT";
+  }
+  return "unknown";
+}
+
+int pattern_complexity(const char *regexp)
+{
+  struct re_list list;
+  if (re_parse_list(&list, regexp, 0, NULL) != 0)
+    return 1;
+
+  // Each pattern of a '\n'-separated list is interpreted on its own
+  int complexity = 0;
+  for (int i = 0; i < list.num_patterns; i++)
+    for (int j = 0; j < list.patterns[i].num_atoms; j++)
+    {
+      enum re_repeat repeat = list.patterns[i].atoms[j].repeat;
+      complexity += repeat == RE_STAR ? 3 : repeat == RE_OPTIONAL ? 2 : 1;
+    }
+
+  re_list_free(&list);
+  return complexity > 0 ? complexity : 1;
+}
+
+// Reads the file of 'fd' into 'model'. Unknown or malformed lines are ignored.
+static void read_costs(struct cost_model *model, int fd)
+{
+  model->costs = default_costs;
+  memset(model->samples, 0, sizeof(model->samples));
+
+  char buffer[1024];
+  ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  buffer[n > 0 ? n : 0] = '\0';
+
+  char *saveptr;
+  for (char *line = strtok_r(buffer, "\n", &saveptr);
+      line != NULL;
+      line = strtok_r(NULL, "\n", &saveptr))
+  {
+    char name[64];
+    double value;
+    int samples;
+    if (sscanf(line, "%63s %lf %d", name, &value, &samples) != 3 || value < 0 || samples < 0)
+      continue;
+
+    for (int i = 0; i < NUM_COST_FIELDS; i++)
+      if (strcmp(name, cost_fields[i].name) == 0)
+      {
+        *cost_field(&model->costs, i) = value;
+        model->samples[i] = samples;
+      }
+  }
+}
+
+void cost_model_load(struct cost_model *model, const char *dir)
+{
+  model->costs = default_costs;
+  memset(model->samples, 0, sizeof(model->samples));
+  model->path[0] = '\0';
+
+  if (dir[0] == '\0')
+    return;
+
+  snprintf(model->path, sizeof(model->path), "%s/" COSTS_FILE_NAME, dir);
+
+  int fd = open(model->path, O_RDONLY);
+  if (fd < 0)
+    return;
+  flock(fd, LOCK_SH);
+  read_costs(model, fd);
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+void cost_model_decide(const struct cost_model *model, const char *regexp,
+    long long size, int num_threads, int o2_cached, struct cost_estimate *estimate)
+{
+  const struct costs *c = &model->costs;
+
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  estimate->size = size;
+  estimate->complexity = pattern_complexity(regexp);
+  estimate->num_threads = num_threads > 0 ? num_threads : 1;
+  estimate->num_cpus = num_cpus > 0 ? num_cpus : 1;
+  estimate->o2_cached = o2_cached;
+
+  if (size < 0)
+  {
+    // A pipe may be arbitrarily long, and the background JIT never does much
+    // worse than the interpreter
+    estimate->interp_ns = estimate->blocking_ns = estimate->background_ns = -1;
+    estimate->strategy = JIT_BACKGROUND;
+    return;
+  }
+
+  // The costs per byte are of one thread
+  int parallel = estimate->num_threads < estimate->num_cpus
+    ? estimate->num_threads : estimate->num_cpus;
+  double interp_ns_per_byte = c->interp_ns_per_byte * estimate->complexity / parallel;
+  double jit_ns_per_byte = c->jit_ns_per_byte / parallel;
+  double o2_ns = o2_cached ? c->load_ns : c->compile_o2_ns;
+
+  estimate->interp_ns = size * interp_ns_per_byte;
+  estimate->blocking_ns = o2_ns + size * jit_ns_per_byte;
+
+  // The first JIT'd tier is the cached O2 matcher or else the O0 one
+  double first_tier_ns = o2_cached ? c->load_ns : c->compile_o0_ns;
+  if (estimate->num_cpus == 1)
+  {
+    // The compiles take the CPU away from the interpreter
+    estimate->background_ns = BACKGROUND_OVERHEAD_NS + estimate->blocking_ns
+      + (o2_cached ? 0 : c->compile_o0_ns);
+  }
+  else if (estimate->interp_ns <= first_tier_ns)
+  {
+    estimate->background_ns = BACKGROUND_OVERHEAD_NS + estimate->interp_ns;
+  }
+  else
+  {
+    double interpreted_bytes = first_tier_ns / interp_ns_per_byte;
+    estimate->background_ns = BACKGROUND_OVERHEAD_NS + first_tier_ns
+      + (size - interpreted_bytes) * jit_ns_per_byte;
+  }
+
+  estimate->strategy = JIT_NEVER;
+  double best_ns = estimate->interp_ns;
+  if (estimate->blocking_ns < best_ns)
+  {
+    estimate->strategy = JIT_BLOCKING;
+    best_ns = estimate->blocking_ns;
+  }
+  if (estimate->background_ns < best_ns)
+  {
+    estimate->strategy = JIT_BACKGROUND;
+    best_ns = estimate->background_ns;
+  }
+}
+
+static void fold(struct cost_model *model, int i, double value)
+{
+  if (value < 0)
+    return;
+
+  double weight = 1.0 / (model->samples[i] + 1);
+  if (weight < MIN_SAMPLE_WEIGHT)
+    weight = MIN_SAMPLE_WEIGHT;
+
+  double *cost = cost_field(&model->costs, i);
+  *cost = model->samples[i] == 0 ? value : *cost + weight * (value - *cost);
+  model->samples[i]++;
+}
+
+void cost_model_update(struct cost_model *model, const struct cost_sample *sample)
+{
+  if (model->path[0] == '\0')
+    return;
+
+  int fd = open(model->path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return;
+  flock(fd, LOCK_EX);
+
+  // Other runs may have updated the file since it was loaded
+  read_costs(model, fd);
+
+  // Several threads scan faster than the costs of one, see jgrep-costs.h
+  if (sample->num_threads == 1 && sample->size >= MIN_SAMPLE_BYTES && sample->scan_ns > 0)
+  {
+    // Only runs that used a single matcher from start to end tell its cost
+    if (sample->strategy == JIT_NEVER)
+      fold(model, 0, sample->scan_ns / ((double)sample->size * sample->complexity));
+    else if (sample->strategy == JIT_BLOCKING)
+      fold(model, 1, sample->scan_ns / sample->size);
+  }
+  // Background runs tell it from the part the optimized matcher scanned, so
+  // that a JIT cost estimated too high is corrected even if the model never
+  // picks a blocking JIT again
+  if (sample->num_threads == 1 && sample->strategy != JIT_BLOCKING
+      && sample->jit_bytes >= MIN_SAMPLE_BYTES
+      && sample->jit_ns > 0)
+    fold(model, 1, sample->jit_ns / sample->jit_bytes);
+  fold(model, 2, sample->compile_o0_ns);
+  fold(model, 3, sample->compile_o2_ns);
+  fold(model, 4, sample->load_ns);
+
+  char buffer[1024];
+  int length = 0;
+  for (int i = 0; i < NUM_COST_FIELDS; i++)
+    length += snprintf(buffer + length, sizeof(buffer) - length, "%s %.6g %d\n",
+        cost_fields[i].name, *cost_field(&model->costs, i), model->samples[i]);
+
+  if (ftruncate(fd, 0) != 0 || pwrite(fd, buffer, length, 0) != length)
+    fprintf(stderr, "jgrep: cannot update '%s'\n", model->path);
+
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+void cost_model_print(const struct cost_model *model, const struct cost_estimate *estimate)
+{
+  const struct costs *c = &model->costs;
+
+  fprintf(stderr, "cost model: %s\n", model->path[0] != '\0' ? model->path : "defaults, not persisted");
+  fprintf(stderr, "  interpreter  %8.3f ns/byte x complexity %d (%d runs)\n",
+      c->interp_ns_per_byte, estimate->complexity, model->samples[0]);
+  fprintf(stderr, "  JIT          %8.3f ns/byte (%d runs)\n", c->jit_ns_per_byte, model->samples[1]);
+  fprintf(stderr, "  compile O0   %8.3f ms (%d runs)\n", c->compile_o0_ns / 1e6, model->samples[2]);
+  fprintf(stderr, "  compile O2   %8.3f ms (%d runs)%s\n", c->compile_o2_ns / 1e6, model->samples[3],
+      estimate->o2_cached ? ", cached" : "");
+  fprintf(stderr, "  cache load   %8.3f ms (%d runs)\n", c->load_ns / 1e6, model->samples[4]);
+
+  if (estimate->size < 0)
+    fprintf(stderr, "  input size unknown, %d threads, %d CPUs\n",
+        estimate->num_threads, estimate->num_cpus);
+  else
+  {
+    fprintf(stderr, "  input %lld bytes, %d threads, %d CPUs\n",
+        estimate->size, estimate->num_threads, estimate->num_cpus);
+    fprintf(stderr, "  estimated: interpreter %.3f ms, blocking JIT %.3f ms, background JIT %.3f ms\n",
+        estimate->interp_ns / 1e6, estimate->blocking_ns / 1e6, estimate->background_ns / 1e6);
+  }
+  fprintf(stderr, "  decision: %s\n", jit_strategy_name(estimate->strategy));
+}
@@ -0,0 +1,111 @@
+#ifndef JGREP_COSTS_H
+#define JGREP_COSTS_H
+
+#include <limits.h>
+
+// Decides whether compiling the regexp pays off for one input, by comparing
+// the estimated running time of each strategy:
+//
+//   interpreter only   size * interpreter cost per byte
+//   blocking JIT       compile time + size * JIT cost per byte
+//   background JIT     the interpreter runs until the JIT code is ready
+//
+// The costs start from defaults and are then measured on this machine: every
+// run reports what it observed with cost_model_update, and the averages are
+// kept in a "costs" file of the cache directory (see jgrep-cache.h).
+//
+// The costs per byte are those of one scanning thread: they are learned only
+// from runs that scan with one (-j 1), and the estimates divide them by the
+// threads of the run that can scan at once, at most one per CPU. Compile
+// times do not depend on the threads and are learned from every run.
+
+enum jit_strategy
+{
+  JIT_AUTO,        // Let the cost model decide
+  JIT_NEVER,       // Interpreter only
+  JIT_BACKGROUND,  // Interpret while compiling, then switch
+  JIT_BLOCKING,    // Compile first, then scan
+};
+
+const char *jit_strategy_name(enum jit_strategy strategy);
+
+// Machine costs. Times are in nanoseconds.
+struct costs
+{
+  // Interpreter per byte and per unit of pattern_complexity
+  double interp_ns_per_byte;
+  // JIT'd matcher per byte
+  double jit_ns_per_byte;
+  // Compiling the matcher at O0 and at O2
+  double compile_o0_ns;
+  double compile_o2_ns;
+  // Loading a cached matcher
+  double load_ns;
+};
+
+struct cost_model
+{
+  char path[PATH_MAX + 16]; // Empty if the costs are not persisted
+  struct costs costs;
+  // Runs averaged into each of the costs, in the order of struct costs
+  int samples[5];
+};
+
+// The inputs and the outcome of a decision
+struct cost_estimate
+{
+  long long size;      // -1 if unknown
+  int complexity;
+  int num_threads;     // Scanning the input, as -j
+  int num_cpus;
+  int o2_cached;
+
+  double interp_ns;
+  double blocking_ns;
+  double background_ns;
+
+  enum jit_strategy strategy;
+};
+
+// Relative cost of interpreting 'regexp' on every byte: each atom counts one,
+// each optional atom two and each starred atom, which may backtrack, three. The complexity of
+// a '\n'-separated list is the sum of its patterns.
+int pattern_complexity(const char *regexp);
+
+// Reads the costs persisted in 'dir', which may be empty to use the defaults
+void cost_model_load(struct cost_model *model, const char *dir);
+
+// Picks the cheapest strategy for an input of 'size' bytes (-1 if unknown)
+// scanned by 'num_threads' threads
+void cost_model_decide(const struct cost_model *model, const char *regexp,
+    long long size, int num_threads, int o2_cached, struct cost_estimate *estimate);
+
+// What a run observed. Negative values were not measured.
+struct cost_sample
+{
+  enum jit_strategy strategy;
+  // Threads that scanned, as -j. Only runs with one tell the costs per byte.
+  int num_threads;
+  // Bytes scanned, fewer than the input when the scan stopped early (-q, -l,
+  // -m)
+  long long size;
+  int complexity;
+  // Time spent scanning them
+  double scan_ns;
+  // Time to compile, or to load from the cache, the O0 and O2 matchers
+  double compile_o0_ns;
+  double compile_o2_ns;
+  double load_ns;
+  // In runs that started on another matcher, the bytes the optimized JIT'd
+  // one scanned once swapped in and its share of scan_ns. 0 if it scanned
+  // nothing.
+  long long jit_bytes;
+  double jit_ns;
+};
+
+// Folds 'sample' into the persisted averages
+void cost_model_update(struct cost_model *model, const struct cost_sample *sample);
+
+void cost_model_print(const struct cost_model *model, const struct cost_estimate *estimate);
+
+#endif // JGREP_COSTS_H
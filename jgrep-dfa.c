@@ -0,0 +1,327 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jgrep-dfa.h"
+#include "jgrep-regexp.h"
+
+// The Thompson NFA of a jgrep regexp is a chain of positions: position i means
+// "atom i is next" and the final position after the last atom means "the whole
+// regexp matched".
+//
+//   x   : i --x--> i+1
+//   x*  : i --x--> i, i --eps--> i+1
+//   x?  : i --x--> i+1, i --eps--> i+1
+//
+// where an edge labelled x is taken on every byte of the set of atom x.
+//
+// A list of regexps separated by '\n' matches if any of them does, so their
+// chains are laid one after the other and the NFA starts at the first position
+// of every chain. An unanchored regexp may start at every byte, so its first
+// position is added back to every set. Sets of positions are bitsets of
+// 'words' 64-bit words.
+
+struct atom
+{
+  struct re_atom re;
+  int final;  // The final position of a regexp, not an atom
+  int dollar; // For final positions, the regexp ended in '$'
+};
+
+// Where the NFA of one regexp starts
+struct start
+{
+  int position;
+  int anchored;
+};
+
+struct builder
+{
+  struct atom *atoms; // The positions of every regexp
+  int num_atoms;
+
+  int words;
+  uint64_t *sets; // One set per DFA state
+  int max_states;
+
+  // Open addressing hash from sets to DFA states
+  int *table;
+  int table_size;
+
+  struct dfa *dfa;
+};
+
+// Appends the positions of the regexp that starts at 'regexp' and ends at the
+// next '\n' or '\0'. Returns the end of the regexp, or NULL if it is not
+// valid.
+static const char *parse_one(struct builder *b, const char *regexp, int flags,
+    struct start *starts, int *num_starts)
+{
+  struct re_pattern pattern;
+  regexp = re_parse(&pattern, regexp, flags, NULL);
+  if (regexp == NULL)
+    return NULL;
+
+  // Leading atoms that may match nothing cannot decide whether an unanchored
+  // regexp matches a line, and dropping them keeps the restart position out
+  // of most sets
+  int first = b->num_atoms;
+  for (int i = re_skippable_prefix(&pattern); i < pattern.num_atoms; i++)
+  {
+    struct atom *atom = &b->atoms[b->num_atoms++];
+    memset(atom, 0, sizeof(*atom));
+    atom->re = pattern.atoms[i];
+  }
+
+  struct atom *final = &b->atoms[b->num_atoms++];
+  memset(final, 0, sizeof(*final));
+  final->final = 1;
+  final->dollar = pattern.dollar;
+
+  starts[*num_starts].position = first;
+  starts[*num_starts].anchored = pattern.anchored;
+  (*num_starts)++;
+
+  re_pattern_free(&pattern);
+  return regexp;
+}
+
+static int parse(struct builder *b, const char *regexp, int flags,
+    struct start **starts, int *num_starts)
+{
+  // Every char yields at most two positions ("x+" is "xx*"), and every regexp
+  // one final one
+  size_t length = strlen(regexp);
+  b->atoms = malloc(sizeof(*b->atoms) * (2 * length + 1));
+  *starts = malloc(sizeof(**starts) * (length + 1));
+  if (b->atoms == NULL || *starts == NULL)
+    return -1;
+
+  for (;;)
+  {
+    regexp = parse_one(b, regexp, flags, *starts, num_starts);
+    if (regexp == NULL)
+      return -1;
+    if (regexp[0] == '\0')
+      break;
+    regexp++; // '\n'
+  }
+
+  return 0;
+}
+
+static int set_has(const uint64_t *set, int i)
+{
+  return (set[i / 64] >> (i % 64)) & 1;
+}
+
+static void set_add(uint64_t *set, int i)
+{
+  set[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static int set_is_empty(const struct builder *b, const uint64_t *set)
+{
+  for (int w = 0; w < b->words; w++)
+    if (set[w] != 0)
+      return 0;
+  return 1;
+}
+
+// Follows the eps edges of the starred and optional atoms. They only go
+// forward, so a single increasing pass reaches every position. Such an atom is
+// never the last position of a regexp, so i+1 stays in the same regexp.
+static void closure(const struct builder *b, uint64_t *set)
+{
+  for (int i = 0; i < b->num_atoms; i++)
+    if (set_has(set, i) && b->atoms[i].re.repeat != RE_ONE)
+      set_add(set, i + 1);
+}
+
+static unsigned hash_set(const struct builder *b, const uint64_t *set)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (int w = 0; w < b->words; w++)
+  {
+    h ^= set[w];
+    h *= 1099511628211ULL;
+  }
+  return (unsigned)(h ^ (h >> 32));
+}
+
+// Returns the DFA state of 'set', adding a new one if needed, or -1 if there
+// would be too many states
+static int lookup_or_add(struct builder *b, const uint64_t *set)
+{
+  unsigned h = hash_set(b, set) & (b->table_size - 1);
+  while (b->table[h] >= 0)
+  {
+    int s = b->table[h];
+    if (memcmp(&b->sets[s * b->words], set, sizeof(uint64_t) * b->words) == 0)
+      return s;
+    h = (h + 1) & (b->table_size - 1);
+  }
+
+  struct dfa *dfa = b->dfa;
+  if (dfa->num_states == b->max_states)
+    return -1;
+
+  int s = dfa->num_states++;
+  memcpy(&b->sets[s * b->words], set, sizeof(uint64_t) * b->words);
+  memset(&dfa->states[s], 0, sizeof(dfa->states[s]));
+  b->table[h] = s;
+
+  return s;
+}
+
+// The state reached from 'set' after the whole regexp has been consumed
+static int classify(struct builder *b, const uint64_t *set)
+{
+  if (set_is_empty(b, set))
+    return DFA_REJECT;
+  for (int i = 0; i < b->num_atoms; i++)
+    if (set_has(set, i) && b->atoms[i].final && !b->atoms[i].dollar)
+      return DFA_ACCEPT;
+  return lookup_or_add(b, set);
+}
+
+// Whether a regexp has fully matched in 'set', needing only the end of line
+static int has_final(const struct builder *b, const uint64_t *set)
+{
+  for (int i = 0; i < b->num_atoms; i++)
+    if (set_has(set, i) && b->atoms[i].final)
+      return 1;
+  return 0;
+}
+
+static int subset_construction(struct builder *b, const struct start *starts, int num_starts)
+{
+  struct dfa *dfa = b->dfa;
+  uint64_t *start = calloc(b->words, sizeof(uint64_t));
+  uint64_t *restart = calloc(b->words, sizeof(uint64_t));
+  uint64_t *next = calloc(b->words, sizeof(uint64_t));
+  if (start == NULL || restart == NULL || next == NULL)
+    goto error;
+
+  for (int i = 0; i < num_starts; i++)
+  {
+    set_add(start, starts[i].position);
+    if (!starts[i].anchored)
+      set_add(restart, starts[i].position);
+  }
+  closure(b, start);
+  closure(b, restart);
+
+  dfa->start = classify(b, start);
+  if (dfa->start < 0)
+    goto error;
+
+  // New states are appended, so this visits every reachable state
+  for (int s = DFA_ACCEPT + 1; s < dfa->num_states; s++)
+  {
+    int accept_at_end = has_final(b, &b->sets[s * b->words]);
+    dfa->states[s].accept_at_end = accept_at_end;
+
+    for (int c = 0; c < 256; c++)
+    {
+      if (c == '\n')
+      {
+        dfa->states[s].next[c] = accept_at_end ? DFA_ACCEPT : DFA_REJECT;
+        continue;
+      }
+
+      const uint64_t *current = &b->sets[s * b->words];
+      memset(next, 0, sizeof(uint64_t) * b->words);
+      for (int i = 0; i < b->num_atoms; i++)
+      {
+        if (!set_has(current, i) || b->atoms[i].final)
+          continue;
+        if (!re_atom_has(&b->atoms[i].re, c))
+          continue;
+        set_add(next, b->atoms[i].re.repeat == RE_STAR ? i : i + 1);
+      }
+      closure(b, next);
+
+      for (int w = 0; w < b->words; w++)
+        next[w] |= restart[w];
+
+      int t = classify(b, next);
+      if (t < 0)
+        goto error;
+      dfa->states[s].next[c] = t;
+    }
+  }
+
+  free(start);
+  free(restart);
+  free(next);
+  return 0;
+
+error:
+  free(start);
+  free(restart);
+  free(next);
+  return -1;
+}
+
+int dfa_build(struct dfa *dfa, const char *regexp, int flags, int max_states)
+{
+  struct builder b;
+  memset(&b, 0, sizeof(b));
+  memset(dfa, 0, sizeof(*dfa));
+  b.dfa = dfa;
+  b.max_states = max_states + 2; // Plus DFA_REJECT and DFA_ACCEPT
+
+  struct start *starts = NULL;
+  int num_starts = 0;
+  if (parse(&b, regexp, flags, &starts, &num_starts) != 0)
+    goto error;
+
+  b.words = (b.num_atoms + 63) / 64;
+  b.sets = calloc((size_t)b.max_states * b.words, sizeof(uint64_t));
+  dfa->states = calloc(b.max_states, sizeof(struct dfa_state));
+
+  b.table_size = 1;
+  while (b.table_size < 2 * b.max_states)
+    b.table_size *= 2;
+  b.table = malloc(sizeof(int) * b.table_size);
+
+  if (b.sets == NULL || dfa->states == NULL || b.table == NULL)
+    goto error;
+
+  for (int i = 0; i < b.table_size; i++)
+    b.table[i] = -1;
+
+  // Both are sinks and are never looked up by set
+  dfa->num_states = DFA_ACCEPT + 1;
+  for (int c = 0; c < 256; c++)
+  {
+    dfa->states[DFA_REJECT].next[c] = DFA_REJECT;
+    dfa->states[DFA_ACCEPT].next[c] = DFA_ACCEPT;
+  }
+  dfa->states[DFA_ACCEPT].accept_at_end = 1;
+
+  if (subset_construction(&b, starts, num_starts) != 0)
+    goto error;
+
+  free(starts);
+  free(b.atoms);
+  free(b.sets);
+  free(b.table);
+  return 0;
+
+error:
+  free(starts);
+  free(b.atoms);
+  free(b.sets);
+  free(b.table);
+  dfa_free(dfa);
+  return -1;
+}
+
+void dfa_free(struct dfa *dfa)
+{
+  free(dfa->states);
+  dfa->states = NULL;
+  dfa->num_states = 0;
+}
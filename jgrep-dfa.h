@@ -0,0 +1,39 @@
+#ifndef JGREP_DFA_H
+#define JGREP_DFA_H
+
+// A DFA over bytes that decides whether a line matches one of the regexps of
+// jgrep (see jgrep-regexp.h), or any of a list of them separated by '\n'. It
+// is built by subset construction from the Thompson NFA of the regexps, so
+// matching reads every byte of the line at most once and never backtracks.
+// For a list of literals it is the Aho-Corasick automaton of the list.
+//
+// A '\n' ends the line just like the end of the text does, so it never takes
+// part in a transition: next['\n'] is DFA_ACCEPT or DFA_REJECT.
+
+enum
+{
+  DFA_REJECT = 0, // The line cannot match any more
+  DFA_ACCEPT = 1, // The line matches, no matter what follows
+};
+
+struct dfa_state
+{
+  int next[256];
+  int accept_at_end; // The line matches if it ends in this state
+};
+
+struct dfa
+{
+  int start;
+  int num_states;
+  // states[DFA_REJECT] and states[DFA_ACCEPT] are never left once entered
+  struct dfa_state *states;
+};
+
+// Builds the DFA of 'regexp' parsed with 'flags' (see re_parse). Returns 0 on
+// success and -1 if the regexp is not valid or needs more than 'max_states'
+// states, in which case callers should use another matcher instead.
+int dfa_build(struct dfa *dfa, const char *regexp, int flags, int max_states);
+void dfa_free(struct dfa *dfa);
+
+#endif // JGREP_DFA_H
@@ -0,0 +1,416 @@
+#define _GNU_SOURCE // O_DIRECT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "jgrep-input.h"
+
+// Below this size asking for transparent huge pages is not worth a syscall
+enum { HUGE_PAGE_THRESHOLD = 8 * 1024 * 1024 };
+
+int input_open(const char *filename)
+{
+  if (strcmp(filename, INPUT_STDIN_NAME) == 0)
+    return dup(STDIN_FILENO);
+  return open(filename, O_RDONLY | O_NOCTTY);
+}
+
+const char *input_display_name(const char *filename)
+{
+  return strcmp(filename, INPUT_STDIN_NAME) == 0 ? "(standard input)" : filename;
+}
+
+int input_map_open(struct input_map *map, const char *filename)
+{
+  int fd = input_open(filename);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    goto error;
+
+  if (!S_ISREG(st.st_mode))
+  {
+    errno = ENODEV;
+    goto error;
+  }
+
+  map->data = NULL;
+  map->size = st.st_size;
+
+  // mmap refuses empty mappings, but an empty file simply has no lines
+  if (map->size > 0)
+  {
+    void *p = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+      goto error;
+
+    // We read the mapping front to back exactly once: let the kernel read
+    // ahead aggressively and drop pages behind us.
+    // These are only hints, so failures are ignored.
+    madvise(p, map->size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (map->size >= HUGE_PAGE_THRESHOLD)
+      madvise(p, map->size, MADV_HUGEPAGE);
+#endif
+
+    map->data = p;
+  }
+
+  // The mapping keeps its own reference to the file
+  close(fd);
+  return 0;
+
+error:
+  {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+  }
+  return -1;
+}
+
+void input_map_close(struct input_map *map)
+{
+  if (map->data != NULL)
+    munmap((void*)map->data, map->size);
+  map->data = NULL;
+  map->size = 0;
+}
+
+const char *input_backend_name(enum input_backend backend)
+{
+  switch (backend)
+  {
+    case INPUT_AUTO: return "auto";
+    case INPUT_MMAP: return "mmap";
+    case INPUT_READ: return "read";
+    case INPUT_DIRECT: return "direct";
+    case INPUT_URING: return "uring";
+  }
+  return "unknown";
+}
+
+char *input_alloc(size_t size)
+{
+  void *buffer;
+  if (posix_memalign(&buffer, INPUT_ALIGNMENT, size) != 0)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return buffer;
+}
+
+// An io_uring of INPUT_MAX_IN_FLIGHT entries, set up with the raw system calls
+// so that jgrep needs no liburing. Each thread that reads with INPUT_URING gets
+// its own, the first time it needs it, and keeps it until it exits.
+struct input_uring
+{
+  int fd;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+static pthread_key_t uring_key;
+static pthread_once_t uring_key_once = PTHREAD_ONCE_INIT;
+
+static void uring_free(void *info)
+{
+  struct input_uring *uring = info;
+  if (uring->sqes != NULL)
+    munmap(uring->sqes, uring->sqes_size);
+  if (uring->cq_ring != NULL && uring->cq_ring != uring->sq_ring)
+    munmap(uring->cq_ring, uring->cq_ring_size);
+  if (uring->sq_ring != NULL)
+    munmap(uring->sq_ring, uring->sq_ring_size);
+  close(uring->fd);
+  free(uring);
+}
+
+static void uring_key_create(void)
+{
+  pthread_key_create(&uring_key, uring_free);
+}
+
+// The io_uring of the calling thread, or NULL if the kernel has none
+static struct input_uring *thread_uring(void)
+{
+  pthread_once(&uring_key_once, uring_key_create);
+  struct input_uring *uring = pthread_getspecific(uring_key);
+  if (uring != NULL)
+    return uring;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, INPUT_MAX_IN_FLIGHT, &params);
+  if (fd < 0)
+    return NULL;
+
+  uring = calloc(1, sizeof(*uring));
+  if (uring == NULL)
+  {
+    close(fd);
+    return NULL;
+  }
+  uring->fd = fd;
+
+  uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (uring->cq_ring_size > uring->sq_ring_size)
+      uring->sq_ring_size = uring->cq_ring_size;
+    uring->cq_ring_size = uring->sq_ring_size;
+  }
+  uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (uring->sq_ring == MAP_FAILED)
+  {
+    uring->sq_ring = NULL;
+    goto error;
+  }
+  uring->cq_ring = uring->sq_ring;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (uring->cq_ring == MAP_FAILED)
+    {
+      uring->cq_ring = NULL;
+      goto error;
+    }
+  }
+  uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (uring->sqes == MAP_FAILED)
+  {
+    uring->sqes = NULL;
+    goto error;
+  }
+
+  char *sq = uring->sq_ring;
+  char *cq = uring->cq_ring;
+  uring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  uring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  uring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  uring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  uring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  uring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  pthread_setspecific(uring_key, uring);
+  return uring;
+
+error:
+  uring_free(uring);
+  return NULL;
+}
+
+void input_reader_init(struct input_reader *reader, int fd, enum input_backend backend)
+{
+  memset(reader, 0, sizeof(*reader));
+  reader->fd = fd;
+  reader->backend = INPUT_READ;
+  reader->max_in_flight = 1;
+
+  struct stat st;
+  reader->seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  if (!reader->seekable)
+    return;
+  reader->offset = lseek(fd, 0, SEEK_CUR);
+  if (reader->offset < 0)
+    reader->offset = 0;
+
+  // O_DIRECT reads must start at an aligned offset
+  if (backend == INPUT_DIRECT && reader->offset % INPUT_ALIGNMENT == 0)
+  {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0 && fcntl(fd, F_SETFL, flags | O_DIRECT) == 0)
+      reader->backend = INPUT_DIRECT;
+  }
+  else if (backend == INPUT_URING)
+  {
+    reader->backend = INPUT_URING;
+    reader->max_in_flight = INPUT_MAX_IN_FLIGHT;
+  }
+}
+
+int input_reader_open(struct input_reader *reader, const char *filename,
+    enum input_backend backend)
+{
+  int fd = input_open(filename);
+  if (fd < 0)
+    return -1;
+  input_reader_init(reader, fd, backend);
+  return 0;
+}
+
+void input_reader_close(struct input_reader *reader)
+{
+  // Reads in flight write into their buffers until they complete
+  while (reader->num_pending > 0)
+    input_reader_complete(reader);
+  close(reader->fd);
+  reader->fd = -1;
+}
+
+void input_reader_submit(struct input_reader *reader, char *buffer, size_t size)
+{
+  int index = (reader->first + reader->num_pending) % INPUT_MAX_IN_FLIGHT;
+  struct input_read *request = &reader->reads[index];
+  request->buffer = buffer;
+  request->size = size;
+  request->offset = reader->offset;
+  request->done = 0;
+  reader->offset += size;
+  reader->num_pending++;
+
+  if (reader->backend != INPUT_URING)
+    return;
+
+  if (reader->uring == NULL)
+    reader->uring = thread_uring();
+  if (reader->uring == NULL)
+  {
+    // Done by input_reader_complete instead
+    reader->backend = INPUT_READ;
+    reader->max_in_flight = 1;
+    return;
+  }
+
+  struct input_uring *uring = reader->uring;
+  unsigned tail = *uring->sq_tail;
+  unsigned slot = tail & *uring->sq_mask;
+  struct io_uring_sqe *sqe = &uring->sqes[slot];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = reader->fd;
+  sqe->addr = (unsigned long)buffer;
+  sqe->len = size;
+  sqe->off = request->offset;
+  sqe->user_data = index;
+  uring->sq_array[slot] = slot;
+  __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  if (syscall(__NR_io_uring_enter, uring->fd, 1, 0, 0, NULL, 0) < 0)
+  {
+    request->result = -errno;
+    request->done = 1;
+  }
+}
+
+// Reads [buffer + done, buffer + size) at 'offset' + done, or at the current
+// position of a stream, until it is full or the input ends
+static ssize_t read_rest(struct input_reader *reader, struct input_read *request, size_t done)
+{
+  while (done < request->size)
+  {
+    ssize_t n = reader->seekable
+      ? pread(reader->fd, request->buffer + done, request->size - done, request->offset + done)
+      : read(reader->fd, request->buffer + done, request->size - done);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    done += n;
+  }
+  return done;
+}
+
+ssize_t input_reader_complete(struct input_reader *reader)
+{
+  struct input_read *request = &reader->reads[reader->first];
+  reader->first = (reader->first + 1) % INPUT_MAX_IN_FLIGHT;
+  reader->num_pending--;
+
+  if (reader->backend != INPUT_URING)
+    return read_rest(reader, request, 0);
+
+  // Completions come in any order: each one is kept in its read
+  struct input_uring *uring = reader->uring;
+  while (!request->done)
+  {
+    unsigned head = *uring->cq_head;
+    if (head == __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+      if (syscall(__NR_io_uring_enter, uring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+          && errno != EINTR)
+        return -1;
+      continue;
+    }
+    struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+    reader->reads[cqe->user_data].result = cqe->res;
+    reader->reads[cqe->user_data].done = 1;
+    __atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+  }
+
+  if (request->result < 0)
+  {
+    errno = -request->result;
+    return -1;
+  }
+  // A short read before the end of the file is finished by hand
+  if (request->result > 0 && (size_t)request->result < request->size)
+    return read_rest(reader, request, request->result);
+  return request->result;
+}
+
+ssize_t input_read_all(struct input_reader *reader, char **buffer, size_t *capacity,
+    size_t size_hint)
+{
+  // One more block than the hint, to see the end
+  size_t needed = (size_hint / INPUT_ALIGNMENT + 1) * INPUT_ALIGNMENT;
+  size_t size = 0;
+
+  for (;;)
+  {
+    if (*capacity < size + needed)
+    {
+      size_t new_capacity = *capacity ? *capacity : 64 * 1024;
+      while (new_capacity < size + needed)
+        new_capacity *= 2;
+      char *new_buffer = input_alloc(new_capacity);
+      memcpy(new_buffer, *buffer, size);
+      free(*buffer);
+      *buffer = new_buffer;
+      *capacity = new_capacity;
+    }
+
+    input_reader_submit(reader, *buffer + size, *capacity - size);
+    ssize_t n = input_reader_complete(reader);
+    if (n < 0)
+      return -1;
+    size += n;
+    if (size < *capacity)
+      return size;
+    needed = *capacity;
+  }
+}
@@ -0,0 +1,117 @@
+#ifndef JGREP_INPUT_H
+#define JGREP_INPUT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// A whole input file mapped read-only in memory. Lines are found in place
+// inside the mapping, so nothing is copied on the way to the matcher.
+struct input_map
+{
+  const char *data;
+  size_t size;
+};
+
+// As in grep, "-" names the standard input
+#define INPUT_STDIN_NAME "-"
+
+// Opens 'filename' for reading, or duplicates the standard input for "-", so
+// that the caller closes it either way. Returns -1 and leaves errno set on
+// errors.
+int input_open(const char *filename);
+
+// The name of 'filename' in the output: "(standard input)" for "-"
+const char *input_display_name(const char *filename);
+
+// Maps 'filename', which may be "-" if the standard input is a regular file.
+// Returns 0 on success. Returns -1 and leaves errno set if the file cannot be
+// opened or cannot be mapped (e.g. it is a pipe), in which case the caller
+// should fall back to reading it with grep_stream (see jgrep-scan.h).
+int input_map_open(struct input_map *map, const char *filename);
+void input_map_close(struct input_map *map);
+
+// How inputs are read, chosen with --io
+enum input_backend
+{
+  INPUT_AUTO,   // mmap for regular files, read() for the rest (and for small
+                // files of a tree, see jgrep-walk.h)
+  INPUT_MMAP,   // mmap whenever the input can be mapped
+  INPUT_READ,   // read() into buffers
+  INPUT_DIRECT, // read() with O_DIRECT into aligned buffers, bypassing the
+                // page cache, for regular files; read() for the rest
+  INPUT_URING,  // io_uring, with several reads in flight for regular files
+};
+
+const char *input_backend_name(enum input_backend backend);
+
+// Whether a single input is mapped with 'backend', when it can be
+static inline int input_uses_mmap(enum input_backend backend)
+{
+  return backend == INPUT_AUTO || backend == INPUT_MMAP;
+}
+
+// Buffers, sizes and file offsets of the reads of an input_reader are
+// multiples of this, as O_DIRECT needs them to be aligned to the logical
+// block size of the device
+enum { INPUT_ALIGNMENT = 4096 };
+// Reads an input_reader may have in flight
+enum { INPUT_MAX_IN_FLIGHT = 8 };
+
+// A buffer of 'size' bytes aligned to INPUT_ALIGNMENT, to be freed with free.
+// Exits if out of memory.
+char *input_alloc(size_t size);
+
+struct input_read
+{
+  char *buffer;
+  size_t size;
+  off_t offset;
+  ssize_t result; // Once done
+  int done;
+};
+
+// Reads of an input in order, behind one of the backends. A read is first
+// submitted, then completed: with io_uring the reads submitted on a regular
+// file are all in flight until completed, with the other backends each one is
+// done when completed. With io_uring the readers of a thread share its ring,
+// so a thread has reads in flight for one reader at a time.
+struct input_reader
+{
+  enum input_backend backend; // INPUT_READ, INPUT_DIRECT or INPUT_URING
+  int fd;
+  int seekable;    // Reads go at offsets, so several may be in flight
+  int max_in_flight;
+  off_t offset;    // Of the next read submitted
+  struct input_read reads[INPUT_MAX_IN_FLIGHT];
+  int first;       // Oldest read not completed
+  int num_pending;
+  struct input_uring *uring; // Of the thread reading, with INPUT_URING
+};
+
+// Reads 'fd', which it then owns, with 'backend'. Backends that do not apply
+// to 'fd' fall back to INPUT_READ, e.g. O_DIRECT on a pipe or io_uring on a
+// kernel without it, and mmap is not a reader, so INPUT_AUTO and INPUT_MMAP
+// read too.
+void input_reader_init(struct input_reader *reader, int fd, enum input_backend backend);
+
+// input_open and input_reader_init. Returns -1 and leaves errno set if the
+// file cannot be opened.
+int input_reader_open(struct input_reader *reader, const char *filename,
+    enum input_backend backend);
+void input_reader_close(struct input_reader *reader);
+
+// Submits the read of the next 'size' bytes of the input into 'buffer', both
+// multiples of INPUT_ALIGNMENT, with fewer than max_in_flight reads pending
+void input_reader_submit(struct input_reader *reader, char *buffer, size_t size);
+
+// Waits for the oldest read submitted. Returns its size, which is less than
+// the size submitted only at the end of the input, or -1 with errno set.
+ssize_t input_reader_complete(struct input_reader *reader);
+
+// Reads the rest of the input into '*buffer', from input_alloc, which grows as
+// needed. 'size_hint' is the size expected. Returns the size read or -1 with
+// errno set.
+ssize_t input_read_all(struct input_reader *reader, char **buffer, size_t *capacity,
+    size_t size_hint);
+
+#endif // JGREP_INPUT_H
@@ -0,0 +1,62 @@
+#include "jgrep-interp.h"
+
+static int matchstar(const struct re_atom *atom, const struct re_pattern *pattern, int i,
+        const char *text, const char *end);
+
+/* at_eol: the line is [text, end), possibly still holding its '\n' */
+static int at_eol(const char *text, const char *end)
+{
+    return text == end || *text == '\n';
+}
+
+/* has: whether atom matches the next char; no atom matches the '\n' */
+static int has(const struct re_atom *atom, const char *text, const char *end)
+{
+    return text != end && re_atom_has(atom, *text);
+}
+
+/* matchhere: search for the atoms of pattern from i on at beginning of text */
+static int matchhere(const struct re_pattern *pattern, int i, const char *text, const char *end)
+{
+    if (i == pattern->num_atoms)
+        return !pattern->dollar || at_eol(text, end);
+    const struct re_atom *atom = &pattern->atoms[i];
+    if (atom->repeat == RE_STAR)
+        return matchstar(atom, pattern, i+1, text, end);
+    if (atom->repeat == RE_OPTIONAL && matchhere(pattern, i+1, text, end))
+        return 1;
+    if (has(atom, text, end))
+        return matchhere(pattern, i+1, text+1, end);
+    return 0;
+}
+
+/* matchstar: search for atom* followed by the atoms from i on at beginning of text */
+static int matchstar(const struct re_atom *atom, const struct re_pattern *pattern, int i,
+        const char *text, const char *end)
+{
+    do {    /* a * matches zero or more instances */
+        if (matchhere(pattern, i, text, end))
+            return 1;
+    } while (has(atom, text++, end));
+    return 0;
+}
+
+/* matchpattern: search for pattern anywhere in text */
+static int matchpattern(const struct re_pattern *pattern, const char *text, const char *end)
+{
+    if (pattern->anchored)
+        return matchhere(pattern, 0, text, end);
+    do {    /* must look even if string is empty */
+        if (matchhere(pattern, 0, text, end))
+            return 1;
+    } while (text++ != end);
+    return 0;
+}
+
+int interp_match(const struct re_list *list, const char *text, const char *end)
+{
+    for (int i = 0; i < list->num_patterns; i++)    /* any pattern of the list */
+        if (matchpattern(&list->patterns[i], text, end))
+            return 1;
+    return 0;
+}
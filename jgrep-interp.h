@@ -0,0 +1,11 @@
+#ifndef JGREP_INTERP_H
+#define JGREP_INTERP_H
+
+#include "jgrep-regexp.h"
+
+/* interp_match: search for any pattern of 'list' anywhere in the line
+ * [text, end), which may still hold its trailing '\n'. Each atom is tested
+ * with its table (see jgrep-regexp.h). */
+int interp_match(const struct re_list *list, const char *text, const char *end);
+
+#endif // JGREP_INTERP_H
@@ -2,443 +2,143 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <libgccjit.h>
 
+#include "jgrep-cache.h"
+#include "jgrep-codegen.h"
+#include "jgrep-input.h"
+#include "jgrep-options.h"
+#include "jgrep-scan.h"
+#include "jgrep-stats.h"
+#include "jgrep-walk.h"
+
 static void die(const char* c)
 {
   fprintf(stderr, "ERROR: %s\n", c);
   exit(EXIT_FAILURE);
 }
 
-#if 0
-static int matchstar(int c, const char *regexp, const char *text);
-
-/* matchhere: search for regexp at beginning of text */
-static int matchhere(const char *regexp, const char *text)
-{
-    if (regexp[0] == '\0')
-        return 1;
-    if (regexp[1] == '*')
-        return matchstar(regexp[0], regexp+2, text);
-    if (regexp[0] == '$' && regexp[1] == '\0')
-        return *text == '\0';
-    if (*text!='\0' && (regexp[0]=='.' || regexp[0]==*text))
-        return matchhere(regexp+1, text+1);
-    return 0;
-}
-
-/* matchstar: search for c*regexp at beginning of text */
-static int matchstar(int c, const char *regexp, const char *text)
-{
-    do {    /* a * matches zero or more instances */
-        if (matchhere(regexp, text))
-            return 1;
-    } while (*text != '\0' && (*text++ == c || c == '.'));
-    return 0;
-
-}
-
-/* match: search for regexp anywhere in text */
-static int match(const char *regexp, const char *text)
-{
-    if (regexp[0] == '^')
-        return matchhere(regexp+1, text);
-    do {    /* must look even if string is empty */
-        if (matchhere(regexp, text))
-            return 1;
-    } while (*text++ != '\0');
-    return 0;
-}
-#endif
-
-static const char* new_block_name(void)
-{
-  static int n = 0;
-  enum { SIZE = 16 };
-  static char c[SIZE];
-
-  snprintf(c, SIZE, "block-%02d", n);
-  c[SIZE-1] = '\0';
-
-  n++;
-
-  return c;
-}
-
-static const char* new_function_name(void)
+// Loads the matcher of 'regexp' with 'flags' compiled with 'profile' from the
+// cache, or compiles it and stores it there. Compiles it in memory when the cache is not usable.
+static struct matcher compile_match(struct jit_cache *cache, const char *regexp, int flags,
+    const struct codegen_profile *profile, enum codegen_mode mode)
 {
-  static int n = 0;
-  enum { SIZE = 16 };
-  static char c[SIZE];
-
-  snprintf(c, SIZE, "matchhere_%d", n);
-  c[SIZE-1] = '\0';
+  struct matcher matcher;
 
-  n++;
+  double start = stats_now_ns();
+  int res = jit_cache_load(cache, regexp, flags, profile, mode, &matcher);
+  stats_add_phase(STATS_CACHE_LOAD, start);
+  if (res == 0)
+    return matcher;
 
-  return c;
-}
-
-static const char* new_local_name(void)
-{
-  static int n = 0;
-  enum { SIZE = 16 };
-  static char c[SIZE];
-
-  snprintf(c, SIZE, "tmp_%d", n);
-  c[SIZE-1] = '\0';
-
-  n++;
-
-  return c;
-}
-
-static void generate_return_zero(gcc_jit_context* ctx, gcc_jit_function *fun, gcc_jit_block** return_zero)
-{
-  if (*return_zero == NULL)
-  {
-    gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
-    *return_zero = gcc_jit_function_new_block(fun, new_block_name());
-    gcc_jit_block_end_with_return(
-        *return_zero, /* loc */ NULL,
-        gcc_jit_context_zero(ctx, int_type));
-  }
-}
-
-static gcc_jit_function *generate_code_matchhere(gcc_jit_context *ctx, const char* regexp, const char* function_name)
-{
-  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
-  gcc_jit_type *char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CHAR);
-  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
-
-  gcc_jit_param *param_text = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "text");
-  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(param_text);
-
-  // matchhere
-  gcc_jit_param* params[] = { param_text };
-  gcc_jit_function *matchhere = gcc_jit_context_new_function(ctx, /* loc */ NULL,
-      GCC_JIT_FUNCTION_INTERNAL, int_type, function_name,
-      1, params, /* is_variadic */ 0);
-  gcc_jit_block* current_block = gcc_jit_function_new_block(matchhere, new_block_name());
-
-  gcc_jit_rvalue* text_plus_one = 
-    gcc_jit_context_new_cast(
-        ctx, /* loc */ NULL,
-        gcc_jit_lvalue_get_address(
-          gcc_jit_context_new_array_access(
-            ctx, /* loc */ NULL,
-            rval_text,
-            gcc_jit_context_one(ctx, int_type)),
-          /* loc */ NULL),
-        const_char_ptr_type);
+  gcc_jit_context *ctx;
+  ctx = gcc_jit_context_acquire ();
+  if (ctx == NULL)
+    die("acquired context is NULL");
 
-  gcc_jit_block* return_zero = NULL;
+  codegen_set_profile(ctx, profile);
 
-  gcc_jit_block* return_one = gcc_jit_function_new_block(matchhere, new_block_name());
-  gcc_jit_block_end_with_return(
-      return_one, /* loc */ NULL,
-      gcc_jit_context_one(ctx, int_type));
+  start = stats_now_ns();
+  generate_code_regexp(ctx, regexp, flags, mode);
+  stats_add_phase(STATS_CODE_GENERATION, start);
 
-  // Now go creating
-  for (;;)
+  start = stats_now_ns();
+  if (jit_cache_store(cache, ctx, regexp, flags, profile, mode, &matcher) == 0)
   {
-    if (regexp[0] == '\0')
-    {
-      gcc_jit_block_end_with_jump(
-          current_block, /* loc */ NULL,
-          return_one);
-      break; // We are done
-    }
-    else if (regexp[1] == '*')
-    {
-      // Generate code for the remaining regular expression
-      gcc_jit_function *remaining_regexp_match = generate_code_matchhere(ctx, regexp + 2, new_function_name());
-
-      gcc_jit_block* loop_body = gcc_jit_function_new_block(matchhere, new_block_name());
-      gcc_jit_block* loop_check = gcc_jit_function_new_block(matchhere, new_block_name());
-
-      gcc_jit_block_end_with_jump(current_block, /* loc */ NULL, loop_body);
-
-      gcc_jit_rvalue* args[] = { rval_text };
-      gcc_jit_rvalue* match_remainder = 
-        gcc_jit_context_new_comparison(
-            ctx, /* loc */ NULL,
-            GCC_JIT_COMPARISON_NE,
-            gcc_jit_context_new_call(ctx, /* loc */ NULL,
-              remaining_regexp_match, 1, args),
-            gcc_jit_context_zero(ctx, int_type));
-
-      gcc_jit_block_end_with_conditional(loop_body, /* loc */ NULL,
-          match_remainder,
-          return_one,
-          loop_check);
-
-      gcc_jit_lvalue* tmp = gcc_jit_function_new_local(matchhere, /* loc */ NULL, char_type, new_local_name());
-      gcc_jit_block_add_assignment(
-          loop_check, /* loc */ NULL,
-          tmp,
-          gcc_jit_lvalue_as_rvalue(
-            gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)));
-
-      gcc_jit_rvalue* check_expr;
-      if (regexp[0] == '.')
-      {
-        check_expr =
-          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-              GCC_JIT_COMPARISON_NE,
-              gcc_jit_lvalue_as_rvalue(tmp),
-              gcc_jit_context_zero(ctx, char_type));
-      }
-      else
-      {
-        check_expr =
-          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-              GCC_JIT_COMPARISON_EQ,
-              gcc_jit_lvalue_as_rvalue(tmp),
-              gcc_jit_context_new_rvalue_from_int(ctx, char_type, regexp[0]));
-      }
-
-      generate_return_zero(ctx, matchhere, &return_zero);
-
-      gcc_jit_block_add_assignment(loop_check, /* loc */ NULL,
-          gcc_jit_param_as_lvalue(param_text),
-          text_plus_one);
-      gcc_jit_block_end_with_conditional(loop_check, /* loc */ NULL,
-          check_expr,
-          loop_body,
-          return_zero);
-
-      break; // We are done
-    }
-    else if (regexp[0] == '$' && regexp[1] == '\0')
-    {
-      gcc_jit_block_end_with_return(
-          current_block, /* loc */ NULL,
-          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-            GCC_JIT_COMPARISON_EQ, 
-            gcc_jit_lvalue_as_rvalue(
-              gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)
-              ),
-            gcc_jit_context_zero(ctx, char_type)));
-
-      regexp++;
-    }
-    else if (regexp[0] == '.')
-    {
-      generate_return_zero(ctx, matchhere, &return_zero);
-
-      gcc_jit_block* next_block = gcc_jit_function_new_block(matchhere, new_block_name());
-
-      // if (*text == '\0')
-      //    return 0;
-      gcc_jit_block_end_with_conditional(
-          current_block, /* loc */ NULL,
-          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-            GCC_JIT_COMPARISON_EQ, 
-            gcc_jit_lvalue_as_rvalue(
-              gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)
-              ),
-            gcc_jit_context_zero(ctx, char_type)),
-          return_zero,
-          next_block);
-
-      // text = &text[1]; // pointer arithmetic
-      gcc_jit_block_add_assignment(next_block, /* loc */ NULL,
-          gcc_jit_param_as_lvalue(param_text),
-          text_plus_one);
-
-      // Chain the code
-      current_block = next_block;
-
-      // Done with the current letter
-      regexp++;
-    }
-    else
-    {
-      generate_return_zero(ctx, matchhere, &return_zero);
-
-      gcc_jit_block* next_block = gcc_jit_function_new_block(matchhere, new_block_name());
-
-      // if (*text != regexp[0])
-      //    return 0;
-      gcc_jit_block_end_with_conditional(
-          current_block, /* loc */ NULL,
-          gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-            GCC_JIT_COMPARISON_NE, 
-            gcc_jit_lvalue_as_rvalue(
-              gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)
-              ),
-            gcc_jit_context_new_rvalue_from_int(ctx, char_type, regexp[0])),
-          return_zero,
-          next_block);
-
-      // text = &text[1]; // pointer arithmetic
-      gcc_jit_block_add_assignment(next_block, /* loc */ NULL,
-          gcc_jit_param_as_lvalue(param_text),
-          text_plus_one);
-
-      // Chain the code
-      current_block = next_block;
-
-      // Done with the current letter
-      regexp++;
-    }
+    stats_add_phase(STATS_COMPILATION, start);
+    gcc_jit_context_release(ctx);
+    return matcher;
   }
 
-  // char c[64];
-  // snprintf(c, 63, "%s.dot", function_name);
-  // c[63] = '\0';
+  gcc_jit_result *result = gcc_jit_context_compile(ctx);
+  stats_add_phase(STATS_COMPILATION, start);
+  if (result == NULL)
+    die("compilation failed");
 
-  // gcc_jit_function_dump_to_dot(matchhere, c);
+  start = stats_now_ns();
+  matcher.match = (match_fun_t)gcc_jit_result_get_code(result, "match");
+  matcher.scan = (scan_fun_t)gcc_jit_result_get_code(result, "scan");
+  stats_add_phase(STATS_GET_CODE, start);
+  if (matcher.match == NULL || matcher.scan == NULL)
+    die("error getting 'match'");
 
-  return matchhere;
+  return matcher;
 }
 
-void generate_code_regexp(gcc_jit_context *ctx, const char* regexp)
+// Returns the number of matching lines. The number of files that could not be
+// searched goes to 'errors'.
+static long long scan(const struct options *options, const struct matcher *matcher, int *errors)
 {
-  const char* matchhere_regexp = regexp;
-  if (regexp[0] == '^')
-  {
-    matchhere_regexp++;
-  }
-  gcc_jit_function* matchhere = generate_code_matchhere(ctx, matchhere_regexp, "matchhere");
-
-  // match function
-  gcc_jit_type *int_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_INT);
-  gcc_jit_type *char_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CHAR);
-  gcc_jit_type *const_char_ptr_type = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
-
-  gcc_jit_param *param_text = gcc_jit_context_new_param(ctx, /* loc */ NULL, const_char_ptr_type, "text");
-  gcc_jit_rvalue *rval_text = gcc_jit_param_as_rvalue(param_text);
+  double start = stats_now_ns();
 
-  gcc_jit_param* params[] = { param_text };
-  gcc_jit_function *match = gcc_jit_context_new_function(ctx, /* loc */ NULL,
-      GCC_JIT_FUNCTION_EXPORTED, int_type, "match",
-      1, params, /* is_variadic */ 0);
-
-  gcc_jit_rvalue* args[] = { rval_text };
-  gcc_jit_rvalue* call_to_matchhere = gcc_jit_context_new_call(ctx, /* loc */ NULL,
-      matchhere,
-      1, args);
-  if (regexp[0] == '^')
+  if (options->recursive || options->num_filenames > 1)
   {
-    gcc_jit_block* block = gcc_jit_function_new_block(match, new_block_name());
-
-    gcc_jit_block_end_with_return(
-        block, /* loc */ NULL,
-        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-          GCC_JIT_COMPARISON_NE, 
-          call_to_matchhere,
-          gcc_jit_context_zero(ctx, int_type)));
+    long long matched = grep_tree(options->filenames, options->num_filenames, options->recursive,
+        matcher, options->num_threads, &options->mode, options->io_backend, errors);
+    stats_add_phase(STATS_SCAN, start);
+    return matched;
   }
-  else
-  {
-    gcc_jit_block* loop_body = gcc_jit_function_new_block(match, new_block_name());
-    gcc_jit_block* return_one = gcc_jit_function_new_block(match, new_block_name());
-    gcc_jit_block* condition_check = gcc_jit_function_new_block(match, new_block_name());
-    gcc_jit_block* return_zero = gcc_jit_function_new_block(match, new_block_name());
 
-    gcc_jit_block_end_with_conditional(
-        loop_body, /* loc */ NULL,
-        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-          GCC_JIT_COMPARISON_NE, 
-          call_to_matchhere,
-          gcc_jit_context_zero(ctx, int_type)),
-        return_one,
-        condition_check);
-
-    gcc_jit_block_end_with_return(
-        return_one, /* loc */ NULL,
-        gcc_jit_context_one(ctx, int_type));
-
-    gcc_jit_lvalue* tmp = gcc_jit_function_new_local(match, /* loc */ NULL, char_type, new_local_name());
-    gcc_jit_block_add_assignment(
-        condition_check, /* loc */ NULL,
-        tmp,
-        gcc_jit_lvalue_as_rvalue(
-          gcc_jit_rvalue_dereference(rval_text, /* loc */ NULL)));
-    gcc_jit_block_add_assignment(
-        condition_check, /* loc */ NULL,
-        gcc_jit_param_as_lvalue(param_text),
-        gcc_jit_context_new_cast(
-          ctx, /* loc */ NULL,
-          gcc_jit_lvalue_get_address(
-            gcc_jit_context_new_array_access(
-              ctx, /* loc */ NULL,
-              rval_text,
-              gcc_jit_context_one(ctx, int_type)),
-            /* loc */ NULL),
-          const_char_ptr_type));
-    gcc_jit_block_end_with_conditional(
-        condition_check, /* loc */ NULL,
-        gcc_jit_context_new_comparison(ctx, /* loc */ NULL,
-          GCC_JIT_COMPARISON_NE, 
-          gcc_jit_lvalue_as_rvalue(tmp),
-          gcc_jit_context_zero(ctx, char_type)),
-        loop_body,
-        return_zero);
-
-    gcc_jit_block_end_with_return(
-        return_zero, /* loc */ NULL,
-        gcc_jit_context_zero(ctx, int_type));
-  }
-  // gcc_jit_function_dump_to_dot(match, "match.dot");
-
-  // gcc_jit_context_dump_to_file(ctx, "generated-regex.dump", /* update-locations */ 1);
-  // gcc_jit_context_set_bool_option(ctx, GCC_JIT_BOOL_OPTION_DEBUGINFO, 1);
-}
-
-int main(int argc, char *argv[])
-{
-  if (argc != 3)
+  // Regular files are scanned in place unless --io says otherwise; anything
+  // else (pipes, character devices, ...) is read through a ring of buffers
+  const char *filename = options->filenames[0];
+  const char *name = input_display_name(filename);
+  *errors = 0;
+  struct input_map map;
+  if (input_uses_mmap(options->io_backend) && input_map_open(&map, filename) == 0)
   {
-    fprintf(stderr, "usage: %s regex filename\n", argv[0]);
-    exit(EXIT_FAILURE);
+    long long matched = grep_mapped(&map, name, matcher, options->num_threads, &options->mode);
+    input_map_close(&map);
+    stats_add_phase(STATS_SCAN, start);
+    return matched;
   }
 
-  const char* regexp = argv[1];
-
-  gcc_jit_context *ctx;
-  ctx = gcc_jit_context_acquire ();
-  if (ctx == NULL)
-    die("acquired context is NULL");
-
-  gcc_jit_context_set_int_option(ctx, GCC_JIT_INT_OPTION_OPTIMIZATION_LEVEL, 2);
-
-  generate_code_regexp(ctx, regexp);
-
-  gcc_jit_result *result = gcc_jit_context_compile(ctx);
-  if (result == NULL)
-    die("compilation failed");
-
-  void *function_addr = gcc_jit_result_get_code(result, "match");
-  if (function_addr == NULL)
-    die("error getting 'match'");
-
-  typedef int (*match_fun_t)(const char*);
-  match_fun_t match = (match_fun_t)function_addr;
-
-  FILE *f = fopen(argv[2], "r");
-  if (f == NULL)
+  struct input_reader reader;
+  if (input_reader_open(&reader, filename, options->io_backend) != 0)
   {
     fprintf(stderr, "error opening file '%s': %s\n",
-        argv[2],
+        filename,
         strerror(errno));
     exit(EXIT_FAILURE);
   }
 
-  char* line = NULL;
-  size_t length = 0;
+  long long matched = grep_stream(&reader, name, matcher, options->num_threads, &options->mode);
 
-  while (getline(&line, &length, f) != -1)
-  {
-    if (match(line))
-      fprintf(stdout, "%s", line);
-  }
-
-  free(line);
-  fclose(f);
+  stats_add_phase(STATS_SCAN, start);
+  return matched;
+}
 
-  return 0;
+int main(int argc, char *argv[])
+{
+  struct options options;
+  parse_options(argc, argv, &options);
+  // As in grep, empty -f files give no pattern, which matches no line
+  if (options.no_patterns)
+    return EXIT_FAILURE;
+
+  const char* regexp = options.regexp;
+  stats_init(options.stats);
+  stats_set_io(input_backend_name(options.io_backend));
+  char profile_name[128];
+  stats_set_profile(codegen_profile_name(&options.profile, profile_name, sizeof(profile_name)));
+
+  struct jit_cache cache;
+  jit_cache_init(&cache, options.use_cache, options.cache_report);
+
+  struct matcher matcher = compile_match(&cache, regexp, options.regexp_flags,
+      &options.profile, options.codegen_mode);
+
+  if (options.cache_report)
+    jit_cache_print_report(&cache);
+
+  int errors;
+  long long matched = scan(&options, &matcher, &errors);
+
+  stats_print("jgrep-jit", regexp);
+  // -q tells whether anything matched, even if some files could not be read
+  if (options.mode.output == SCAN_QUIET)
+    return matched > 0 ? 0 : EXIT_FAILURE;
+  return errors == 0 ? 0 : EXIT_FAILURE;
 }
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libgccjit.h>
+
+#include "jgrep.h"
+#include "jgrep-codegen.h"
+#include "jgrep-interp.h"
+#include "jgrep-regexp.h"
+
+_Static_assert((int)JGREP_IGNORE_CASE == (int)RE_IGNORE_CASE, "the flags of jgrep.h are those of re_parse");
+
+struct jgrep_matcher
+{
+  // The JIT'd code, or NULL with the interpreter
+  gcc_jit_result *result;
+  match_fun_t match;
+  scan_fun_t scan;
+  // The parsed regexp, for the interpreter
+  struct re_list patterns;
+};
+
+// The parent of the contexts of the matchers, built on first use and kept for
+// the life of the process. Its ctx stays NULL if it cannot be built.
+static struct codegen_parent parent;
+static pthread_once_t parent_once = PTHREAD_ONCE_INIT;
+// libgccjit records in the parent what its children ask of it: a type from
+// gcc_jit_context_get_type on a child is made and cached by the parent, and so
+// are the types derived from it, such as the const char of an access through a
+// const char *. Compiling a child also walks the parent. Children are
+// therefore built and compiled one at a time, under this lock.
+static pthread_mutex_t parent_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// How every matcher is compiled
+static const struct codegen_profile profile = CODEGEN_PROFILE_DEFAULT;
+
+// Nanoseconds spent by every thread building code and in
+// gcc_jit_context_compile (see jgrep_compile_times)
+static atomic_llong codegen_ns, compile_ns;
+
+static long long now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void parent_init(void)
+{
+  gcc_jit_context *ctx = gcc_jit_context_acquire();
+  if (ctx == NULL)
+    return;
+  codegen_set_profile(ctx, &profile);
+  codegen_parent_init(&parent, ctx);
+}
+
+static int compile(struct jgrep_matcher *matcher, const char *regexp, int flags,
+    int own_context, const char **error)
+{
+  if (!own_context)
+    pthread_once(&parent_once, parent_init);
+
+  int child = !own_context && parent.ctx != NULL;
+  gcc_jit_context *ctx;
+  if (child)
+  {
+    pthread_mutex_lock(&parent_lock);
+    ctx = gcc_jit_context_new_child_context(parent.ctx);
+  }
+  else
+  {
+    ctx = gcc_jit_context_acquire();
+    if (ctx != NULL)
+      codegen_set_profile(ctx, &profile);
+  }
+  if (ctx == NULL)
+  {
+    if (child)
+      pthread_mutex_unlock(&parent_lock);
+    *error = "cannot acquire a libgccjit context";
+    return -1;
+  }
+
+  long long start = now_ns();
+  generate_code_regexp_child(ctx, child ? &parent : NULL, regexp, flags, CODEGEN_AUTO);
+  long long generated = now_ns();
+  atomic_fetch_add(&codegen_ns, generated - start);
+
+  matcher->result = gcc_jit_context_compile(ctx);
+  atomic_fetch_add(&compile_ns, now_ns() - generated);
+  gcc_jit_context_release(ctx);
+  if (child)
+    pthread_mutex_unlock(&parent_lock);
+  if (matcher->result == NULL)
+  {
+    *error = "compilation failed";
+    return -1;
+  }
+
+  matcher->match = (match_fun_t)gcc_jit_result_get_code(matcher->result, "match");
+  matcher->scan = (scan_fun_t)gcc_jit_result_get_code(matcher->result, "scan");
+  if (matcher->match == NULL || matcher->scan == NULL)
+  {
+    *error = "the compiled code has no 'match' or 'scan'";
+    return -1;
+  }
+  return 0;
+}
+
+struct jgrep_matcher *jgrep_compile(const char *regexp, int flags, const char **error)
+{
+  const char *ignored;
+  if (error == NULL)
+    error = &ignored;
+
+  struct jgrep_matcher *matcher = calloc(1, sizeof(*matcher));
+  if (matcher == NULL)
+  {
+    *error = "out of memory";
+    return NULL;
+  }
+
+  if (re_parse_list(&matcher->patterns, regexp, flags & RE_IGNORE_CASE, error) != 0)
+  {
+    free(matcher);
+    return NULL;
+  }
+
+  if (!(flags & JGREP_INTERPRET)
+      && compile(matcher, regexp, flags & RE_IGNORE_CASE, flags & JGREP_OWN_CONTEXT, error) != 0)
+  {
+    jgrep_free(matcher);
+    return NULL;
+  }
+  return matcher;
+}
+
+// The regexps of jgrep_compile_all, taken one at a time by every thread
+struct compile_pool
+{
+  const char *const *regexps;
+  int num_regexps;
+  int flags;
+  struct jgrep_matcher **matchers;
+  const char **errors;
+  atomic_int next;
+  atomic_int num_failed;
+};
+
+static void *compile_pool_run(void *info)
+{
+  struct compile_pool *pool = info;
+  int i;
+  while ((i = atomic_fetch_add(&pool->next, 1)) < pool->num_regexps)
+  {
+    const char *error = NULL;
+    pool->matchers[i] = jgrep_compile(pool->regexps[i], pool->flags, &error);
+    if (pool->matchers[i] == NULL)
+      atomic_fetch_add(&pool->num_failed, 1);
+    if (pool->errors != NULL)
+      pool->errors[i] = error;
+  }
+  return NULL;
+}
+
+int jgrep_compile_all(const char *const *regexps, int num_regexps, int flags, int num_threads,
+    struct jgrep_matcher **matchers, const char **errors)
+{
+  struct compile_pool pool = {
+    .regexps = regexps,
+    .num_regexps = num_regexps,
+    .flags = flags,
+    .matchers = matchers,
+    .errors = errors,
+  };
+  atomic_init(&pool.next, 0);
+  atomic_init(&pool.num_failed, 0);
+
+  if (num_threads <= 0)
+  {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = n > 0 ? n : 1;
+  }
+  if (num_threads > num_regexps)
+    num_threads = num_regexps;
+
+  // The calling thread is one of them. Without more the regexps are still
+  // compiled, only serially.
+  pthread_t *threads = calloc(num_threads, sizeof(*threads));
+  int num_started = 0;
+  for (int i = 1; threads != NULL && i < num_threads; i++)
+  {
+    if (pthread_create(&threads[num_started], NULL, compile_pool_run, &pool) != 0)
+      break;
+    num_started++;
+  }
+  compile_pool_run(&pool);
+  for (int i = 0; i < num_started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  return atomic_load(&pool.num_failed);
+}
+
+void jgrep_compile_times(double *codegen_seconds, double *compile_seconds)
+{
+  *codegen_seconds = atomic_load(&codegen_ns) / 1e9;
+  *compile_seconds = atomic_load(&compile_ns) / 1e9;
+}
+
+long jgrep_exec(const struct jgrep_matcher *matcher, const char *begin, const char *end,
+    const char **hits, long max_hits, const char **next)
+{
+  if (matcher->scan != NULL)
+    return matcher->scan(begin, end, hits, max_hits, next);
+
+  long num_hits = 0;
+  const char *line = begin;
+  while (line < end && num_hits < max_hits)
+  {
+    const char *eol = memchr(line, '\n', end - line);
+    if (interp_match(&matcher->patterns, line, eol != NULL ? eol : end))
+      hits[num_hits++] = line;
+    line = eol != NULL ? eol + 1 : end;
+  }
+  *next = line;
+  return num_hits;
+}
+
+int jgrep_match(const struct jgrep_matcher *matcher, const char *begin, const char *end)
+{
+  if (matcher->match != NULL)
+    return matcher->match(begin, end);
+  return interp_match(&matcher->patterns, begin, end);
+}
+
+void jgrep_free(struct jgrep_matcher *matcher)
+{
+  if (matcher == NULL)
+    return;
+  if (matcher->result != NULL)
+    gcc_jit_result_release(matcher->result);
+  re_list_free(&matcher->patterns);
+  free(matcher);
+}
@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "jgrep-options.h"
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-r] [-i] [-q | -l | -c] [-m num] [-A num] [-B num] [-C num] [-j threads] [--verbose] [-O level] [--march=cpu] [--jit=when] [--codegen=mode] [--io=backend] [--no-cache] [--cache-report] [--stats] regex [file...]\n", prog);
+  fprintf(stderr, "       %s [options] -f patterns [file...]\n", prog);
+  fprintf(stderr, "  -f patterns      match any of the regexps of this file, one per line;\n");
+  fprintf(stderr, "                   several -f add up their patterns\n");
+  fprintf(stderr, "  file             \"-\", or none, reads the standard input\n");
+  fprintf(stderr, "  -r, --recursive  search the files in directories\n");
+  fprintf(stderr, "  -i, --ignore-case\n");
+  fprintf(stderr, "                   match ASCII letters in either case\n");
+  fprintf(stderr, "  -q, --quiet      write nothing, exit with 0 at the first match\n");
+  fprintf(stderr, "  -l, --files-with-matches\n");
+  fprintf(stderr, "                   write the names of the files that match\n");
+  fprintf(stderr, "  -c, --count      write the number of matching lines of each file\n");
+  fprintf(stderr, "  -m, --max-count num\n");
+  fprintf(stderr, "                   stop reading a file after num matching lines\n");
+  fprintf(stderr, "  -A, --after-context num\n");
+  fprintf(stderr, "                   also write the num lines after each matching line\n");
+  fprintf(stderr, "  -B, --before-context num\n");
+  fprintf(stderr, "                   also write the num lines before each matching line\n");
+  fprintf(stderr, "  -C, --context num\n");
+  fprintf(stderr, "                   same as -A num -B num\n");
+  fprintf(stderr, "  -j threads       scan with this many threads (0: one per CPU)\n");
+  fprintf(stderr, "  --verbose        report how the run went on stderr\n");
+  fprintf(stderr, "  -O, --optimize level\n");
+  fprintf(stderr, "                   optimization level of the JIT'd matcher, 0 to 3 (default 2)\n");
+  fprintf(stderr, "  --march=cpu      compile the JIT'd matcher for this CPU, as gcc's -march\n");
+  fprintf(stderr, "                   (e.g. native)\n");
+  fprintf(stderr, "  --jit=when       auto (default), never, background or blocking\n");
+  fprintf(stderr, "  --codegen=mode   auto (default: a DFA when small enough), backtrack or calls\n");
+  fprintf(stderr, "  --io=backend     how files are read: auto (default: mmap, read() for small\n");
+  fprintf(stderr, "                   files of a tree), mmap, read, direct (O_DIRECT) or uring\n");
+  fprintf(stderr, "  --no-cache       always compile the matcher, do not use the cache\n");
+  fprintf(stderr, "  --cache-report   report cache hits and misses on stderr\n");
+  fprintf(stderr, "  --stats          print the time of each phase and what was scanned as JSON on stderr\n");
+  exit(EXIT_FAILURE);
+}
+
+static int parse_int(const char *prog, const char *s)
+{
+  char *end;
+  long n = strtol(s, &end, 10);
+  if (*s == '\0' || *end != '\0' || n < 0 || n > 4096)
+    usage(prog);
+  return (int)n;
+}
+
+static long long parse_count(const char *prog, const char *s)
+{
+  char *end;
+  errno = 0;
+  long long n = strtoll(s, &end, 10);
+  if (*s == '\0' || *end != '\0' || n < 0 || errno != 0)
+    usage(prog);
+  return n;
+}
+
+// The lines of 'path' joined by '\n', which separates patterns in a regexp.
+// The final newline is dropped. NULL if the file is empty: it has no
+// pattern, unlike a file of one empty line, whose empty pattern matches
+// every line.
+static char *read_patterns(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+  {
+    fprintf(stderr, "jgrep: cannot open '%s'\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  size_t length = 0, capacity = 4096;
+  char *patterns = malloc(capacity);
+  size_t n;
+  while (patterns != NULL && (n = fread(patterns + length, 1, capacity - length - 1, f)) > 0)
+  {
+    length += n;
+    if (capacity - length - 1 == 0)
+    {
+      capacity *= 2;
+      patterns = realloc(patterns, capacity);
+    }
+  }
+  if (patterns == NULL || ferror(f))
+  {
+    fprintf(stderr, "jgrep: cannot read '%s'\n", path);
+    exit(EXIT_FAILURE);
+  }
+  fclose(f);
+
+  if (length == 0)
+  {
+    free(patterns);
+    return NULL;
+  }
+  if (patterns[length - 1] == '\n')
+    length--;
+  patterns[length] = '\0';
+  return patterns;
+}
+
+// 'list' and 'patterns', both from read_patterns, joined as the lines of one
+// file, as grep does with several -f
+static char *join_patterns(char *list, char *patterns)
+{
+  if (list == NULL || patterns == NULL)
+    return list != NULL ? list : patterns;
+
+  size_t length = strlen(list);
+  char *joined = realloc(list, length + 1 + strlen(patterns) + 1);
+  if (joined == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  joined[length] = '\n';
+  strcpy(joined + length + 1, patterns);
+  free(patterns);
+  return joined;
+}
+
+static enum jit_strategy parse_jit_strategy(const char *prog, const char *s)
+{
+  if (strcmp(s, "auto") == 0)
+    return JIT_AUTO;
+  if (strcmp(s, "never") == 0)
+    return JIT_NEVER;
+  if (strcmp(s, "background") == 0)
+    return JIT_BACKGROUND;
+  if (strcmp(s, "blocking") == 0)
+    return JIT_BLOCKING;
+  usage(prog);
+  return JIT_AUTO;
+}
+
+static enum codegen_mode parse_codegen_mode(const char *prog, const char *s)
+{
+  if (strcmp(s, "auto") == 0)
+    return CODEGEN_AUTO;
+  if (strcmp(s, "backtrack") == 0)
+    return CODEGEN_BACKTRACK;
+  if (strcmp(s, "calls") == 0)
+    return CODEGEN_CALLS;
+  usage(prog);
+  return CODEGEN_AUTO;
+}
+
+static enum input_backend parse_io_backend(const char *prog, const char *s)
+{
+  if (strcmp(s, "auto") == 0)
+    return INPUT_AUTO;
+  if (strcmp(s, "mmap") == 0)
+    return INPUT_MMAP;
+  if (strcmp(s, "read") == 0)
+    return INPUT_READ;
+  if (strcmp(s, "direct") == 0)
+    return INPUT_DIRECT;
+  if (strcmp(s, "uring") == 0)
+    return INPUT_URING;
+  usage(prog);
+  return INPUT_AUTO;
+}
+
+void parse_options(int argc, char *argv[], struct options *options)
+{
+  enum { OPT_NO_CACHE = 256, OPT_CACHE_REPORT, OPT_JIT, OPT_CODEGEN, OPT_IO, OPT_STATS,
+    OPT_MARCH, OPT_VERBOSE };
+  static const struct option long_options[] = {
+    { "verbose", no_argument, NULL, OPT_VERBOSE },
+    { "recursive", no_argument, NULL, 'r' },
+    { "quiet", no_argument, NULL, 'q' },
+    { "ignore-case", no_argument, NULL, 'i' },
+    { "files-with-matches", no_argument, NULL, 'l' },
+    { "count", no_argument, NULL, 'c' },
+    { "max-count", required_argument, NULL, 'm' },
+    { "after-context", required_argument, NULL, 'A' },
+    { "before-context", required_argument, NULL, 'B' },
+    { "context", required_argument, NULL, 'C' },
+    { "optimize", required_argument, NULL, 'O' },
+    { "march", required_argument, NULL, OPT_MARCH },
+    { "jit", required_argument, NULL, OPT_JIT },
+    { "codegen", required_argument, NULL, OPT_CODEGEN },
+    { "io", required_argument, NULL, OPT_IO },
+    { "no-cache", no_argument, NULL, OPT_NO_CACHE },
+    { "cache-report", no_argument, NULL, OPT_CACHE_REPORT },
+    { "stats", no_argument, NULL, OPT_STATS },
+    { NULL, 0, NULL, 0 },
+  };
+
+  options->regexp = NULL;
+  options->no_patterns = 0;
+  options->regexp_flags = 0;
+  options->recursive = 0;
+  options->mode.output = SCAN_LINES;
+  options->mode.max_count = -1;
+  options->mode.before = -1;
+  options->mode.after = -1;
+  options->num_threads = 1;
+  options->verbose = 0;
+  options->jit_strategy = JIT_AUTO;
+  options->codegen_mode = CODEGEN_AUTO;
+  options->profile = (struct codegen_profile)CODEGEN_PROFILE_DEFAULT;
+  options->io_backend = INPUT_AUTO;
+  options->use_cache = 1;
+  options->cache_report = 0;
+  options->stats = 0;
+
+  // As in grep, -A and -B win over -C whatever their order
+  long long context = -1;
+
+  // The patterns of -f, if any
+  int patterns_files = 0;
+  char *patterns = NULL;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "A:B:C:cf:ij:lm:qrO:", long_options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'f':
+        patterns = join_patterns(patterns, read_patterns(optarg));
+        patterns_files++;
+        break;
+      case 'i':
+        options->regexp_flags |= RE_IGNORE_CASE;
+        break;
+      case 'j':
+        options->num_threads = parse_int(argv[0], optarg);
+        if (options->num_threads == 0)
+        {
+          long n = sysconf(_SC_NPROCESSORS_ONLN);
+          options->num_threads = n > 0 ? n : 1;
+        }
+        break;
+      case 'r':
+        options->recursive = 1;
+        break;
+      // As in grep, -q wins over -l, which wins over -c
+      case 'q':
+        options->mode.output = SCAN_QUIET;
+        break;
+      case 'l':
+        if (options->mode.output != SCAN_QUIET)
+          options->mode.output = SCAN_FILE_NAMES;
+        break;
+      case 'c':
+        if (options->mode.output == SCAN_LINES)
+          options->mode.output = SCAN_COUNT;
+        break;
+      case 'm':
+        options->mode.max_count = parse_count(argv[0], optarg);
+        break;
+      case 'A':
+        options->mode.after = parse_count(argv[0], optarg);
+        break;
+      case 'B':
+        options->mode.before = parse_count(argv[0], optarg);
+        break;
+      case 'C':
+        context = parse_count(argv[0], optarg);
+        break;
+      case OPT_VERBOSE:
+        options->verbose = 1;
+        break;
+      case 'O':
+        options->profile.opt_level = parse_int(argv[0], optarg);
+        if (options->profile.opt_level > 3)
+          usage(argv[0]);
+        break;
+      case OPT_MARCH:
+        if (*optarg == '\0' || strlen(optarg) > 64)
+          usage(argv[0]);
+        options->profile.march = optarg;
+        break;
+      case OPT_JIT:
+        options->jit_strategy = parse_jit_strategy(argv[0], optarg);
+        break;
+      case OPT_CODEGEN:
+        options->codegen_mode = parse_codegen_mode(argv[0], optarg);
+        break;
+      case OPT_IO:
+        options->io_backend = parse_io_backend(argv[0], optarg);
+        break;
+      case OPT_NO_CACHE:
+        options->use_cache = 0;
+        break;
+      case OPT_CACHE_REPORT:
+        options->cache_report = 1;
+        break;
+      case OPT_STATS:
+        options->stats = 1;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if (options->mode.after < 0)
+    options->mode.after = context;
+  if (options->mode.before < 0)
+    options->mode.before = context;
+
+  if (patterns_files > 0)
+  {
+    options->regexp = patterns;
+    options->no_patterns = patterns == NULL;
+  }
+  else
+  {
+    if (optind == argc)
+      usage(argv[0]);
+    options->regexp = argv[optind++];
+  }
+
+  const char *error;
+  if (options->no_patterns)
+    memset(&options->patterns, 0, sizeof(options->patterns));
+  else if (re_parse_list(&options->patterns, options->regexp, options->regexp_flags, &error) != 0)
+  {
+    fprintf(stderr, "jgrep: %s in the regexp\n", error);
+    exit(EXIT_FAILURE);
+  }
+
+  // As in grep, no file is the standard input
+  static char *standard_input[] = { INPUT_STDIN_NAME };
+  options->filenames = argv + optind;
+  options->num_filenames = argc - optind;
+  if (options->num_filenames == 0)
+  {
+    options->filenames = standard_input;
+    options->num_filenames = 1;
+  }
+}
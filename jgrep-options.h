@@ -0,0 +1,57 @@
+#ifndef JGREP_OPTIONS_H
+#define JGREP_OPTIONS_H
+
+#include "jgrep-codegen.h"
+#include "jgrep-costs.h"
+#include "jgrep-input.h"
+#include "jgrep-regexp.h"
+#include "jgrep-scan.h"
+
+// Command line shared by all jgrep programs:
+//
+//   prog [-r] [-i] [-q | -l | -c] [-m num] [-A num] [-B num] [-C num] [-j threads] [--verbose] [-O level] [--march=cpu] [--jit=when] [--codegen=mode] [--io=backend] [--no-cache] [--cache-report] [--stats] regex [file...]
+//   prog [options] -f patterns [-f patterns...] [file...]
+struct options
+{
+  // With -f, the lines of the patterns files joined by '\n'. NULL if they
+  // are all empty.
+  const char *regexp;
+  // -f gave no pattern at all, so that no line matches: the programs exit
+  // with 1 without reading their input, as grep does
+  int no_patterns;
+  // RE_IGNORE_CASE with -i
+  int regexp_flags;
+  // The regexp, parsed with regexp_flags
+  struct re_list patterns;
+  // At least one: INPUT_STDIN_NAME if the command line has none
+  char **filenames;
+  int num_filenames;
+  // Search the files in directories (see jgrep-walk.h)
+  int recursive;
+  // What is written for each file (-q, -l, -c), where its scan stops (-m) and
+  // the lines written around the matching ones (-A, -B, -C)
+  struct scan_mode mode;
+  // Threads scanning chunks of the input. 1 scans serially.
+  int num_threads;
+  // Report on stderr how the run went (e.g. the lines run by each JIT tier)
+  int verbose;
+  // When jgrep-concurrent compiles the regexp, JIT_AUTO by default
+  enum jit_strategy jit_strategy;
+  // How the JIT'd matcher is generated, CODEGEN_AUTO by default
+  enum codegen_mode codegen_mode;
+  // How it is compiled, CODEGEN_PROFILE_DEFAULT by default
+  struct codegen_profile profile;
+  // How the files are read, INPUT_AUTO by default
+  enum input_backend io_backend;
+  // Compiled matchers are kept in the cache of jgrep-cache.h
+  int use_cache;
+  // Report cache hits and misses on stderr
+  int cache_report;
+  // Print the stats of jgrep-stats.h on stderr
+  int stats;
+};
+
+// Fills 'options' from the command line. Prints the usage and exits on errors.
+void parse_options(int argc, char *argv[], struct options *options);
+
+#endif // JGREP_OPTIONS_H
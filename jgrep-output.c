@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+
+#include "jgrep-output.h"
+
+// Copied lines are flushed when this much is pending
+enum { OUTPUT_BUFFER_SIZE = 256 * 1024 };
+
+static const char separator[] = "--\n";
+
+void output_init(struct output *out, int fd)
+{
+  out->fd = fd;
+  out->num_iov = 0;
+  out->buffer = NULL;
+  out->buffer_size = 0;
+  out->buffer_capacity = 0;
+  out->lock = NULL;
+  out->locked = 0;
+  out->own_started = 0;
+  out->started = &out->own_started;
+}
+
+void output_init_shared(struct output *out, int fd, pthread_mutex_t *lock, int *started)
+{
+  output_init(out, fd);
+  out->lock = lock;
+  out->started = started;
+}
+
+static void write_error(void)
+{
+  fprintf(stderr, "jgrep: write error: %s\n", strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+void output_flush(struct output *out)
+{
+  struct iovec *iov = out->iov;
+  int num_iov = out->num_iov;
+
+  if (num_iov > 0 && out->lock != NULL && !out->locked)
+  {
+    pthread_mutex_lock(out->lock);
+    out->locked = 1;
+  }
+
+  if (num_iov > 0 && !*out->started)
+  {
+    if (iov->iov_base == separator)
+    {
+      iov++;
+      num_iov--;
+    }
+    *out->started = num_iov > 0;
+  }
+
+  while (num_iov > 0)
+  {
+    ssize_t n = writev(out->fd, iov, num_iov);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      write_error();
+    }
+
+    // Skip what was written, which may end in the middle of an iovec
+    while (num_iov > 0 && (size_t)n >= iov->iov_len)
+    {
+      n -= iov->iov_len;
+      iov++;
+      num_iov--;
+    }
+    if (num_iov > 0)
+    {
+      iov->iov_base = (char*)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  out->num_iov = 0;
+  out->buffer_size = 0;
+}
+
+void output_reference(struct output *out, const char *data, size_t length)
+{
+  if (length == 0)
+    return;
+
+  // A hit on the line right after the previous one extends its iovec
+  if (out->num_iov > 0)
+  {
+    struct iovec *last = &out->iov[out->num_iov - 1];
+    if ((const char*)last->iov_base + last->iov_len == data && last->iov_base != separator)
+    {
+      last->iov_len += length;
+      return;
+    }
+  }
+
+  if (out->num_iov == OUTPUT_MAX_IOVECS)
+    output_flush(out);
+
+  out->iov[out->num_iov].iov_base = (void*)data;
+  out->iov[out->num_iov].iov_len = length;
+  out->num_iov++;
+}
+
+void output_separator(struct output *out)
+{
+  if (out->num_iov == OUTPUT_MAX_IOVECS)
+    output_flush(out);
+
+  // Never merged with a neighbour, so that a flush can tell it apart
+  out->iov[out->num_iov].iov_base = (void*)separator;
+  out->iov[out->num_iov].iov_len = sizeof(separator) - 1;
+  out->num_iov++;
+}
+
+void output_copy(struct output *out, const char *data, size_t length)
+{
+  if (out->buffer == NULL)
+  {
+    out->buffer = malloc(OUTPUT_BUFFER_SIZE);
+    if (out->buffer == NULL)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    out->buffer_capacity = OUTPUT_BUFFER_SIZE;
+  }
+
+  if (out->buffer_size + length > out->buffer_capacity || out->num_iov == OUTPUT_MAX_IOVECS)
+    output_flush(out);
+
+  if (length > out->buffer_capacity)
+  {
+    // Too long to be worth copying, write it now
+    output_reference(out, data, length);
+    output_flush(out);
+    return;
+  }
+
+  memcpy(out->buffer + out->buffer_size, data, length);
+  output_reference(out, out->buffer + out->buffer_size, length);
+  out->buffer_size += length;
+}
+
+void output_end_file(struct output *out)
+{
+  if (!out->locked)
+    return;
+
+  output_flush(out);
+  pthread_mutex_unlock(out->lock);
+  out->locked = 0;
+}
+
+void output_close(struct output *out)
+{
+  output_flush(out);
+  output_end_file(out);
+  free(out->buffer);
+  out->buffer = NULL;
+  out->buffer_capacity = 0;
+}
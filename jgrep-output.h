@@ -0,0 +1,67 @@
+#ifndef JGREP_OUTPUT_H
+#define JGREP_OUTPUT_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+// Batches the hits written to a file descriptor and writes them with a single
+// writev per batch, instead of a call (and a copy into the stdio buffer) per
+// line.
+//
+// Lines of a mapped input are referenced in place: the batch holds iovecs
+// pointing into the mapping, and hits on consecutive lines share one iovec.
+// Lines that do not outlive the call (e.g. read with getline) are copied
+// into a buffer of the output instead.
+enum { OUTPUT_MAX_IOVECS = 1024 };
+
+struct output
+{
+  int fd;
+  struct iovec iov[OUTPUT_MAX_IOVECS];
+  int num_iov;
+  // Copied lines
+  char *buffer;
+  size_t buffer_size;
+  size_t buffer_capacity;
+  // Serializes the outputs of several threads to the same fd. NULL if the
+  // output is not shared.
+  pthread_mutex_t *lock;
+  int locked;
+  // Whether anything was written to fd yet, shared by the outputs that share
+  // 'lock'
+  int *started;
+  int own_started;
+};
+
+void output_init(struct output *out, int fd);
+
+// An output of one of several threads writing to 'fd', each with its own
+// output but all with the same 'lock'. Outputs of whole files never
+// interleave: once a flush has written part of a file, the lock is kept
+// until output_end_file. 'started' is shared by them all, and starts at 0.
+void output_init_shared(struct output *out, int fd, pthread_mutex_t *lock, int *started);
+
+// Queues [data, data + length), which must stay valid until the next flush
+void output_reference(struct output *out, const char *data, size_t length);
+
+// Queues a copy of [data, data + length)
+void output_copy(struct output *out, const char *data, size_t length);
+
+// Queues the "--" line that separates groups of context lines (see
+// context_write_hit). A separator at the very start of the fd is dropped when
+// flushed, so each file can start its first group with one, whichever file
+// comes out first.
+void output_separator(struct output *out);
+
+// Writes everything queued. Exits on write errors.
+void output_flush(struct output *out);
+
+// Marks the end of the hits of a file. If a flush wrote part of them, the
+// rest is written and the lock released; otherwise they may stay queued.
+void output_end_file(struct output *out);
+
+// Flushes and frees the buffer
+void output_close(struct output *out);
+
+#endif // JGREP_OUTPUT_H
@@ -0,0 +1,315 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jgrep-regexp.h"
+
+static const struct
+{
+  const char *name;
+  int (*has)(int c);
+} named_classes[] = {
+  { "alnum", isalnum },
+  { "alpha", isalpha },
+  { "blank", isblank },
+  { "cntrl", iscntrl },
+  { "digit", isdigit },
+  { "graph", isgraph },
+  { "lower", islower },
+  { "print", isprint },
+  { "punct", ispunct },
+  { "space", isspace },
+  { "upper", isupper },
+  { "xdigit", isxdigit },
+};
+
+static void set_add(uint8_t *set, int c)
+{
+  set[c / 8] |= 1 << (c % 8);
+}
+
+static int at_end(const char *regexp)
+{
+  return *regexp == '\0' || *regexp == '\n';
+}
+
+// Adds to 'set' the bytes of the class whose name starts at 'name', just
+// after "[:". Returns the byte after its ":]", or NULL if there is no such
+// class.
+static const char *parse_named_class(uint8_t *set, const char *name)
+{
+  for (size_t i = 0; i < sizeof(named_classes) / sizeof(named_classes[0]); i++)
+  {
+    size_t length = strlen(named_classes[i].name);
+    if (strncmp(name, named_classes[i].name, length) != 0
+        || name[length] != ':' || name[length + 1] != ']')
+      continue;
+
+    for (int c = 0; c < 256; c++)
+      if (named_classes[i].has(c))
+        set_add(set, c);
+    return name + length + 2;
+  }
+  return NULL;
+}
+
+// Adds the other case of every ASCII letter of 'set'
+static void fold_case(uint8_t *set)
+{
+  for (int c = 'a'; c <= 'z'; c++)
+  {
+    int upper = c - 'a' + 'A';
+    if ((set[c / 8] >> (c % 8)) & 1 || (set[upper / 8] >> (upper % 8)) & 1)
+    {
+      set_add(set, c);
+      set_add(set, upper);
+    }
+  }
+}
+
+// Parses the bracket expression that starts at 'regexp', just after its '['.
+// Returns the byte after its ']', or NULL if it is not valid. As in grep, case
+// is folded before a '^' takes the complement, so that with -i [^a] matches
+// neither a nor A.
+static const char *parse_class(uint8_t *set, const char *regexp, int flags,
+    const char **error)
+{
+  int negated = regexp[0] == '^';
+  if (negated)
+    regexp++;
+
+  // A ']' right after the '[' or the '[^' does not close the set
+  const char *first = regexp;
+  while (regexp == first || regexp[0] != ']')
+  {
+    if (at_end(regexp))
+    {
+      *error = "unmatched [";
+      return NULL;
+    }
+
+    if (regexp[0] == '[' && regexp[1] == ':')
+    {
+      regexp = parse_named_class(set, regexp + 2);
+      if (regexp == NULL)
+      {
+        *error = "invalid character class";
+        return NULL;
+      }
+      continue;
+    }
+
+    int low = (unsigned char)regexp[0];
+    int high = low;
+    regexp++;
+    if (regexp[0] == '-' && regexp[1] != ']' && !at_end(regexp + 1))
+    {
+      high = (unsigned char)regexp[1];
+      regexp += 2;
+      if (high < low)
+      {
+        *error = "invalid range end";
+        return NULL;
+      }
+    }
+    for (int c = low; c <= high; c++)
+      set_add(set, c);
+  }
+
+  if (flags & RE_IGNORE_CASE)
+    fold_case(set);
+  if (negated)
+    for (int i = 0; i < 32; i++)
+      set[i] = ~set[i];
+
+  return regexp + 1;
+}
+
+// Fills 'literal', 'folded' and 'any' from the set of 'atom', once '\n' is out
+// of it
+static void classify_atom(struct re_atom *atom)
+{
+  atom->set['\n' / 8] &= ~(1 << ('\n' % 8));
+
+  int count = 0;
+  int last = -1;
+  for (int c = 0; c < 256; c++)
+    if (re_atom_has(atom, c))
+    {
+      count++;
+      last = c;
+    }
+
+  // The lowercase letter comes last of its two cases
+  atom->literal = -1;
+  atom->folded = 0;
+  if (count == 1)
+  {
+    atom->literal = last;
+  }
+  else if (count == 2 && last >= 'a' && last <= 'z' && re_atom_has(atom, last - 'a' + 'A'))
+  {
+    atom->literal = last;
+    atom->folded = 1;
+  }
+  atom->any = count == 255;
+}
+
+const char *re_parse(struct re_pattern *pattern, const char *regexp, int flags,
+    const char **error)
+{
+  const char *ignored;
+  if (error == NULL)
+    error = &ignored;
+
+  memset(pattern, 0, sizeof(*pattern));
+
+  // "x+" takes two atoms, so this is enough for any pattern
+  size_t length = strcspn(regexp, "\n");
+  pattern->atoms = calloc(length + 1, sizeof(*pattern->atoms));
+  if (pattern->atoms == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pattern->anchored = regexp[0] == '^';
+  if (pattern->anchored)
+    regexp++;
+
+  while (!at_end(regexp))
+  {
+    if (regexp[0] == '$' && at_end(regexp + 1))
+    {
+      pattern->dollar = 1;
+      regexp++;
+      break;
+    }
+
+    struct re_atom *atom = &pattern->atoms[pattern->num_atoms++];
+    if (regexp[0] == '.')
+    {
+      memset(atom->set, 0xff, sizeof(atom->set));
+      regexp++;
+    }
+    else if (regexp[0] == '[')
+    {
+      regexp = parse_class(atom->set, regexp + 1, flags, error);
+      if (regexp == NULL)
+      {
+        re_pattern_free(pattern);
+        return NULL;
+      }
+    }
+    else
+    {
+      set_add(atom->set, (unsigned char)regexp[0]);
+      if (flags & RE_IGNORE_CASE)
+        fold_case(atom->set);
+      regexp++;
+    }
+    classify_atom(atom);
+
+    if (regexp[0] == '*')
+    {
+      atom->repeat = RE_STAR;
+      regexp++;
+    }
+    else if (regexp[0] == '?')
+    {
+      atom->repeat = RE_OPTIONAL;
+      regexp++;
+    }
+    else if (regexp[0] == '+')
+    {
+      pattern->atoms[pattern->num_atoms] = *atom;
+      pattern->atoms[pattern->num_atoms].repeat = RE_STAR;
+      pattern->num_atoms++;
+      regexp++;
+    }
+  }
+
+  return regexp;
+}
+
+void re_pattern_free(struct re_pattern *pattern)
+{
+  free(pattern->atoms);
+  memset(pattern, 0, sizeof(*pattern));
+}
+
+int re_parse_list(struct re_list *list, const char *regexp, int flags, const char **error)
+{
+  list->num_patterns = 1;
+  for (const char *p = regexp; *p != '\0'; p++)
+    list->num_patterns += *p == '\n';
+
+  list->patterns = calloc(list->num_patterns, sizeof(*list->patterns));
+  if (list->patterns == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < list->num_patterns; i++)
+  {
+    regexp = re_parse(&list->patterns[i], regexp, flags, error);
+    if (regexp == NULL)
+    {
+      re_list_free(list);
+      return -1;
+    }
+    regexp += *regexp == '\n';
+  }
+
+  return 0;
+}
+
+void re_list_free(struct re_list *list)
+{
+  for (int i = 0; i < list->num_patterns; i++)
+    re_pattern_free(&list->patterns[i]);
+  free(list->patterns);
+  memset(list, 0, sizeof(*list));
+}
+
+int re_skippable_prefix(const struct re_pattern *pattern)
+{
+  if (pattern->anchored)
+    return 0;
+
+  int n = 0;
+  while (n < pattern->num_atoms && pattern->atoms[n].repeat != RE_ONE)
+    n++;
+  return n;
+}
+
+int re_required_literal(const struct re_pattern *pattern, int *length)
+{
+  int best = 0, best_length = 0;
+  int run = 0, run_length = 0;
+
+  for (int i = 0; i < pattern->num_atoms; i++)
+  {
+    const struct re_atom *atom = &pattern->atoms[i];
+    if (atom->repeat == RE_ONE && atom->literal >= 0)
+    {
+      if (run_length == 0)
+        run = i;
+      run_length++;
+      if (run_length > best_length)
+      {
+        best = run;
+        best_length = run_length;
+      }
+    }
+    else
+    {
+      run_length = 0;
+    }
+  }
+
+  *length = best_length;
+  return best;
+}
@@ -0,0 +1,95 @@
+#ifndef JGREP_REGEXP_H
+#define JGREP_REGEXP_H
+
+#include <stdint.h>
+
+// The regexps of jgrep, parsed once for every engine. A pattern is a leading
+// '^', a sequence of atoms and a trailing '$', both optional. An atom is
+//
+//   c         the byte c
+//   .         any byte
+//   [set]     any byte of the set: bytes, ranges like a-z and classes like
+//             [:digit:]. A ']' right after the '[' or '[^' is a byte of the
+//             set, and so is a '-' at either end.
+//   [^set]    any byte not in the set
+//
+// followed by at most one of '*' (zero or more), '+' (one or more) or '?'
+// (zero or one). Elsewhere '^', '$', '*', '+' and '?' are plain bytes. As in
+// grep, a '\n' separates patterns and a line matches if any of them matches.
+//
+// Every atom is a 256-bit table of the bytes it matches, so that the engines
+// test any atom with a single lookup. No atom matches '\n', which ends the
+// line. "x+" is parsed as "xx*", so the engines only see three repetitions.
+//
+// With RE_IGNORE_CASE every ASCII letter in a set brings its other case in,
+// before a '^' takes the complement, so the engines need nothing else to
+// ignore case.
+
+enum
+{
+  RE_IGNORE_CASE = 1, // -i
+};
+
+enum re_repeat
+{
+  RE_ONE,
+  RE_STAR,
+  RE_OPTIONAL,
+};
+
+struct re_atom
+{
+  uint8_t set[32];     // Bit c % 8 of set[c / 8] for each byte c matched
+  // The only byte matched, or with 'folded' a lowercase letter matched in
+  // either case, or -1. Either way the atom is a literal: it stands for one
+  // char of the text.
+  int literal;
+  int folded;
+  int any;             // Matches every byte but '\n'
+  enum re_repeat repeat;
+};
+
+struct re_pattern
+{
+  int anchored;        // Leading '^'
+  int dollar;          // Trailing '$'
+  int num_atoms;
+  struct re_atom *atoms;
+};
+
+struct re_list
+{
+  int num_patterns;
+  struct re_pattern *patterns;
+};
+
+static inline int re_atom_has(const struct re_atom *atom, unsigned char c)
+{
+  return (atom->set[c / 8] >> (c % 8)) & 1;
+}
+
+// Parses the pattern that starts at 'regexp' and ends at the next '\n' or
+// '\0', with 'flags' among RE_IGNORE_CASE. Returns the end of the pattern, or
+// NULL if it is not valid, in which case 'error' (if not NULL) tells why.
+const char *re_parse(struct re_pattern *pattern, const char *regexp, int flags,
+    const char **error);
+void re_pattern_free(struct re_pattern *pattern);
+
+// Parses every pattern of 'regexp'. Returns 0 on success and -1 if some
+// pattern is not valid, as in re_parse.
+int re_parse_list(struct re_list *list, const char *regexp, int flags, const char **error);
+void re_list_free(struct re_list *list);
+
+// Leading atoms that may match nothing never decide whether an unanchored
+// pattern matches a line: if "x*rest" matches at some position then "rest"
+// matches after the x's, and if "rest" matches then "x*rest" matches at the
+// same position with no x. Returns the number of such atoms, which is 0 for
+// anchored patterns.
+int re_skippable_prefix(const struct re_pattern *pattern);
+
+// The longest run of RE_ONE literal atoms, folded or not, that every match of
+// 'pattern' contains. Returns the index of its first atom and sets 'length', which is 0
+// if there is none.
+int re_required_literal(const struct re_pattern *pattern, int *length);
+
+#endif // JGREP_REGEXP_H
@@ -0,0 +1,894 @@
+#define _GNU_SOURCE // memrchr
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "jgrep-output.h"
+#include "jgrep-scan.h"
+#include "jgrep-stats.h"
+
+// Chunks are at most this big, so that output starts early and the pending
+// hit buffers stay small ...
+enum { MAX_CHUNK_SIZE = 4 * 1024 * 1024 };
+// ... and at least this big, so that claiming a chunk stays cheap
+enum { MIN_CHUNK_SIZE = 64 * 1024 };
+// Chunks a worker may run ahead of the one being written, per thread
+enum { CHUNKS_IN_FLIGHT_PER_THREAD = 4 };
+// Buffers of a stream read ahead of the one being written, per thread. Each
+// read fills STREAM_BUFFER_SIZE bytes, behind a headroom for the end of the
+// previous buffer that grows past STREAM_HEADROOM only for longer lines.
+enum { STREAM_BUFFER_SIZE = 1024 * 1024 };
+enum { STREAM_HEADROOM = 64 * 1024 };
+enum { STREAM_BUFFERS_PER_THREAD = 2 };
+
+static void out_of_memory(void)
+{
+  fprintf(stderr, "out of memory\n");
+  exit(EXIT_FAILURE);
+}
+
+// Hits of one chunk, in order, as ranges of the mapping. Hits on consecutive
+// lines are merged into one range.
+struct hit_list
+{
+  struct iovec *ranges;
+  size_t count;
+  size_t capacity;
+};
+
+static void hit_list_append(struct hit_list *hits, const char *line, size_t length)
+{
+  if (hits->count > 0)
+  {
+    struct iovec *last = &hits->ranges[hits->count - 1];
+    if ((const char*)last->iov_base + last->iov_len == line)
+    {
+      last->iov_len += length;
+      return;
+    }
+  }
+
+  if (hits->count == hits->capacity)
+  {
+    size_t capacity = hits->capacity ? hits->capacity * 2 : 256;
+    struct iovec *ranges = realloc(hits->ranges, capacity * sizeof(*ranges));
+    if (ranges == NULL)
+      out_of_memory();
+    hits->ranges = ranges;
+    hits->capacity = capacity;
+  }
+
+  hits->ranges[hits->count].iov_base = (void*)line;
+  hits->ranges[hits->count].iov_len = length;
+  hits->count++;
+}
+
+long long scan_limit(const struct scan_mode *mode)
+{
+  long long limit = mode->max_count >= 0 ? mode->max_count : LLONG_MAX;
+  if ((mode->output == SCAN_FILE_NAMES || mode->output == SCAN_QUIET) && limit > 1)
+    limit = 1;
+  return limit;
+}
+
+void scan_write_summary(struct output *out, const struct scan_mode *mode,
+    const char *name, int with_name, long long num_matched)
+{
+  if (mode->output == SCAN_COUNT)
+  {
+    char count[32];
+    int length = snprintf(count, sizeof(count), "%lld\n", num_matched);
+    if (with_name)
+    {
+      output_copy(out, name, strlen(name));
+      output_copy(out, ":", 1);
+    }
+    output_copy(out, count, length);
+  }
+  else if (mode->output == SCAN_FILE_NAMES && num_matched > 0)
+  {
+    output_copy(out, name, strlen(name));
+    output_copy(out, "\n", 1);
+  }
+}
+
+// Writes the lines [begin, end) of the input, referenced. As grep, the last
+// line of an input that does not end with '\n' gets one.
+static void write_lines(struct output *out, const char *begin, const char *end)
+{
+  output_reference(out, begin, end - begin);
+  if (end[-1] != '\n')
+    output_copy(out, "\n", 1);
+}
+
+int scan_has_context(const struct scan_mode *mode)
+{
+  return mode->output == SCAN_LINES && (mode->before >= 0 || mode->after >= 0);
+}
+
+// The start of the first of the 'num_lines' lines before 'line', or of the
+// first line after 'floor' if there are fewer. 'line' and 'floor' start lines.
+static const char *lines_before(const char *floor, const char *line, long long num_lines)
+{
+  for (long long i = 0; i < num_lines && line > floor; i++)
+  {
+    // line[-1] ends the previous line
+    const char *eol = memrchr(floor, '\n', line - 1 - floor);
+    line = eol != NULL ? eol + 1 : floor;
+  }
+  return line;
+}
+
+void context_init(struct context *context, const struct scan_mode *mode)
+{
+  memset(context, 0, sizeof(*context));
+  context->before = mode->before > 0 ? mode->before : 0;
+  context->after = mode->after > 0 ? mode->after : 0;
+  context->written_end = -1;
+}
+
+void context_set_window(struct context *context, const char *begin, const char *end,
+    long long offset)
+{
+  context->begin = begin;
+  context->end = end;
+  context->offset = offset;
+}
+
+// The start of the window, or the end of the last line written if it is in
+// the window
+static const char *context_floor(const struct context *context)
+{
+  if (context->written_end <= context->offset)
+    return context->begin;
+  return context->begin + (context->written_end - context->offset);
+}
+
+static void context_write_line(struct context *context, struct output *out,
+    const char *line, const char *next, char mark)
+{
+  if (context->name != NULL)
+  {
+    output_copy(out, context->name, context->name_length);
+    output_copy(out, &mark, 1);
+  }
+  if (context->copy)
+    output_copy(out, line, next - line);
+  else
+    output_reference(out, line, next - line);
+  // As grep, terminate the last line of an input that does not end with '\n'
+  if (next[-1] != '\n')
+    output_copy(out, "\n", 1);
+
+  context->written_end = context->offset + (next - context->begin);
+}
+
+// Writes the lines left after the last hit that start before 'limit', a line
+// start or the end of the window
+static void context_write_after(struct context *context, struct output *out, const char *limit)
+{
+  if (context->written_end < context->offset)
+    return;
+
+  const char *line = context_floor(context);
+  while (context->after_left > 0 && line < limit)
+  {
+    const char *eol = memchr(line, '\n', limit - line);
+    const char *next = eol != NULL ? eol + 1 : limit;
+    context_write_line(context, out, line, next, '-');
+    context->after_left--;
+    line = next;
+  }
+}
+
+void context_write_hit(struct context *context, struct output *out,
+    const char *line, const char *next)
+{
+  context_write_after(context, out, line);
+
+  const char *start = lines_before(context_floor(context), line, context->before);
+  if (context->offset + (start - context->begin) != context->written_end)
+    output_separator(out);
+  while (start < line)
+  {
+    const char *eol = memchr(start, '\n', line - start);
+    context_write_line(context, out, start, eol + 1, '-');
+    start = eol + 1;
+  }
+
+  context_write_line(context, out, line, next, ':');
+  context->after_left = context->after;
+}
+
+int context_end_window(struct context *context, struct output *out)
+{
+  context_write_after(context, out, context->end);
+  return context->after_left > 0;
+}
+
+long long count_lines(const char *begin, const char *end)
+{
+  long long num_lines = 0;
+  for (const char *p = begin; p < end; p++)
+  {
+    p = memchr(p, '\n', end - p);
+    if (p == NULL)
+      return num_lines + 1;
+    num_lines++;
+  }
+  return num_lines;
+}
+
+long matcher_scan(const struct matcher *matcher, const char *begin, const char *end,
+    const char **hits, long max_hits, const char **next)
+{
+  const char *slice_end = end;
+  if (end - begin > SCAN_SLICE_SIZE)
+  {
+    const char *eol = memchr(begin + SCAN_SLICE_SIZE - 1, '\n', end - (begin + SCAN_SLICE_SIZE - 1));
+    if (eol != NULL)
+      slice_end = eol + 1;
+  }
+
+  long num_hits = 0;
+  long long num_lines = 0;
+  if (matcher->scan != NULL)
+  {
+    num_hits = matcher->scan(begin, slice_end, hits, max_hits, next);
+    // The JIT'd scan skips the lines it does not need to look at, so they are
+    // only counted for the stats
+    if (stats_enabled())
+      num_lines = count_lines(begin, *next);
+  }
+  else
+  {
+    const char *line = begin;
+    while (line < slice_end && num_hits < max_hits)
+    {
+      const char *eol = memchr(line, '\n', slice_end - line);
+
+      num_lines++;
+      if (matcher->match(line, eol != NULL ? eol : slice_end))
+        hits[num_hits++] = line;
+      line = eol != NULL ? eol + 1 : slice_end;
+    }
+    *next = line;
+  }
+
+  stats_add_scan(*next - begin, num_lines, num_hits);
+  return num_hits;
+}
+
+// Scans until 'limit' lines match. Matching lines go to 'hits' if not NULL,
+// else to 'out' if not NULL, through 'context' if not NULL. Returns the number
+// of matching lines.
+static long long scan_lines(const struct matcher *matcher, const char *line, const char *end,
+    struct hit_list *hits, struct output *out, struct context *context, long long limit)
+{
+  const char *batch[SCAN_BATCH_SIZE];
+  long long num_hits = 0;
+
+  while (line < end && num_hits < limit)
+  {
+    long max_hits = limit - num_hits < SCAN_BATCH_SIZE ? limit - num_hits : SCAN_BATCH_SIZE;
+    long n = matcher_scan(matcher, line, end, batch, max_hits, &line);
+    for (long i = 0; i < n; i++)
+    {
+      const char *eol = memchr(batch[i], '\n', end - batch[i]);
+      const char *next = eol != NULL ? eol + 1 : end;
+      if (hits != NULL)
+        hit_list_append(hits, batch[i], next - batch[i]);
+      else if (out != NULL && context != NULL)
+        context_write_hit(context, out, batch[i], next);
+      else if (out != NULL)
+        write_lines(out, batch[i], next);
+    }
+    num_hits += n;
+  }
+
+  return num_hits;
+}
+
+// Writes the first 'num_lines' lines of 'hits', through 'context' if not NULL
+static void write_hit_lines(struct output *out, struct context *context,
+    const struct hit_list *hits, long long num_lines)
+{
+  for (size_t i = 0; i < hits->count && num_lines > 0; i++)
+  {
+    const char *begin = hits->ranges[i].iov_base;
+    const char *end = begin + hits->ranges[i].iov_len;
+    const char *p = begin;
+    while (p < end && num_lines > 0)
+    {
+      const char *eol = memchr(p, '\n', end - p);
+      const char *next = eol != NULL ? eol + 1 : end;
+      if (context != NULL)
+        context_write_hit(context, out, p, next);
+      p = next;
+      num_lines--;
+    }
+    if (context == NULL)
+      write_lines(out, begin, p);
+  }
+}
+
+struct chunk
+{
+  struct hit_list hits;
+  long long num_hits;
+  int done;
+};
+
+struct parallel_scan
+{
+  const char *data;
+  size_t size;
+  size_t chunk_size;
+  const struct matcher *matcher;
+  long long limit;
+  int keep_lines;   // Whether the hits are written, or only counted
+  int any_hit_stops; // Whether a hit anywhere is enough (-l and -q)
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  struct chunk *chunks;
+  size_t num_chunks;
+  size_t next_chunk;    // Next chunk to be claimed by a worker
+  size_t next_to_write; // Next chunk to be written by the main thread
+  size_t max_in_flight;
+  long long num_found;  // Matching lines found by the workers
+  int stop;             // No more chunks are needed
+};
+
+// Chunk boundaries start lines: the nominal boundary is moved forward to just
+// after the next '\n'. Neighbouring chunks compute the same boundary on their
+// own, so no line is lost or scanned twice.
+static const char *chunk_boundary(const struct parallel_scan *scan, size_t index)
+{
+  size_t offset = index * scan->chunk_size;
+  if (offset == 0)
+    return scan->data;
+  if (offset >= scan->size)
+    return scan->data + scan->size;
+
+  const char *end = scan->data + scan->size;
+  const char *eol = memchr(scan->data + offset - 1, '\n', end - (scan->data + offset - 1));
+  return eol != NULL ? eol + 1 : end;
+}
+
+static void *scan_worker(void *info)
+{
+  struct parallel_scan *scan = info;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&scan->lock);
+    while (scan->next_chunk < scan->num_chunks && !scan->stop
+        && scan->next_chunk >= scan->next_to_write + scan->max_in_flight)
+      pthread_cond_wait(&scan->cond, &scan->lock);
+    if (scan->next_chunk == scan->num_chunks || scan->stop)
+    {
+      pthread_mutex_unlock(&scan->lock);
+      return NULL;
+    }
+    size_t index = scan->next_chunk++;
+    pthread_mutex_unlock(&scan->lock);
+
+    struct chunk *chunk = &scan->chunks[index];
+    chunk->num_hits = scan_lines(scan->matcher,
+        chunk_boundary(scan, index),
+        chunk_boundary(scan, index + 1),
+        scan->keep_lines ? &chunk->hits : NULL, NULL, NULL, scan->limit);
+
+    pthread_mutex_lock(&scan->lock);
+    chunk->done = 1;
+    scan->num_found += chunk->num_hits;
+    if (scan->any_hit_stops && chunk->num_hits > 0)
+      scan->stop = 1;
+    pthread_cond_broadcast(&scan->cond);
+    pthread_mutex_unlock(&scan->lock);
+  }
+}
+
+static long long grep_mapped_parallel(const struct input_map *map, const struct matcher *matcher,
+    int num_threads, const struct scan_mode *mode, struct output *out, struct context *context)
+{
+  struct parallel_scan scan;
+  memset(&scan, 0, sizeof(scan));
+
+  scan.data = map->data;
+  scan.size = map->size;
+  scan.matcher = matcher;
+  scan.limit = scan_limit(mode);
+  scan.keep_lines = mode->output == SCAN_LINES;
+  scan.any_hit_stops = mode->output == SCAN_FILE_NAMES || mode->output == SCAN_QUIET;
+
+  scan.chunk_size = map->size / ((size_t)num_threads * CHUNKS_IN_FLIGHT_PER_THREAD);
+  if (scan.chunk_size > MAX_CHUNK_SIZE)
+    scan.chunk_size = MAX_CHUNK_SIZE;
+  if (scan.chunk_size < MIN_CHUNK_SIZE)
+    scan.chunk_size = MIN_CHUNK_SIZE;
+
+  scan.num_chunks = (map->size + scan.chunk_size - 1) / scan.chunk_size;
+  scan.max_in_flight = (size_t)num_threads * CHUNKS_IN_FLIGHT_PER_THREAD;
+  scan.chunks = calloc(scan.num_chunks, sizeof(*scan.chunks));
+  if (scan.chunks == NULL)
+    out_of_memory();
+
+  pthread_mutex_init(&scan.lock, NULL);
+  pthread_cond_init(&scan.cond, NULL);
+
+  pthread_t *workers = calloc(num_threads, sizeof(*workers));
+  if (workers == NULL)
+    out_of_memory();
+
+  int num_workers = 0;
+  for (int i = 0; i < num_threads; i++)
+  {
+    int res = pthread_create(&workers[num_workers], NULL, scan_worker, &scan);
+    if (res != 0)
+    {
+      fprintf(stderr, "cannot create pthread: %s\n", strerror(res));
+      break;
+    }
+    num_workers++;
+  }
+
+  long long num_matched = 0;
+  if (num_workers == 0)
+  {
+    // Nobody to hand the chunks to, so scan them here
+    num_matched = scan_lines(matcher, map->data, map->data + map->size, NULL,
+        scan.keep_lines ? out : NULL, context, scan.limit);
+  }
+  else
+  {
+    // Write the chunks in file order as soon as each one is complete, up to
+    // the limit
+    for (size_t i = 0; i < scan.num_chunks && num_matched < scan.limit; i++)
+    {
+      struct chunk *chunk = &scan.chunks[i];
+
+      pthread_mutex_lock(&scan.lock);
+      while (!chunk->done && !scan.stop)
+        pthread_cond_wait(&scan.cond, &scan.lock);
+      int done = chunk->done;
+      pthread_mutex_unlock(&scan.lock);
+      if (!done)
+        break;
+
+      long long n = chunk->num_hits;
+      if (n > scan.limit - num_matched)
+        n = scan.limit - num_matched;
+      if (scan.keep_lines)
+        write_hit_lines(out, context, &chunk->hits, n);
+      num_matched += n;
+
+      pthread_mutex_lock(&scan.lock);
+      scan.next_to_write++;
+      if (num_matched == scan.limit)
+        scan.stop = 1;
+      pthread_cond_broadcast(&scan.cond);
+      pthread_mutex_unlock(&scan.lock);
+    }
+  }
+
+  // The writer may stop early, e.g. at -m, with workers waiting for room
+  pthread_mutex_lock(&scan.lock);
+  scan.stop = 1;
+  pthread_cond_broadcast(&scan.cond);
+  pthread_mutex_unlock(&scan.lock);
+
+  for (int i = 0; i < num_workers; i++)
+    pthread_join(workers[i], NULL);
+
+  // With -l and -q a hit in any chunk counts, written or not
+  if (scan.any_hit_stops && scan.num_found > 0)
+    num_matched = 1;
+
+  for (size_t i = 0; i < scan.num_chunks; i++)
+    free(scan.chunks[i].hits.ranges);
+  free(workers);
+  free(scan.chunks);
+  pthread_cond_destroy(&scan.cond);
+  pthread_mutex_destroy(&scan.lock);
+
+  return num_matched;
+}
+
+long long grep_mapped(const struct input_map *map, const char *name,
+    const struct matcher *matcher, int num_threads, const struct scan_mode *mode)
+{
+  struct output out;
+  output_init(&out, STDOUT_FILENO);
+  stats_add_files(1);
+
+  // The whole mapping is the window
+  struct context lines_around;
+  context_init(&lines_around, mode);
+  context_set_window(&lines_around, map->data, map->data + map->size, 0);
+  struct context *context = scan_has_context(mode) ? &lines_around : NULL;
+
+  long long num_matched;
+  if (num_threads <= 1 || map->size <= MIN_CHUNK_SIZE)
+    num_matched = scan_lines(matcher, map->data, map->data + map->size, NULL,
+        mode->output == SCAN_LINES ? &out : NULL, context, scan_limit(mode));
+  else
+    num_matched = grep_mapped_parallel(map, matcher, num_threads, mode, &out, context);
+  if (context != NULL)
+    context_end_window(context, &out);
+
+  scan_write_summary(&out, mode, name, 0, num_matched);
+  output_close(&out);
+  return num_matched;
+}
+
+// The buffers of the ring of grep_stream. Each one holds whole lines, so it
+// is matched as a mapping would be.
+enum buffer_state
+{
+  BUFFER_FREE,    // The reader may fill it
+  BUFFER_READING, // A read into it was submitted
+  BUFFER_FILLED,  // Waiting for a matcher
+  BUFFER_SCANNED, // Waiting to be written
+};
+
+// Each read goes to an aligned area after a headroom, where the partial line
+// left by the previous buffer is then copied, just before the bytes that
+// follow it
+struct stream_buffer
+{
+  char *base;      // From input_alloc
+  size_t headroom; // A multiple of INPUT_ALIGNMENT
+  char *data;      // Within the headroom
+  size_t size;
+  // Before 'data', also within the headroom: the last lines of the previous
+  // buffers, for the context of the first hits of this one
+  char *context;
+  long long offset; // Of 'data' in the input
+  enum buffer_state state;
+  struct hit_list hits;
+  long long num_hits;
+};
+
+struct stream_scan
+{
+  struct input_reader input; // Owned by the reader thread
+  const char *name;
+  const struct matcher *matcher;
+  long long limit;
+  int keep_lines;
+  int any_hit_stops;
+  long long before; // Lines kept before each buffer for its context
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  // Buffer k of the input is buffers[k % num_buffers]
+  struct stream_buffer *buffers;
+  size_t num_buffers;
+  size_t num_filled;    // Buffers of the input filled so far
+  size_t next_to_scan;  // Next buffer to be claimed by a matcher
+  size_t next_to_write; // Next buffer to be written by the main thread
+  int eof;              // num_filled is final
+  long long num_found;  // Matching lines found by the matchers
+  int stop;             // No more buffers are needed
+  int users;            // The last of the reader and the main thread frees it
+};
+
+static void stream_scan_release(struct stream_scan *scan)
+{
+  pthread_mutex_lock(&scan->lock);
+  int users = --scan->users;
+  pthread_mutex_unlock(&scan->lock);
+  if (users > 0)
+    return;
+
+  for (size_t i = 0; i < scan->num_buffers; i++)
+  {
+    free(scan->buffers[i].base);
+    free(scan->buffers[i].hits.ranges);
+  }
+  free(scan->buffers);
+  pthread_cond_destroy(&scan->cond);
+  pthread_mutex_destroy(&scan->lock);
+  free(scan);
+}
+
+// Gives 'buffer' a headroom of at least 'size' bytes, keeping the 'used' bytes
+// read after it
+static void stream_buffer_reserve(struct stream_buffer *buffer, size_t used, size_t size)
+{
+  if (size <= buffer->headroom)
+    return;
+  size_t headroom = (size + INPUT_ALIGNMENT - 1) / INPUT_ALIGNMENT * INPUT_ALIGNMENT;
+  char *base = input_alloc(headroom + STREAM_BUFFER_SIZE);
+  memcpy(base + headroom, buffer->base + buffer->headroom, used);
+  free(buffer->base);
+  buffer->base = base;
+  buffer->headroom = headroom;
+}
+
+// Fills the buffers in input order, each one up to its last '\n': the part
+// of a line that does not fit is moved to the start of the next buffer, and a
+// buffer without a '\n' is published empty, its line moving on whole. Reads
+// are submitted into every free buffer ahead, as many at a time as the
+// backend takes, so with io_uring the disk works on several while the oldest
+// is matched. The reader never gets more than the ring ahead of the writer.
+static void *stream_reader(void *info)
+{
+  struct stream_scan *scan = info;
+  struct input_reader *input = &scan->input;
+  char *carry = NULL;   // The partial line left by the last buffer filled
+  size_t carried = 0;
+  size_t carry_capacity = 0;
+  size_t num_submitted = 0;
+  long long offset = 0; // Of the carry in the input
+  int eof = 0;
+
+  while (!eof)
+  {
+    size_t first = num_submitted;
+    pthread_mutex_lock(&scan->lock);
+    for (;;)
+    {
+      while (input->num_pending + (int)(num_submitted - first) < input->max_in_flight
+          && !scan->stop)
+      {
+        struct stream_buffer *buffer = &scan->buffers[num_submitted % scan->num_buffers];
+        if (buffer->state != BUFFER_FREE)
+          break;
+        buffer->state = BUFFER_READING;
+        num_submitted++;
+      }
+      if (num_submitted > scan->num_filled || scan->stop)
+        break;
+      pthread_cond_wait(&scan->cond, &scan->lock);
+    }
+    int stop = scan->stop;
+    pthread_mutex_unlock(&scan->lock);
+    if (stop)
+      break;
+
+    for (size_t k = first; k < num_submitted; k++)
+    {
+      struct stream_buffer *buffer = &scan->buffers[k % scan->num_buffers];
+      input_reader_submit(input, buffer->base + buffer->headroom, STREAM_BUFFER_SIZE);
+    }
+
+    ssize_t n = input_reader_complete(input);
+    if (n < 0)
+    {
+      fprintf(stderr, "error reading '%s': %s\n", scan->name, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    eof = (size_t)n < STREAM_BUFFER_SIZE;
+
+    // The previous buffer may be being written, but it is not refilled until
+    // the ring comes round, past the reads in flight
+    const char *kept = NULL;
+    size_t num_kept = 0;
+    if (scan->before > 0 && scan->num_filled > 0)
+    {
+      const struct stream_buffer *previous = &scan->buffers[(scan->num_filled - 1) % scan->num_buffers];
+      const char *previous_end = previous->data + previous->size;
+      kept = lines_before(previous->context, previous_end, scan->before);
+      num_kept = previous_end - kept;
+    }
+
+    struct stream_buffer *buffer = &scan->buffers[scan->num_filled % scan->num_buffers];
+    stream_buffer_reserve(buffer, n, num_kept + carried);
+    buffer->data = buffer->base + buffer->headroom - carried;
+    buffer->context = buffer->data - num_kept;
+    buffer->offset = offset;
+    if (num_kept > 0)
+      memcpy(buffer->context, kept, num_kept);
+    memcpy(buffer->data, carry, carried);
+    buffer->size = carried + n;
+
+    carried = 0;
+    if (!eof)
+    {
+      const char *eol = memrchr(buffer->data, '\n', buffer->size);
+      size_t size = eol != NULL ? (size_t)(eol + 1 - buffer->data) : 0;
+      carried = buffer->size - size;
+      if (carried > carry_capacity)
+      {
+        carry_capacity = carried * 2;
+        free(carry);
+        carry = malloc(carry_capacity);
+        if (carry == NULL)
+          out_of_memory();
+      }
+      memcpy(carry, buffer->data + size, carried);
+      buffer->size = size;
+    }
+    offset += buffer->size;
+
+    pthread_mutex_lock(&scan->lock);
+    buffer->state = BUFFER_FILLED;
+    buffer->num_hits = 0;
+    buffer->hits.count = 0;
+    scan->num_filled++;
+    scan->eof = eof;
+    pthread_cond_broadcast(&scan->cond);
+    pthread_mutex_unlock(&scan->lock);
+  }
+
+  // Reads still in flight write into the buffers until they complete
+  input_reader_close(input);
+  free(carry);
+  stream_scan_release(scan);
+  return NULL;
+}
+
+static void *stream_matcher(void *info)
+{
+  struct stream_scan *scan = info;
+
+  pthread_mutex_lock(&scan->lock);
+  for (;;)
+  {
+    while (scan->next_to_scan == scan->num_filled && !scan->eof && !scan->stop)
+      pthread_cond_wait(&scan->cond, &scan->lock);
+    if (scan->next_to_scan == scan->num_filled || scan->stop)
+      break;
+    struct stream_buffer *buffer = &scan->buffers[scan->next_to_scan++ % scan->num_buffers];
+    pthread_mutex_unlock(&scan->lock);
+
+    long long num_hits = scan_lines(scan->matcher, buffer->data, buffer->data + buffer->size,
+        scan->keep_lines ? &buffer->hits : NULL, NULL, NULL, scan->limit);
+
+    pthread_mutex_lock(&scan->lock);
+    buffer->num_hits = num_hits;
+    buffer->state = BUFFER_SCANNED;
+    scan->num_found += num_hits;
+    if (scan->any_hit_stops && num_hits > 0)
+      scan->stop = 1;
+    pthread_cond_broadcast(&scan->cond);
+  }
+  pthread_mutex_unlock(&scan->lock);
+  return NULL;
+}
+
+long long grep_stream(struct input_reader *input, const char *name,
+    const struct matcher *matcher, int num_threads, const struct scan_mode *mode)
+{
+  struct output out;
+  output_init(&out, STDOUT_FILENO);
+  stats_add_files(1);
+
+  struct stream_scan *scan = calloc(1, sizeof(*scan));
+  if (scan == NULL)
+    out_of_memory();
+  scan->input = *input;
+  scan->name = name;
+  scan->matcher = matcher;
+  scan->limit = scan_limit(mode);
+  scan->keep_lines = mode->output == SCAN_LINES;
+  scan->any_hit_stops = mode->output == SCAN_FILE_NAMES || mode->output == SCAN_QUIET;
+  scan->before = scan_has_context(mode) && mode->before > 0 ? mode->before : 0;
+  scan->users = 2;
+  pthread_mutex_init(&scan->lock, NULL);
+  pthread_cond_init(&scan->cond, NULL);
+
+  // One more buffer than the matchers can hold for each read in flight
+  scan->num_buffers = (size_t)(num_threads > 1 ? num_threads : 1) * STREAM_BUFFERS_PER_THREAD
+    + input->max_in_flight;
+  scan->buffers = calloc(scan->num_buffers, sizeof(*scan->buffers));
+  if (scan->buffers == NULL)
+    out_of_memory();
+  for (size_t i = 0; i < scan->num_buffers; i++)
+  {
+    scan->buffers[i].headroom = STREAM_HEADROOM;
+    scan->buffers[i].base = input_alloc(STREAM_HEADROOM + STREAM_BUFFER_SIZE);
+  }
+
+  pthread_t reader;
+  int res = pthread_create(&reader, NULL, stream_reader, scan);
+  if (res != 0)
+  {
+    fprintf(stderr, "cannot create pthread: %s\n", strerror(res));
+    exit(EXIT_FAILURE);
+  }
+  // It may still be blocked in a read when the scan stops early
+  pthread_detach(reader);
+
+  // With a single thread the main thread matches the buffers itself
+  pthread_t *matchers = calloc(num_threads, sizeof(*matchers));
+  if (matchers == NULL)
+    out_of_memory();
+  int num_matchers = 0;
+  for (int i = 0; num_threads > 1 && i < num_threads; i++)
+  {
+    res = pthread_create(&matchers[num_matchers], NULL, stream_matcher, scan);
+    if (res != 0)
+    {
+      fprintf(stderr, "cannot create pthread: %s\n", strerror(res));
+      break;
+    }
+    num_matchers++;
+  }
+
+  struct context lines_around;
+  context_init(&lines_around, mode);
+  struct context *context = scan_has_context(mode) ? &lines_around : NULL;
+
+  // Write the buffers in input order as soon as each one is matched, up to
+  // the limit and the lines after the last hit, and hand them back to the
+  // reader
+  long long num_matched = 0;
+  int after_left = 0;
+  while (num_matched < scan->limit || after_left)
+  {
+    pthread_mutex_lock(&scan->lock);
+    struct stream_buffer *buffer = &scan->buffers[scan->next_to_write % scan->num_buffers];
+    while (!scan->stop && (scan->next_to_write == scan->num_filled
+          ? !scan->eof
+          : num_matchers > 0 && buffer->state != BUFFER_SCANNED))
+      pthread_cond_wait(&scan->cond, &scan->lock);
+    int done = scan->stop || scan->next_to_write == scan->num_filled;
+    pthread_mutex_unlock(&scan->lock);
+    if (done)
+      break;
+
+    if (context != NULL)
+      context_set_window(context, buffer->context, buffer->data + buffer->size,
+          buffer->offset - (buffer->data - buffer->context));
+
+    // Past the limit only the lines after the last hit are left to write
+    long long n = 0;
+    if (num_matched < scan->limit && num_matchers == 0)
+    {
+      n = scan_lines(matcher, buffer->data, buffer->data + buffer->size, NULL,
+          scan->keep_lines ? &out : NULL, context, scan->limit - num_matched);
+    }
+    else if (num_matched < scan->limit)
+    {
+      n = buffer->num_hits;
+      if (n > scan->limit - num_matched)
+        n = scan->limit - num_matched;
+      if (scan->keep_lines)
+        write_hit_lines(&out, context, &buffer->hits, n);
+    }
+    num_matched += n;
+    if (context != NULL)
+      after_left = context_end_window(context, &out);
+    // The hits point into the buffer
+    output_flush(&out);
+
+    pthread_mutex_lock(&scan->lock);
+    buffer->state = BUFFER_FREE;
+    scan->next_to_write++;
+    if (num_matched == scan->limit && !after_left)
+      scan->stop = 1;
+    pthread_cond_broadcast(&scan->cond);
+    pthread_mutex_unlock(&scan->lock);
+  }
+
+  // The writer may stop early, e.g. at -m, with the reader still reading
+  pthread_mutex_lock(&scan->lock);
+  scan->stop = 1;
+  pthread_cond_broadcast(&scan->cond);
+  pthread_mutex_unlock(&scan->lock);
+
+  for (int i = 0; i < num_matchers; i++)
+    pthread_join(matchers[i], NULL);
+  free(matchers);
+
+  // With -l and -q a hit in any buffer counts, written or not
+  if (scan->any_hit_stops && scan->num_found > 0)
+    num_matched = 1;
+
+  stream_scan_release(scan);
+  scan_write_summary(&out, mode, name, 0, num_matched);
+  output_close(&out);
+  return num_matched;
+}
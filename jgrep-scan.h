@@ -0,0 +1,154 @@
+#ifndef JGREP_SCAN_H
+#define JGREP_SCAN_H
+
+#include <stdio.h>
+
+#include "jgrep-input.h"
+#include "jgrep-output.h"
+
+// Returns nonzero if the line [begin, end) matches. The line is not
+// NUL-terminated and may or may not include its trailing '\n'. Both the
+// interpreter and the JIT'd "match" have this signature.
+typedef int (*match_fun_t)(const char *begin, const char *end);
+
+// Matches the lines of [begin, end), which starts a line, and stores the
+// start of each matching line in 'hits'. Stops once it has stored 'max_hits'
+// of them, right after the line of the last one, or at end. Stores where it
+// stopped in '*next' and returns the number of hits. The JIT'd "scan" has
+// this signature: it runs "match" inline on every line, so a whole buffer
+// costs one call instead of one per line.
+typedef long (*scan_fun_t)(const char *begin, const char *end,
+    const char **hits, long max_hits, const char **next);
+
+// A compiled regexp. 'scan' is optional: without it lines are matched one by
+// one with 'match'.
+struct matcher
+{
+  match_fun_t match;
+  scan_fun_t scan;
+};
+
+// The lines of [begin, end), counting a last one without '\n'
+long long count_lines(const char *begin, const char *end);
+
+// Bytes matched by one call of a scan_fun_t in matcher_scan, and the hits
+// callers usually collect with one call
+enum { SCAN_SLICE_SIZE = 256 * 1024 };
+enum { SCAN_BATCH_SIZE = 256 };
+
+// Scans the lines of [begin, end) with 'matcher' as a scan_fun_t would, but
+// stops after the line that crosses SCAN_SLICE_SIZE bytes, so that the matcher
+// can change between calls (see jgrep-concurrent.c). Adds what it scanned to
+// the stats.
+long matcher_scan(const struct matcher *matcher, const char *begin, const char *end,
+    const char **hits, long max_hits, const char **next);
+
+// What a scan writes for each file
+enum scan_output
+{
+  SCAN_LINES,      // The matching lines
+  SCAN_COUNT,      // -c: the number of matching lines
+  SCAN_FILE_NAMES, // -l: the name of the file if a line matches
+  SCAN_QUIET,      // -q: nothing
+};
+
+struct scan_mode
+{
+  enum scan_output output;
+  // -m: matching lines per file after which the scan of the file stops, -1
+  // for no limit
+  long long max_count;
+  // -B and -A: lines written before and after each matching line with
+  // SCAN_LINES, -1 if not given. With either of them, even at 0, groups of
+  // lines that are not adjacent are separated by "--", as in grep.
+  long long before;
+  long long after;
+};
+
+// The matching lines a scan of a file in 'mode' needs to find before it can
+// stop: max_count, or one for -l and -q, which only need to know whether
+// there is any
+long long scan_limit(const struct scan_mode *mode);
+
+// Whether 'mode' writes lines around the matching ones
+int scan_has_context(const struct scan_mode *mode);
+
+// Writes matching lines with the lines around them, as grep -A, -B and -C do.
+// The hits of a file must come in order, but they may come from several
+// chunks or buffers scanned in parallel.
+//
+// The lines around a hit are found from the hit itself, by searching for
+// '\n' back and forth in the part of the input in memory, the window: they
+// are written straight from the mapping or buffer, neither copied nor read
+// again, and the JIT'd scan still skips the lines it does not need to look
+// at. Positions are kept as offsets in the input, so that the window can move
+// along a stream.
+struct context
+{
+  long long before;
+  long long after;
+  // With a name, lines are prefixed with it and ':' for hits or '-' for the
+  // lines around them
+  const char *name;
+  size_t name_length;
+  int copy; // Lines do not outlive the window, so they are copied
+  // [begin, end) is at 'offset' in the input
+  const char *begin;
+  const char *end;
+  long long offset;
+  long long written_end; // Offset of the end of the last line written, -1 if none
+  long long after_left;  // Lines still to write after the last hit
+};
+
+void context_init(struct context *context, const struct scan_mode *mode);
+
+// Moves the window to [begin, end), at 'offset' in the input. The window
+// left must have been ended with context_end_window.
+void context_set_window(struct context *context, const char *begin, const char *end,
+    long long offset);
+
+// Writes the hit [line, next) of the window, after the lines left after the
+// previous hit and the lines before this one that were not written yet
+void context_write_hit(struct context *context, struct output *out,
+    const char *line, const char *next);
+
+// Writes the lines after the last hit up to the end of the window. Returns
+// nonzero if more are needed from the next window.
+int context_end_window(struct context *context, struct output *out);
+
+// Writes what 'mode' writes for a file after its lines, e.g. its count of
+// matching lines. 'name' is written first if 'with_name'.
+void scan_write_summary(struct output *out, const struct scan_mode *mode,
+    const char *name, int with_name, long long num_matched);
+
+// Writes to stdout the lines of the mapping of 'name' that 'matcher' matches,
+// or what 'mode' asks for instead. Returns the number of
+// matching lines found, which stops at scan_limit.
+//
+// With num_threads > 1 the mapping is split into newline-aligned chunks that a
+// pool of threads matches concurrently, all of them using the same 'matcher'.
+// The hits of every chunk are collected as ranges of the mapping and written
+// in file order, so the output is identical to a serial run. Once the limit
+// is reached no more chunks are started.
+//
+// Hits are written in batches with writev (see jgrep-output.h), straight from
+// the mapping, and so are the lines around them: the whole mapping is the
+// window of the context, so hits near the end of a chunk reach into the next
+// one.
+long long grep_mapped(const struct input_map *map, const char *name,
+    const struct matcher *matcher, int num_threads, const struct scan_mode *mode);
+
+// Same for an input that is not mapped, e.g. a pipe or a file read with
+// --io=read, direct or uring. A reader thread fills a ring of large buffers
+// with whole lines through 'input', which it takes over and closes, while the
+// matchers take the filled ones, so reads overlap with matching. With num_threads > 1 that many
+// threads match buffers concurrently and the main thread writes their hits in
+// input order; otherwise the main thread matches them itself. The reader
+// waits for a buffer to be written before refilling it, so memory stays
+// bounded by the ring whatever the size of the input. With -B each buffer
+// starts with a copy of the last lines of the previous one, for its first
+// hits; lines after the last hit of a buffer are written from the next one.
+long long grep_stream(struct input_reader *input, const char *name,
+    const struct matcher *matcher, int num_threads, const struct scan_mode *mode);
+
+#endif // JGREP_SCAN_H
@@ -0,0 +1,190 @@
+#include <stdio.h>
+
+#include <stdatomic.h>
+#include <time.h>
+
+#include "jgrep-stats.h"
+
+enum { STATS_MAX_TIERS = 4 };
+
+static const char *const phase_names[STATS_NUM_PHASES] = {
+  [STATS_CACHE_LOAD] = "cache_load",
+  [STATS_CODE_GENERATION] = "code_generation",
+  [STATS_COMPILATION] = "compilation",
+  [STATS_GET_CODE] = "get_code",
+  [STATS_SCAN] = "scan",
+};
+
+static struct
+{
+  int enabled;
+  double start_ns;
+
+  atomic_llong phase_ns[STATS_NUM_PHASES];
+  atomic_int phase_count[STATS_NUM_PHASES];
+
+  atomic_llong files;
+  atomic_llong bytes;
+  atomic_llong lines;
+  atomic_llong hits;
+
+  const char *strategy;
+  const char *io;
+  const char *profile;
+  struct
+  {
+    const char *name;
+    double ns;
+    long long lines;
+  } tiers[STATS_MAX_TIERS];
+  int num_tiers;
+} stats;
+
+static double monotonic_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+void stats_init(int enabled)
+{
+  stats.enabled = enabled;
+  if (enabled)
+    stats.start_ns = monotonic_ns();
+}
+
+int stats_enabled(void)
+{
+  return stats.enabled;
+}
+
+double stats_now_ns(void)
+{
+  return stats.enabled ? monotonic_ns() : 0;
+}
+
+void stats_add_phase(enum stats_phase phase, double start_ns)
+{
+  if (!stats.enabled)
+    return;
+  atomic_fetch_add(&stats.phase_ns[phase], (long long)(monotonic_ns() - start_ns));
+  atomic_fetch_add(&stats.phase_count[phase], 1);
+}
+
+void stats_add_scan(long long bytes, long long lines, long long hits)
+{
+  if (!stats.enabled)
+    return;
+  atomic_fetch_add(&stats.bytes, bytes);
+  atomic_fetch_add(&stats.lines, lines);
+  atomic_fetch_add(&stats.hits, hits);
+}
+
+void stats_add_files(long long files)
+{
+  if (stats.enabled)
+    atomic_fetch_add(&stats.files, files);
+}
+
+void stats_add_tier(const char *name, double ns, long long lines)
+{
+  if (!stats.enabled || stats.num_tiers == STATS_MAX_TIERS)
+    return;
+  stats.tiers[stats.num_tiers].name = name;
+  stats.tiers[stats.num_tiers].ns = ns;
+  stats.tiers[stats.num_tiers].lines = lines;
+  stats.num_tiers++;
+}
+
+void stats_set_strategy(const char *strategy)
+{
+  stats.strategy = strategy;
+}
+
+void stats_set_io(const char *io)
+{
+  stats.io = io;
+}
+
+void stats_set_profile(const char *profile)
+{
+  stats.profile = profile;
+}
+
+static void print_string(const char *s)
+{
+  fputc('"', stderr);
+  for (; *s != '\0'; s++)
+  {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(stderr, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(stderr, "\\u%04x", c);
+    else
+      fputc(c, stderr);
+  }
+  fputc('"', stderr);
+}
+
+void stats_print(const char *program, const char *regexp)
+{
+  if (!stats.enabled)
+    return;
+
+  fprintf(stderr, "{\n  \"program\": ");
+  print_string(program);
+  fprintf(stderr, ",\n  \"regexp\": ");
+  print_string(regexp);
+  if (stats.strategy != NULL)
+  {
+    fprintf(stderr, ",\n  \"strategy\": ");
+    print_string(stats.strategy);
+  }
+  if (stats.io != NULL)
+  {
+    fprintf(stderr, ",\n  \"io\": ");
+    print_string(stats.io);
+  }
+  if (stats.profile != NULL)
+  {
+    fprintf(stderr, ",\n  \"profile\": ");
+    print_string(stats.profile);
+  }
+  fprintf(stderr, ",\n  \"total_ms\": %.3f", (monotonic_ns() - stats.start_ns) / 1e6);
+
+  fprintf(stderr, ",\n  \"phases\": {");
+  for (int i = 0; i < STATS_NUM_PHASES; i++)
+    fprintf(stderr, "%s\n    \"%s\": { \"ms\": %.3f, \"count\": %d }",
+        i > 0 ? "," : "", phase_names[i],
+        atomic_load(&stats.phase_ns[i]) / 1e6, atomic_load(&stats.phase_count[i]));
+  fprintf(stderr, "\n  }");
+
+  fprintf(stderr, ",\n  \"files\": %lld", atomic_load(&stats.files));
+  fprintf(stderr, ",\n  \"bytes\": %lld", atomic_load(&stats.bytes));
+  fprintf(stderr, ",\n  \"lines\": %lld", atomic_load(&stats.lines));
+  fprintf(stderr, ",\n  \"hits\": %lld", atomic_load(&stats.hits));
+
+  // The first tier that is not the first matcher is the JIT'd code taking
+  // over from the interpreter
+  if (stats.num_tiers > 1)
+    fprintf(stderr, ",\n  \"jit_swap_ms\": %.3f", stats.tiers[1].ns / 1e6);
+  else
+    fprintf(stderr, ",\n  \"jit_swap_ms\": null");
+
+  if (stats.num_tiers > 0)
+  {
+    fprintf(stderr, ",\n  \"tiers\": [");
+    for (int i = 0; i < stats.num_tiers; i++)
+    {
+      fprintf(stderr, "%s\n    { \"name\": ", i > 0 ? "," : "");
+      print_string(stats.tiers[i].name);
+      fprintf(stderr, ", \"ready_ms\": %.3f, \"lines\": %lld }",
+          stats.tiers[i].ns / 1e6, stats.tiers[i].lines);
+    }
+    fprintf(stderr, "\n  ]");
+  }
+
+  fprintf(stderr, "\n}\n");
+}
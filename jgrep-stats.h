@@ -0,0 +1,56 @@
+#ifndef JGREP_STATS_H
+#define JGREP_STATS_H
+
+// Where the time of a run goes, measured with the monotonic clock: the phases
+// of building the matcher (the same as the Extrae events of
+// jgrep-concurrent), the scan, what was scanned and when the JIT'd code
+// replaced the interpreter. Printed as JSON on stderr with --stats.
+//
+// Phases may run on several threads at once (e.g. compiling while scanning)
+// and their times are added up. When stats are disabled the clock is not
+// read; scans still count their lines and hits, which costs next to nothing,
+// except for the JIT'd scan, which does not look at every line.
+
+enum stats_phase
+{
+  STATS_CACHE_LOAD,
+  STATS_CODE_GENERATION,
+  STATS_COMPILATION,
+  STATS_GET_CODE,
+  STATS_SCAN,
+  STATS_NUM_PHASES,
+};
+
+// Starts the clock of the run
+void stats_init(int enabled);
+
+// Whether --stats asked for them, for counts that cost something to get
+int stats_enabled(void);
+
+// Nanoseconds of the monotonic clock, 0 when stats are disabled
+double stats_now_ns(void);
+
+// Adds the time since 'start_ns', from stats_now_ns, to 'phase'
+void stats_add_phase(enum stats_phase phase, double start_ns);
+
+// Adds a scanned file, or part of one
+void stats_add_scan(long long bytes, long long lines, long long hits);
+void stats_add_files(long long files);
+
+// The matcher named 'name' replaced the previous one at 'ns' since the start
+// of the run, then matched 'lines' lines
+void stats_add_tier(const char *name, double ns, long long lines);
+
+// How the program decided to compile, e.g. jit_strategy_name
+void stats_set_strategy(const char *strategy);
+
+// How the input was read, e.g. input_backend_name
+void stats_set_io(const char *io);
+
+// How the JIT'd matcher was compiled, e.g. codegen_profile_name
+void stats_set_profile(const char *profile);
+
+// Prints the stats, if enabled, as a JSON object on stderr
+void stats_print(const char *program, const char *regexp);
+
+#endif // JGREP_STATS_H
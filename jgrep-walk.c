@@ -0,0 +1,722 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "jgrep-input.h"
+#include "jgrep-output.h"
+#include "jgrep-stats.h"
+#include "jgrep-walk.h"
+
+// Files found in a directory are searched in batches of this many, so that
+// scheduling costs little next to small files ...
+enum { FILES_PER_BATCH = 32 };
+// ... which are read rather than mapped, as mapping costs more than copying
+// them
+enum { SMALL_FILE_SIZE = 256 * 1024 };
+// Files this big are split into chunks searched by different workers
+enum { HUGE_FILE_SIZE = 16 * 1024 * 1024 };
+enum { CHUNK_SIZE = 4 * 1024 * 1024 };
+
+static void out_of_memory(void)
+{
+  fprintf(stderr, "out of memory\n");
+  exit(EXIT_FAILURE);
+}
+
+// Hits of a chunk, one iovec per line
+struct line_list
+{
+  struct iovec *lines;
+  size_t count;
+  size_t capacity;
+};
+
+static void line_list_append(struct line_list *list, const char *line, size_t length)
+{
+  if (list->count == list->capacity)
+  {
+    size_t capacity = list->capacity ? list->capacity * 2 : 64;
+    struct iovec *lines = realloc(list->lines, capacity * sizeof(*lines));
+    if (lines == NULL)
+      out_of_memory();
+    list->lines = lines;
+    list->capacity = capacity;
+  }
+
+  list->lines[list->count].iov_base = (void*)line;
+  list->lines[list->count].iov_len = length;
+  list->count++;
+}
+
+// A file split into chunks. The worker that completes the last chunk writes
+// the hits of all of them.
+struct huge_file
+{
+  char *path;
+  struct input_map map;
+  size_t num_chunks;
+  atomic_size_t remaining;
+  struct line_list *hits; // Of each chunk
+};
+
+enum work_type
+{
+  WORK_DIRECTORY, // paths[0] is a directory to read
+  WORK_FILES,     // paths[0 .. num_paths) are files to search
+  WORK_CHUNK,     // Chunk 'chunk' of 'file'
+};
+
+struct work
+{
+  enum work_type type;
+  int num_paths;
+  char *paths[FILES_PER_BATCH];
+  struct huge_file *file;
+  size_t chunk;
+};
+
+// The items of a worker. The worker pushes and pops at the tail, thieves
+// take from the head: the owner works depth first, on what is most likely
+// still in its caches, and thieves take the oldest items, which tend to be
+// the biggest (directories near the roots).
+struct deque
+{
+  pthread_mutex_t lock;
+  struct work **items; // items[i & (capacity - 1)] for head <= i < tail
+  size_t head;
+  size_t tail;
+  size_t capacity;
+};
+
+struct walk;
+
+struct worker
+{
+  struct walk *walk;
+  struct deque deque;
+  struct output out;
+  unsigned int seed;     // Picks the workers to steal from
+  char *buffer;          // Small files are read here, from input_alloc
+  size_t buffer_capacity;
+};
+
+struct walk
+{
+  const struct matcher *matcher;
+  int recursive;
+  int with_filename;
+  const struct scan_mode *mode;
+  long long limit; // Of matching lines per file, see scan_limit
+  enum input_backend io;
+
+  struct worker *workers;
+  int num_workers;
+
+  // Items pushed and not yet completed. The walk is over when it drops to 0.
+  atomic_long pending;
+  atomic_int errors;
+  atomic_llong matched;
+  // With -q the first hit settles it: the items left are dropped
+  atomic_int stop;
+
+  pthread_mutex_t output_lock;
+  int output_started; // Guarded by output_lock, see output_init_shared
+};
+
+static void report_error(struct walk *walk, const char *path, int error)
+{
+  fprintf(stderr, "jgrep: %s: %s\n", path, strerror(error));
+  atomic_fetch_add(&walk->errors, 1);
+}
+
+static void deque_init(struct deque *deque)
+{
+  pthread_mutex_init(&deque->lock, NULL);
+  deque->capacity = 64;
+  deque->items = malloc(deque->capacity * sizeof(*deque->items));
+  if (deque->items == NULL)
+    out_of_memory();
+  deque->head = deque->tail = 0;
+}
+
+static void deque_destroy(struct deque *deque)
+{
+  pthread_mutex_destroy(&deque->lock);
+  free(deque->items);
+}
+
+static void push(struct worker *worker, struct work *item)
+{
+  struct deque *deque = &worker->deque;
+
+  // Counted before it can be stolen and completed
+  atomic_fetch_add(&worker->walk->pending, 1);
+
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail - deque->head == deque->capacity)
+  {
+    size_t capacity = deque->capacity * 2;
+    struct work **items = malloc(capacity * sizeof(*items));
+    if (items == NULL)
+      out_of_memory();
+    for (size_t i = deque->head; i != deque->tail; i++)
+      items[i & (capacity - 1)] = deque->items[i & (deque->capacity - 1)];
+    free(deque->items);
+    deque->items = items;
+    deque->capacity = capacity;
+  }
+  deque->items[deque->tail++ & (deque->capacity - 1)] = item;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+static struct work *pop(struct deque *deque)
+{
+  struct work *item = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail != deque->head)
+    item = deque->items[--deque->tail & (deque->capacity - 1)];
+  pthread_mutex_unlock(&deque->lock);
+  return item;
+}
+
+static struct work *steal(struct deque *deque)
+{
+  struct work *item = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail != deque->head)
+    item = deque->items[deque->head++ & (deque->capacity - 1)];
+  pthread_mutex_unlock(&deque->lock);
+  return item;
+}
+
+// Tries every other worker, starting from a random one
+static struct work *steal_any(struct worker *worker)
+{
+  struct walk *walk = worker->walk;
+  int self = worker - walk->workers;
+  int first = rand_r(&worker->seed) % walk->num_workers;
+
+  for (int i = 0; i < walk->num_workers; i++)
+  {
+    int victim = (first + i) % walk->num_workers;
+    if (victim == self)
+      continue;
+    struct work *item = steal(&walk->workers[victim].deque);
+    if (item != NULL)
+      return item;
+  }
+  return NULL;
+}
+
+static struct work *new_work(enum work_type type)
+{
+  struct work *item = calloc(1, sizeof(*item));
+  if (item == NULL)
+    out_of_memory();
+  item->type = type;
+  return item;
+}
+
+static char *join_path(const char *dir, const char *name)
+{
+  size_t dir_length = strlen(dir);
+  size_t name_length = strlen(name);
+  int slash = dir_length > 0 && dir[dir_length - 1] != '/';
+
+  char *path = malloc(dir_length + slash + name_length + 1);
+  if (path == NULL)
+    out_of_memory();
+  memcpy(path, dir, dir_length);
+  if (slash)
+    path[dir_length] = '/';
+  memcpy(path + dir_length + slash, name, name_length + 1);
+  return path;
+}
+
+// Writes a hit, after the name of its file if there are several files. Lines
+// of a mapping are referenced, others copied.
+static void write_hit(struct worker *worker, const char *path, size_t path_length,
+    const char *line, const char *next, int copy)
+{
+  struct output *out = &worker->out;
+
+  if (worker->walk->with_filename)
+  {
+    output_copy(out, path, path_length);
+    output_copy(out, ":", 1);
+  }
+  if (copy)
+    output_copy(out, line, next - line);
+  else
+    output_reference(out, line, next - line);
+
+  // As grep, terminate the last line of a file that does not end with '\n'
+  if (next[-1] != '\n')
+    output_copy(out, "\n", 1);
+}
+
+// Writes what the mode writes after the lines of a file, and records its hits
+static void end_file(struct worker *worker, const char *path, long long num_matched)
+{
+  struct walk *walk = worker->walk;
+
+  scan_write_summary(&worker->out, walk->mode, path, walk->with_filename, num_matched);
+  if (num_matched > 0)
+  {
+    atomic_fetch_add(&walk->matched, num_matched);
+    if (walk->mode->output == SCAN_QUIET)
+      atomic_store(&walk->stop, 1);
+  }
+}
+
+// Scans [line, end) until 'limit' lines match and calls 'hit' on them.
+// Returns the number of matching lines.
+static long long scan_range(struct worker *worker, const char *line, const char *end,
+    long long limit, void (*hit)(struct worker *worker, void *info, const char *line, const char *next),
+    void *info)
+{
+  const char *batch[SCAN_BATCH_SIZE];
+  long long num_hits = 0;
+
+  while (line < end && num_hits < limit)
+  {
+    long max_hits = limit - num_hits < SCAN_BATCH_SIZE ? limit - num_hits : SCAN_BATCH_SIZE;
+    long n = matcher_scan(worker->walk->matcher, line, end, batch, max_hits, &line);
+    for (long i = 0; i < n; i++)
+    {
+      const char *eol = memchr(batch[i], '\n', end - batch[i]);
+      hit(worker, info, batch[i], eol != NULL ? eol + 1 : end);
+    }
+    num_hits += n;
+  }
+  return num_hits;
+}
+
+// The lines around the hits of a file, as write_hit writes them. NULL without
+// -A, -B or -C.
+static struct context *init_context(struct worker *worker, struct context *context,
+    const char *path, size_t path_length, const char *data, size_t size, int copy)
+{
+  struct walk *walk = worker->walk;
+  if (!scan_has_context(walk->mode))
+    return NULL;
+
+  context_init(context, walk->mode);
+  if (walk->with_filename)
+  {
+    context->name = path;
+    context->name_length = path_length;
+  }
+  context->copy = copy;
+  context_set_window(context, data, data + size, 0);
+  return context;
+}
+
+struct file_hit
+{
+  const char *path;
+  size_t path_length;
+  int copy;
+  struct context *context;
+};
+
+static void write_file_hit(struct worker *worker, void *info, const char *line, const char *next)
+{
+  struct file_hit *file = info;
+  if (file->context != NULL)
+    context_write_hit(file->context, &worker->out, line, next);
+  else if (worker->walk->mode->output == SCAN_LINES)
+    write_hit(worker, file->path, file->path_length, line, next, file->copy);
+}
+
+static void scan_file(struct worker *worker, const char *path,
+    const char *data, size_t size, int copy)
+{
+  struct context lines_around;
+  struct file_hit file = { path, strlen(path), copy, NULL };
+  file.context = init_context(worker, &lines_around, path, file.path_length, data, size, copy);
+  long long num_hits = scan_range(worker, data, data + size, worker->walk->limit,
+      write_file_hit, &file);
+  if (file.context != NULL)
+    context_end_window(file.context, &worker->out);
+
+  stats_add_files(1);
+  end_file(worker, path, num_hits);
+}
+
+static void append_chunk_hit(struct worker *worker, void *info, const char *line, const char *next)
+{
+  line_list_append(info, line, next - line);
+}
+
+// Same boundaries as the chunks of grep_mapped: the nominal boundary is moved
+// to just after the next '\n'
+static const char *chunk_boundary(const struct huge_file *file, size_t index)
+{
+  size_t offset = index * CHUNK_SIZE;
+  if (offset == 0)
+    return file->map.data;
+  if (offset >= file->map.size)
+    return file->map.data + file->map.size;
+
+  const char *end = file->map.data + file->map.size;
+  const char *start = file->map.data + offset - 1;
+  const char *eol = memchr(start, '\n', end - start);
+  return eol != NULL ? eol + 1 : end;
+}
+
+static void split_huge_file(struct worker *worker, const char *path, struct input_map *map)
+{
+  struct huge_file *file = calloc(1, sizeof(*file));
+  if (file == NULL)
+    out_of_memory();
+  file->path = strdup(path);
+  file->map = *map;
+  file->num_chunks = (map->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  atomic_init(&file->remaining, file->num_chunks);
+  file->hits = calloc(file->num_chunks, sizeof(*file->hits));
+  if (file->path == NULL || file->hits == NULL)
+    out_of_memory();
+
+  // In reverse, so that this worker pops them in file order
+  for (size_t i = file->num_chunks; i-- > 0;)
+  {
+    struct work *item = new_work(WORK_CHUNK);
+    item->file = file;
+    item->chunk = i;
+    push(worker, item);
+  }
+}
+
+// Every chunk stops at the limit on its own, and the writer keeps the first
+// 'limit' hits of them all. With -q the chunks left after a hit are skipped.
+static void search_chunk(struct worker *worker, struct huge_file *file, size_t index)
+{
+  struct walk *walk = worker->walk;
+
+  if (!atomic_load(&walk->stop))
+    scan_range(worker, chunk_boundary(file, index), chunk_boundary(file, index + 1),
+        walk->limit, append_chunk_hit, &file->hits[index]);
+
+  if (atomic_fetch_sub(&file->remaining, 1) != 1)
+    return;
+
+  stats_add_files(1);
+
+  // The last chunk done writes them all, in order, with the lines around
+  // them from the whole mapping
+  int write_lines = walk->mode->output == SCAN_LINES;
+  size_t path_length = strlen(file->path);
+  struct context lines_around;
+  struct context *context = init_context(worker, &lines_around, file->path, path_length,
+      file->map.data, file->map.size, 0);
+  long long num_matched = 0;
+  for (size_t i = 0; i < file->num_chunks; i++)
+  {
+    for (size_t j = 0; j < file->hits[i].count && num_matched < walk->limit; j++)
+    {
+      const char *hit = file->hits[i].lines[j].iov_base;
+      const char *next = hit + file->hits[i].lines[j].iov_len;
+      if (context != NULL)
+        context_write_hit(context, &worker->out, hit, next);
+      else if (write_lines)
+        write_hit(worker, file->path, path_length, hit, next, 0);
+      num_matched++;
+    }
+    free(file->hits[i].lines);
+  }
+  if (context != NULL)
+    context_end_window(context, &worker->out);
+  end_file(worker, file->path, num_matched);
+  output_flush(&worker->out);
+  output_end_file(&worker->out);
+
+  input_map_close(&file->map);
+  free(file->hits);
+  free(file->path);
+  free(file);
+}
+
+static void search_file(struct worker *worker, const char *path)
+{
+  struct walk *walk = worker->walk;
+
+  int fd = input_open(path);
+  if (fd < 0)
+  {
+    report_error(walk, path, errno);
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    report_error(walk, path, errno);
+    close(fd);
+    return;
+  }
+
+  if (S_ISDIR(st.st_mode))
+  {
+    close(fd);
+    if (!walk->recursive)
+    {
+      report_error(walk, path, EISDIR);
+      return;
+    }
+    struct work *item = new_work(WORK_DIRECTORY);
+    item->num_paths = 1;
+    item->paths[0] = strdup(path);
+    if (item->paths[0] == NULL)
+      out_of_memory();
+    push(worker, item);
+    return;
+  }
+
+  // --io=mmap maps every file it can, auto only the big ones
+  if (S_ISREG(st.st_mode) && st.st_size > 0
+      && (walk->io == INPUT_MMAP || (walk->io == INPUT_AUTO && st.st_size > SMALL_FILE_SIZE)))
+  {
+    close(fd);
+
+    struct input_map map;
+    if (input_map_open(&map, path) != 0)
+    {
+      report_error(walk, path, errno);
+      return;
+    }
+
+    if (map.size >= HUGE_FILE_SIZE && walk->num_workers > 1)
+    {
+      split_huge_file(worker, input_display_name(path), &map);
+      return;
+    }
+
+    scan_file(worker, input_display_name(path), map.data, map.size, 0);
+    // The hits point into the mapping
+    output_flush(&worker->out);
+    output_end_file(&worker->out);
+    input_map_close(&map);
+    return;
+  }
+
+  // Small files, anything that cannot be mapped and every file with the
+  // other backends are read whole
+  struct input_reader reader;
+  input_reader_init(&reader, fd, walk->io);
+  ssize_t size = input_read_all(&reader, &worker->buffer, &worker->buffer_capacity,
+      S_ISREG(st.st_mode) ? st.st_size : 0);
+  if (size < 0)
+    report_error(walk, path, errno);
+  else
+    scan_file(worker, input_display_name(path), worker->buffer, size, 1);
+  output_end_file(&worker->out);
+  input_reader_close(&reader);
+}
+
+// Files go in batches, directories in items of their own
+static void search_directory(struct worker *worker, const char *path)
+{
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+  {
+    report_error(worker->walk, path, errno);
+    return;
+  }
+
+  struct work *batch = NULL;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    const char *name = entry->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      continue;
+
+    int type = entry->d_type;
+    if (type == DT_UNKNOWN)
+    {
+      struct stat st;
+      if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        continue;
+      type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+
+    // Like grep -r, symbolic links and special files are not followed
+    if (type == DT_DIR)
+    {
+      struct work *item = new_work(WORK_DIRECTORY);
+      item->num_paths = 1;
+      item->paths[0] = join_path(path, name);
+      push(worker, item);
+    }
+    else if (type == DT_REG)
+    {
+      if (batch == NULL)
+        batch = new_work(WORK_FILES);
+      batch->paths[batch->num_paths++] = join_path(path, name);
+      if (batch->num_paths == FILES_PER_BATCH)
+      {
+        push(worker, batch);
+        batch = NULL;
+      }
+    }
+  }
+
+  if (batch != NULL)
+    push(worker, batch);
+  closedir(dir);
+}
+
+static void run(struct worker *worker, struct work *item)
+{
+  // Chunks still have to be counted down, so that their file is released
+  if (atomic_load(&worker->walk->stop) && item->type != WORK_CHUNK)
+    goto done;
+
+  switch (item->type)
+  {
+    case WORK_DIRECTORY:
+      search_directory(worker, item->paths[0]);
+      break;
+    case WORK_FILES:
+      for (int i = 0; i < item->num_paths; i++)
+        search_file(worker, item->paths[i]);
+      break;
+    case WORK_CHUNK:
+      search_chunk(worker, item->file, item->chunk);
+      break;
+  }
+
+done:
+  for (int i = 0; i < item->num_paths; i++)
+    free(item->paths[i]);
+  free(item);
+}
+
+static void *worker_run(void *info)
+{
+  struct worker *worker = info;
+  struct walk *walk = worker->walk;
+  int idle_rounds = 0;
+
+  for (;;)
+  {
+    struct work *item = pop(&worker->deque);
+    if (item == NULL)
+      item = steal_any(worker);
+
+    if (item == NULL)
+    {
+      if (atomic_load(&walk->pending) == 0)
+        break;
+      // Others are still working and may push more: spin a little, then
+      // back off
+      if (++idle_rounds < 64)
+        sched_yield();
+      else
+        nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = 100 * 1000 }, NULL);
+      continue;
+    }
+
+    idle_rounds = 0;
+    run(worker, item);
+    atomic_fetch_sub(&walk->pending, 1);
+  }
+
+  output_close(&worker->out);
+  return NULL;
+}
+
+long long grep_tree(char *const *paths, int num_paths, int recursive,
+    const struct matcher *matcher,
+    int num_threads, const struct scan_mode *mode, enum input_backend io, int *num_errors)
+{
+  struct walk walk;
+  memset(&walk, 0, sizeof(walk));
+  walk.matcher = matcher;
+  walk.recursive = recursive;
+  walk.mode = mode;
+  walk.limit = scan_limit(mode);
+  walk.io = io;
+  walk.num_workers = num_threads > 0 ? num_threads : 1;
+  atomic_init(&walk.pending, 0);
+  atomic_init(&walk.errors, 0);
+  atomic_init(&walk.matched, 0);
+  atomic_init(&walk.stop, 0);
+  pthread_mutex_init(&walk.output_lock, NULL);
+
+  // As grep, name the files unless there is a single one
+  struct stat st;
+  walk.with_filename = num_paths > 1
+    || (recursive && stat(paths[0], &st) == 0 && S_ISDIR(st.st_mode));
+
+  walk.workers = calloc(walk.num_workers, sizeof(*walk.workers));
+  if (walk.workers == NULL)
+    out_of_memory();
+  for (int i = 0; i < walk.num_workers; i++)
+  {
+    struct worker *worker = &walk.workers[i];
+    worker->walk = &walk;
+    worker->seed = i + 1;
+    deque_init(&worker->deque);
+    output_init_shared(&worker->out, STDOUT_FILENO, &walk.output_lock, &walk.output_started);
+  }
+
+  // The paths start on the deque of the main thread, which is worker 0, in
+  // reverse so that they are searched in order when there is a single worker
+  for (int i = (num_paths - 1) / FILES_PER_BATCH * FILES_PER_BATCH; i >= 0; i -= FILES_PER_BATCH)
+  {
+    struct work *batch = new_work(WORK_FILES);
+    for (int j = i; j < num_paths && j < i + FILES_PER_BATCH; j++)
+    {
+      batch->paths[batch->num_paths] = strdup(paths[j]);
+      if (batch->paths[batch->num_paths++] == NULL)
+        out_of_memory();
+    }
+    push(&walk.workers[0], batch);
+  }
+
+  pthread_t *threads = calloc(walk.num_workers, sizeof(*threads));
+  if (threads == NULL)
+    out_of_memory();
+
+  int num_started = 1;
+  for (int i = 1; i < walk.num_workers; i++)
+  {
+    int res = pthread_create(&threads[i], NULL, worker_run, &walk.workers[i]);
+    if (res != 0)
+    {
+      // The workers that did start take it all
+      fprintf(stderr, "cannot create pthread: %s\n", strerror(res));
+      break;
+    }
+    num_started++;
+  }
+
+  worker_run(&walk.workers[0]);
+
+  for (int i = 1; i < num_started; i++)
+    pthread_join(threads[i], NULL);
+
+  for (int i = 0; i < walk.num_workers; i++)
+  {
+    deque_destroy(&walk.workers[i].deque);
+    free(walk.workers[i].buffer);
+  }
+  free(threads);
+  free(walk.workers);
+  pthread_mutex_destroy(&walk.output_lock);
+
+  *num_errors = atomic_load(&walk.errors);
+  return atomic_load(&walk.matched);
+}
@@ -0,0 +1,36 @@
+#ifndef JGREP_WALK_H
+#define JGREP_WALK_H
+
+#include "jgrep-scan.h"
+
+// Writes to stdout the matching lines of several files, each prefixed with
+// the name of its file as in grep. With 'recursive', directories are searched
+// for files, but symbolic links and special files inside them are skipped
+// (like grep -r).
+//
+// Directories, batches of small files and chunks of huge files are work
+// items scheduled on 'num_threads' workers: each worker has a deque of items,
+// takes the most recent one of its own and steals the oldest one of another
+// worker when its deque is empty. Directories push the items they find on the
+// deque of the worker that reads them, so the walk itself is parallel. All the
+// workers use the same 'matcher'.
+//
+// The lines of a file are written in order and never interleaved with those
+// of another file, but the files come out in no particular order.
+//
+// 'mode' applies to each file as in grep_mapped. With -q the walk stops at the
+// first hit.
+//
+// 'io' is how files are read. With INPUT_AUTO files above a small size are
+// mapped and the others read whole, with INPUT_MMAP every regular file is
+// mapped, and the other backends read every file whole. Only mapped files are
+// split in chunks.
+//
+// Returns the number of matching lines written or counted. The number of
+// paths that could not be searched, which are reported on stderr, is stored
+// in 'num_errors'.
+long long grep_tree(char *const *paths, int num_paths, int recursive,
+    const struct matcher *matcher, int num_threads, const struct scan_mode *mode,
+    enum input_backend io, int *num_errors);
+
+#endif // JGREP_WALK_H
@@ -0,0 +1,70 @@
+#ifndef JGREP_H
+#define JGREP_H
+
+// libjgrep: the matchers of jgrep for programs that search many buffers
+// without running jgrep for each one. A regexp is compiled once into a
+// matcher, which then scans any number of buffers, from any number of threads
+// at once, until it is freed.
+//
+// Regexps are those of jgrep (see jgrep-regexp.h). Matchers are JIT'd with
+// libgccjit, as in jgrep-jit, unless JGREP_INTERPRET asks for the interpreter
+// of jgrep-basic, which costs nothing to build but matches slower. Each one is
+// built in a child of a context kept for the life of the process, which
+// declares once what the code of every regexp shares (see codegen_parent in
+// jgrep-codegen.h), unless JGREP_OWN_CONTEXT asks for a context of its own.
+//
+// Link with libjgrep.a -lgccjit -lpthread -ldl and with -rdynamic: the JIT'd
+// code calls helpers of the library by name.
+
+#include <stddef.h>
+
+enum
+{
+  JGREP_IGNORE_CASE = 1, // Match ASCII letters in either case, as -i
+  JGREP_INTERPRET = 2,   // Build no code, match with the interpreter
+  JGREP_OWN_CONTEXT = 4, // Build in a libgccjit context of its own (see below)
+};
+
+struct jgrep_matcher;
+
+// Compiles 'regexp', whose '\n's separate patterns as with -f, with 'flags'
+// among the ones above. Returns NULL if the regexp is not valid or does not
+// compile, in which case 'error' (if not NULL) tells why. Any number of
+// threads may compile at once.
+struct jgrep_matcher *jgrep_compile(const char *regexp, int flags, const char **error);
+
+// Compiles the 'num_regexps' regexps of 'regexps' as jgrep_compile, on
+// 'num_threads' threads (0 for one per CPU) that each take the next regexp
+// not compiled yet. Stores the matcher of regexps[i], or NULL, in
+// matchers[i] and, if 'errors' is not NULL, why it failed in errors[i].
+// Returns the number of regexps that failed.
+//
+// The threads overlap less than it seems. libgccjit holds one lock for the
+// whole process while it compiles a context (gcc_jit_context_compile), so
+// they never compile two regexps at once: with JGREP_OWN_CONTEXT they build
+// the code of some while another one compiles, and the time of the compiles
+// bounds how much faster than one thread they get. Without it the children of
+// the shared context are also built one at a time, and extra threads gain
+// little more than parsing the regexps at once.
+int jgrep_compile_all(const char *const *regexps, int num_regexps, int flags, int num_threads,
+    struct jgrep_matcher **matchers, const char **errors);
+
+// Seconds spent so far by the threads of the process together building the
+// code of matchers, and compiling it in gcc_jit_context_compile, waiting for
+// libgccjit's lock included. For benchmarks.
+void jgrep_compile_times(double *codegen_seconds, double *compile_seconds);
+
+// Finds the lines of [begin, end) that match, as the JIT'd "scan" of
+// jgrep-scan.h: 'begin' starts a line, and the last line may have no '\n'.
+// Stores the start of each matching line in 'hits' and stops once it has
+// stored 'max_hits' of them, right after the line of the last one, or at
+// 'end'. Stores where it stopped in '*next' and returns the number of hits.
+long jgrep_exec(const struct jgrep_matcher *matcher, const char *begin, const char *end,
+    const char **hits, long max_hits, const char **next);
+
+// Whether the single line [begin, end), with or without its '\n', matches
+int jgrep_match(const struct jgrep_matcher *matcher, const char *begin, const char *end);
+
+void jgrep_free(struct jgrep_matcher *matcher);
+
+#endif // JGREP_H